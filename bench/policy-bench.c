@@ -0,0 +1,102 @@
+#include "../src/policy.h"
+
+#include <time.h>
+
+// Benchmark our policy engine: compile a policy of a given number of rules, and time how many
+// routes a second can be run through it.
+//
+// usage: policy-bench [rules] [evaluations]
+
+#define BENCH_RULES_DEFAULT 256
+#define BENCH_EVALUATIONS_DEFAULT 10000000
+#define BENCH_ROUTES 4096
+
+// Write a policy file of rules rules, mixing prefix ranges, tags and metrics across both directions
+// and a handful of neighbours:
+static int bench_write_policy(const char *path, int rules) {
+
+	FILE *fp = fopen(path, "w");
+	if ( fp == NULL ) {
+		return 1;
+	}
+	for ( int i = 0; i < rules; i++ ) {
+		switch ( i % 4 ) {
+			case 0:
+				fprintf(fp, "in 192.0.2.%d deny prefix 10.%d.0.0/16 le 24\n", (i % 8) + 1, i % 256);
+				break;
+			case 1:
+				fprintf(fp, "in any permit prefix 172.%d.0.0/16 ge 20 le 28 set-metric +%d\n", i % 256, (i % 4) + 1);
+				break;
+			case 2:
+				fprintf(fp, "in any permit tag %d metric 1-%d set-tag %d\n", i, (i % 15) + 1, i + 1);
+				break;
+			default:
+				fprintf(fp, "out any deny prefix 10.%d.0.0/16 ge 24\n", i % 256);
+				break;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+
+	char path[] = "/tmp/policy-bench.XXXXXX";
+	int rules = ( argc > 1 ) ? atoi(argv[1]) : BENCH_RULES_DEFAULT;
+	long evaluations = ( argc > 2 ) ? atol(argv[2]) : BENCH_EVALUATIONS_DEFAULT;
+	uint32_t addrs[BENCH_ROUTES];
+	uint32_t subnets[BENCH_ROUTES];
+	uint32_t neighbour;
+	policy_t *policy;
+	policy_result_t result;
+	struct timespec start, end;
+	long permitted = 0;
+	double elapsed;
+	int fd;
+
+	if ( rules < 1 || rules > POLICY_MAX_RULES || evaluations < 1 ) {
+		fprintf(stderr, "usage: policy-bench [rules (1 - %d)] [evaluations]\n", POLICY_MAX_RULES);
+		return 1;
+	}
+
+	fd = mkstemp(path);
+	if ( fd < 0 ) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	if ( bench_write_policy(path, rules) != 0 ) {
+		perror("fopen");
+		unlink(path);
+		return 1;
+	}
+	policy = load_policy(path);
+	unlink(path);
+	if ( policy == NULL ) {
+		return 1;
+	}
+
+	// Routes drawn from the ranges our rules match (and some they don't):
+	srandom(1);
+	for ( int i = 0; i < BENCH_ROUTES; i++ ) {
+		uint8_t len = 16 + (random() % 17);
+		subnets[i] = htonl(0xFFFFFFFFu << (32 - len));
+		addrs[i] = htonl(((random() % 2 ? 10u : 172u) << 24) | (random() & 0x00FFFFFF)) & subnets[i];
+	}
+	inet_pton(AF_INET, "192.0.2.1", &neighbour);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for ( long i = 0; i < evaluations; i++ ) {
+		int r = i % BENCH_ROUTES;
+		permitted += policy_evaluate(policy, (i & 1) ? POLICY_DIR_OUT : POLICY_DIR_IN, neighbour,
+				addrs[r], subnets[r], (i % 15) + 1, i % 1024, &result);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d rule(s): %ld evaluations in %.3fs, %.0f evaluations/sec (%.1f ns each), %ld permitted\n",
+			rules, evaluations, elapsed, evaluations / elapsed, elapsed * 1e9 / evaluations, permitted);
+
+	policy_put(policy);
+	return 0;
+}
@@ -0,0 +1,340 @@
+#include "fib-writer.h"
+#include "route.h"
+#include "xripd-sched.h"
+
+// Our queue, one FIFO per op class, and a hash of every queued prefix.
+// Protected by mutex_queue, the writer sleeps on cond_queue until there is work:
+typedef struct fib_queue_t {
+	fib_op_t *head[FIB_OP_CLASSES];
+	fib_op_t *tail[FIB_OP_CLASSES];
+	fib_op_t *hash[FIB_WRITER_HASH_SIZE];
+	uint32_t count;
+	uint64_t first_ms; // When the queue last went from empty to not
+	pthread_mutex_t mutex_queue;
+	pthread_cond_t cond_queue;
+} fib_queue_t;
+
+static fib_queue_t fib_queue;
+
+// Hash a prefix into a bucket:
+static uint32_t fib_hash(uint32_t ipaddr, uint32_t subnet) {
+	return ((ipaddr * 2654435761u) ^ subnet) % FIB_WRITER_HASH_SIZE;
+}
+
+// Find the queued operation for a prefix (if any):
+static fib_op_t *fib_queue_find(uint32_t ipaddr, uint32_t subnet) {
+
+	fib_op_t *cur = fib_queue.hash[fib_hash(ipaddr, subnet)];
+
+	while ( cur != NULL ) {
+		if ( cur->entry.rip_msg_entry.ipaddr == ipaddr && cur->entry.rip_msg_entry.subnet == subnet ) {
+			return cur;
+		}
+		cur = cur->hnext;
+	}
+	return NULL;
+}
+
+// Has the rib queued the prefix again, since we took it off the queue? Takes mutex_queue:
+static int fib_queue_requeued(uint32_t ipaddr, uint32_t subnet) {
+
+	int requeued;
+
+	pthread_mutex_lock(&(fib_queue.mutex_queue));
+	requeued = ( fib_queue_find(ipaddr, subnet) != NULL );
+	pthread_mutex_unlock(&(fib_queue.mutex_queue));
+	return requeued;
+}
+
+// Join op onto the tail of the list for its class:
+static void fib_list_append(fib_op_t *op) {
+
+	op->next = NULL;
+	op->prev = fib_queue.tail[op->op];
+	if ( op->prev == NULL ) {
+		fib_queue.head[op->op] = op;
+	} else {
+		op->prev->next = op;
+	}
+	fib_queue.tail[op->op] = op;
+}
+
+// Remove op from the list for its class:
+static void fib_list_remove(fib_op_t *op) {
+
+	if ( op->prev == NULL ) {
+		fib_queue.head[op->op] = op->next;
+	} else {
+		op->prev->next = op->next;
+	}
+	if ( op->next == NULL ) {
+		fib_queue.tail[op->op] = op->prev;
+	} else {
+		op->next->prev = op->prev;
+	}
+}
+
+// Remove op from its hash bucket:
+static void fib_hash_remove(fib_op_t *op) {
+
+	fib_op_t **cur = &(fib_queue.hash[fib_hash(op->entry.rip_msg_entry.ipaddr, op->entry.rip_msg_entry.subnet)]);
+
+	while ( *cur != NULL ) {
+		if ( *cur == op ) {
+			*cur = op->hnext;
+			return;
+		}
+		cur = &((*cur)->hnext);
+	}
+}
+
+// Queue op for entry, merging with any operation still queued for the same prefix:
+//	+ Anything followed by a DELETE is a DELETE
+//	+ An INSTALL followed by an INSTALL remains an INSTALL (of the later route)
+//	+ Anything else is a REPLACE of the later route, as we can't know what the kernel holds for the prefix
+void fib_writer_queue(uint8_t op, const rib_entry_t *entry) {
+
+	fib_op_t *queued;
+	uint32_t bucket;
+	uint8_t force = op & FIB_OP_FORCE;
+
+	op &= ~FIB_OP_FORCE;
+
+	pthread_mutex_lock(&(fib_queue.mutex_queue));
+
+	queued = fib_queue_find(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+	if ( queued != NULL ) {
+
+		if ( op != FIB_OP_DELETE && !(op == FIB_OP_INSTALL && queued->op == FIB_OP_INSTALL) ) {
+			op = FIB_OP_REPLACE;
+		}
+#if XRIPD_DEBUG == 1
+		fprintf(stderr, "[fib]: Coalescing queued operation %d with %d.\n", queued->op, op);
+#endif
+		// Move into the list for our (possibly new) class:
+		fib_list_remove(queued);
+		queued->op = op;
+		queued->force |= force;
+		memcpy(&(queued->entry), entry, sizeof(rib_entry_t));
+		fib_list_append(queued);
+
+	} else {
+
+		queued = (fib_op_t *)malloc(sizeof(fib_op_t));
+		memset(queued, 0, sizeof(fib_op_t));
+		queued->op = op;
+		queued->force = force;
+		memcpy(&(queued->entry), entry, sizeof(rib_entry_t));
+		fib_list_append(queued);
+
+		bucket = fib_hash(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+		queued->hnext = fib_queue.hash[bucket];
+		fib_queue.hash[bucket] = queued;
+
+		if ( fib_queue.count == 0 ) {
+			fib_queue.first_ms = sched_now_ms();
+		}
+		fib_queue.count++;
+	}
+
+	pthread_cond_signal(&(fib_queue.cond_queue));
+	pthread_mutex_unlock(&(fib_queue.mutex_queue));
+}
+
+// Wait for work, and out our coalescing window. Then pull up to FIB_WRITER_BATCH operations out of the queue,
+// highest priority class first. Returns the amount of operations placed into batch:
+static int fib_queue_take(fib_op_t **batch) {
+
+	int count = 0;
+	fib_op_t *op;
+	uint64_t now = 0;
+	struct timespec hold;
+
+	pthread_mutex_lock(&(fib_queue.mutex_queue));
+
+	while ( fib_queue.count == 0 ) {
+		pthread_cond_wait(&(fib_queue.cond_queue), &(fib_queue.mutex_queue));
+	}
+
+	// Operations queued meanwhile coalesce with the ones already waiting:
+	now = sched_now_ms();
+	if ( now < fib_queue.first_ms + FIB_WRITER_COALESCE_MS ) {
+		hold.tv_sec = 0;
+		hold.tv_nsec = (fib_queue.first_ms + FIB_WRITER_COALESCE_MS - now) * 1000000;
+		pthread_mutex_unlock(&(fib_queue.mutex_queue));
+		nanosleep(&hold, NULL);
+		pthread_mutex_lock(&(fib_queue.mutex_queue));
+	}
+
+	for ( int c = 0; c < FIB_OP_CLASSES && count < FIB_WRITER_BATCH; c++ ) {
+		while ( fib_queue.head[c] != NULL && count < FIB_WRITER_BATCH ) {
+			op = fib_queue.head[c];
+			fib_list_remove(op);
+			fib_hash_remove(op);
+			fib_queue.count--;
+			batch[count++] = op;
+		}
+	}
+
+	pthread_mutex_unlock(&(fib_queue.mutex_queue));
+	return count;
+}
+
+// The batch holds part of the routes through a nexthop, the rest of them may be further back in the queue.
+// Pull out every queued op that lets a nexthop go whole (all of its routes deleted, or moved to one gateway) onto the end
+// of batch, so the decision is made against the whole queue rather than one batch. Returns the new count of batch:
+static int fib_queue_take_group(xripd_settings_t *xripd_settings, fib_op_t ***batch, int *batch_max, int count) {
+
+	fib_op_t *op;
+	fib_op_t *next;
+
+	pthread_mutex_lock(&(fib_queue.mutex_queue));
+
+	for ( int c = 0; c < FIB_OP_CLASSES; c++ ) {
+		for ( op = fib_queue.head[c]; op != NULL; op = op->next ) {
+			netlink_group_add(xripd_settings, &(op->entry), op->op == FIB_OP_DELETE, 1);
+		}
+	}
+
+	for ( int c = 0; c < FIB_OP_CLASSES; c++ ) {
+		for ( op = fib_queue.head[c]; op != NULL; op = next ) {
+			next = op->next;
+			if ( !netlink_group_whole(&(op->entry)) ) {
+				continue;
+			}
+			fib_list_remove(op);
+			fib_hash_remove(op);
+			fib_queue.count--;
+			if ( count == *batch_max ) {
+				*batch_max *= 2;
+				*batch = (fib_op_t **)realloc(*batch, *batch_max * sizeof(fib_op_t *));
+			}
+			(*batch)[count++] = op;
+		}
+	}
+
+	pthread_mutex_unlock(&(fib_queue.mutex_queue));
+	return count;
+}
+
+// Writer main loop. The rib lock is only taken to record state, never across a call into the kernel:
+static void fib_writer_loop(xripd_settings_t *xripd_settings) {
+
+	int batch_max = FIB_WRITER_BATCH;
+	fib_op_t **batch = (fib_op_t **)malloc(batch_max * sizeof(fib_op_t *));
+	netlink_ack_t acks[FIB_WRITER_BATCH * 2];
+	int count = 0;
+	int ack_count = 0;
+	int lost = 0;
+
+	while (1) {
+
+		count = fib_queue_take(batch);
+
+		// Group our ops by the nexthop their routes are installed through, so that the routes of a dead neighbour
+		// (or one whose gateway has changed) can share one message, however many batches they span:
+		for ( int i = 0; i < count; i++ ) {
+			netlink_group_add(xripd_settings, &(batch[i]->entry), batch[i]->op == FIB_OP_DELETE, 0);
+		}
+		if ( netlink_group_open() ) {
+			count = fib_queue_take_group(xripd_settings, &batch, &batch_max, count);
+		}
+		netlink_group_apply(xripd_settings);
+
+		// Build our netlink batch (stamps each entry with its seq):
+		for ( int i = 0; i < count; i++ ) {
+
+			if ( batch[i]->op == FIB_OP_DELETE ) {
+				netlink_delete_new_route(xripd_settings, &(batch[i]->entry));
+				continue;
+			}
+
+			// Nothing the kernel can see has changed (eg. only the metric), our route stands:
+			if ( !batch[i]->force && netlink_route_current(xripd_settings, &(batch[i]->entry)) ) {
+#if XRIPD_DEBUG == 1
+				fprintf(stderr, "[fib]: Kernel already holds route, skipping operation %d.\n", batch[i]->op);
+#endif
+				batch[i]->entry.fib_state = RIB_FIB_INSTALLED;
+				batch[i]->entry.fib_seq = 0;
+				continue;
+			}
+
+			switch (batch[i]->op) {
+				case FIB_OP_REPLACE:
+					netlink_replace_new_route(xripd_settings, &(batch[i]->entry));
+					break;
+				default:
+					netlink_install_new_route(xripd_settings, &(batch[i]->entry));
+					break;
+			}
+		}
+
+		// Record our seqs in the rib, so the ACKs can be matched to the latest request for each prefix
+		// (routes we skipped are recorded as installed). The rib queues under its lock, so a prefix it has
+		// requeued since is left pending on its newer op (its seq 0 then turns away the ACK of this one):
+		pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+		for ( int i = 0; i < count; i++ ) {
+			if ( fib_queue_requeued(batch[i]->entry.rip_msg_entry.ipaddr, batch[i]->entry.rip_msg_entry.subnet) ) {
+				continue;
+			}
+			(*xripd_settings->xripd_rib->update_fib_state)(batch[i]->entry.rip_msg_entry.ipaddr, 
+					batch[i]->entry.rip_msg_entry.subnet, batch[i]->entry.fib_seq, batch[i]->entry.fib_state);
+		}
+		pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+		netlink_group_end();
+
+		// Program the kernel, and collect its answers. The kernel has answered the whole batch by the time
+		// our send returns, so empty the socket before we sleep on the queue, leaving no route pending on an ACK:
+		netlink_flush_routes(xripd_settings);
+		while ( (ack_count = netlink_reap_acks(xripd_settings, acks, FIB_WRITER_BATCH * 2, &lost)) > 0 || lost ) {
+
+			pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+			for ( int i = 0; i < ack_count; i++ ) {
+				if ( acks[i].nlmsg_type == RTM_DELNEXTHOP || acks[i].nlmsg_type == RTM_NEWNEXTHOP ) {
+					rib_fib_group_ack(xripd_settings, acks[i].seq, acks[i].nlmsg_type, acks[i].error);
+				} else {
+					rib_fib_ack(xripd_settings, acks[i].ipaddr, acks[i].subnet, acks[i].seq, acks[i].nlmsg_type, acks[i].error);
+				}
+			}
+			if ( lost ) {
+				rib_fib_acks_lost(xripd_settings);
+			}
+			pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+		}
+
+		for ( int i = 0; i < count; i++ ) {
+			free(batch[i]);
+		}
+	}
+}
+
+// Entry point for our writer thread:
+static void *fib_writer_spawn(void *xripd_settings) {
+
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[fib]: FIB writer thread started.\n");
+#endif
+	fib_writer_loop((xripd_settings_t *)xripd_settings);
+	return NULL;
+}
+
+// Open our netlink socket and spawn the writer thread:
+int fib_writer_init(xripd_settings_t *xripd_settings) {
+
+	pthread_t fib_writer_thread;
+
+	memset(&fib_queue, 0, sizeof(fib_queue));
+	pthread_mutex_init(&(fib_queue.mutex_queue), NULL);
+	pthread_cond_init(&(fib_queue.cond_queue), NULL);
+
+	if ( init_netlink_fib(xripd_settings) != 0 ) {
+		return 1;
+	}
+
+	if ( pthread_create(&fib_writer_thread, NULL, &fib_writer_spawn, (void *)xripd_settings) != 0 ) {
+		fprintf(stderr, "[fib]: Unable to spawn FIB writer thread.\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef XRIPD_FIB_WRITER_H
+#define XRIPD_FIB_WRITER_H
+
+#include "xripd.h"
+#include "rib.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+// Threading:
+#include <pthread.h>
+#include <time.h>
+
+// Kernel operations, in the order the writer processes them.
+// Deletions of invalidated routes go first (stop forwarding into a black hole), then replaces, then new installs:
+#define FIB_OP_DELETE 0x00
+#define FIB_OP_REPLACE 0x01
+#define FIB_OP_INSTALL 0x02
+#define FIB_OP_CLASSES 3
+
+// OR'd into an op, always send it to the kernel, even if our shadow FIB shows the kernel already holding the route
+// (a retry, or the kernel has lost the route under us):
+#define FIB_OP_FORCE 0x80
+
+// Max amount of operations to send to the kernel in one batch:
+#define FIB_WRITER_BATCH 256
+
+// Once work arrives, the writer holds off this long (ms) before taking a batch, so the opposite operations
+// of a flapping prefix (a DELETE then INSTALL) meet in the queue and coalesce, rather than both reaching the kernel:
+#define FIB_WRITER_COALESCE_MS 250
+
+// Buckets in our prefix -> queued operation hash:
+#define FIB_WRITER_HASH_SIZE 1024
+
+// A queued kernel operation for a prefix. Linked into the list for its op class, and into
+// a hash bucket keyed by prefix (so a later operation on the same prefix coalesces into it):
+typedef struct fib_op_t {
+	uint8_t op;
+	uint8_t force;
+	rib_entry_t entry;
+	struct fib_op_t *prev;
+	struct fib_op_t *next;
+	struct fib_op_t *hnext;
+} fib_op_t;
+
+// Open our netlink socket and spawn the writer thread:
+int fib_writer_init(xripd_settings_t *xripd_settings);
+
+// Queue op (FIB_OP_*, optionally | FIB_OP_FORCE) for entry. If an operation for the same prefix is still queued, the two are merged.
+// Never blocks on the kernel, safe to call with mutex_rib_lock held:
+void fib_writer_queue(uint8_t op, const rib_entry_t *entry);
+
+#endif
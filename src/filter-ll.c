@@ -1,37 +1,8 @@
 #include "filter-ll.h"
 
-// Create a brand new list:
-filter_list_t *init_filter_list(void) {
-
-	// Allocate on the heap:
-	filter_list_t *filter_list = (filter_list_t*)malloc(sizeof(*filter_list));
-	memset(filter_list, 0, sizeof(*filter_list));
-
-	filter_list->head = NULL;
-	filter_list->tail = NULL;
-
-	return filter_list;
-}
-
-// Destroy the filter_list_t struct:
-static void destroy_filter_list(filter_list_t *fl) {
-
-	// Todo: code to traverse the filter nodes
-	
-	filter_node_t *cur = fl->head;
-	filter_node_t *next = cur;
-
-	// De-alloc every filter_node:
-	while ( cur != NULL ) {
-		next = cur->next;
-		free(cur);
-		cur = next;
-	}
-}
-
 // Destroy our filter:
 void destroy_filter(filter_t *f) {
-	destroy_filter_list(f->filter_list);
+	destroy_filter_trie(f->filter_trie);
 	free(f);
 }
 
@@ -42,35 +13,65 @@ filter_t *init_filter(uint8_t mode) {
 	filter_t *filter = (filter_t*)malloc(sizeof(*filter));
 	memset(filter, 0, sizeof(*filter));
 
-	// Create our filter list and link to our struct:
-	filter->filter_list = init_filter_list();
+	// Create our trie and link to our struct:
+	filter->filter_trie = init_filter_trie();
 	filter->filter_mode = mode;
+	filter->refs = 1;
 	return filter;
 }
 
-// Create a brand new node:
-static filter_node_t *init_filter_node(uint32_t addr, uint32_t mask) {
+// Take a reference on f:
+filter_t *filter_get(filter_t *f) {
+	if ( f != NULL ) {
+		__atomic_add_fetch(&(f->refs), 1, __ATOMIC_RELAXED);
+	}
+	return f;
+}
+
+// Drop a reference on f, destroying it with the last:
+void filter_put(filter_t *f) {
+	if ( f != NULL && __atomic_sub_fetch(&(f->refs), 1, __ATOMIC_ACQ_REL) == 0 ) {
+		destroy_filter(f);
+	}
+}
+
+// Walk callback of dump_filter_list(), printing the rules on a prefix.
+// Each run of lengths in the node's bitmap is a rule (rules merged on the same prefix print as one):
+static void dump_filter_node(uint32_t addr, uint8_t len, uint64_t lengths, void *arg) {
+
+	int *printed = (int *)arg;
+	uint32_t mask = ( len == 0 ) ? 0 : htonl(0xFFFFFFFFu << (32 - len));
+	char ipaddr[16];
+	char subnet[16];
+	int ge = 0;
+	int le = 0;
 
-	// Init and zeroise:
-	filter_node_t *n = (filter_node_t*)malloc(sizeof(*n));
-	memset(n, 0, sizeof(*n));
+	inet_ntop(AF_INET, &addr, ipaddr, sizeof(ipaddr));
+	inet_ntop(AF_INET, &mask, subnet, sizeof(subnet));
 
-	n->ipaddr = addr;
-	n->netmask = mask;
-	n->next = NULL;
+	while ( lengths != 0 ) {
+		ge = __builtin_ctzll(lengths);
+		le = ge;
+		while ( le < 32 && (lengths & (1ULL << (le + 1))) ) {
+			le++;
+		}
+		lengths &= ~(((1ULL << (le + 1)) - 1));
 
-	return n;
+		if ( (*printed)++ >= XRIPD_FILTER_DUMP_MAX ) {
+			continue;
+		}
+		if ( ge == len && le == len ) {
+			fprintf(stderr, "[filter]: Dump: Filter Rule: Network: %s %s\n", ipaddr, subnet);
+		} else {
+			fprintf(stderr, "[filter]: Dump: Filter Rule: Network: %s %s ge %d le %d\n", ipaddr, subnet, ge, le);
+		}
+	}
 }
 
 void dump_filter_list(filter_t *f) {
 
-	// Assign cur iterator:
-	filter_list_t *fl = f->filter_list;
-	filter_node_t *cur = fl->head;
-
-	char ipaddr[16];
-	char subnet[16];
 	char mode[32];
+	int printed = 0;
 
 	if (f->filter_mode == XRIPD_FILTER_MODE_BLACKLIST) {
 		strcpy(mode, "Blacklist Filter");
@@ -83,17 +84,22 @@ void dump_filter_list(filter_t *f) {
 	fprintf(stderr, "[filter]: Dumping Filter List.\n");
 	fprintf(stderr, "[filter]: Filter Type: %s.\n", mode);
 
-	while (cur != NULL) {
-		inet_ntop(AF_INET, &(cur->ipaddr), ipaddr, sizeof(ipaddr));
-		inet_ntop(AF_INET, &(cur->netmask), subnet, sizeof(ipaddr));
-		fprintf(stderr, "[filter]: Dump: Filter Node: %p Network: %s %s\n", cur, ipaddr, subnet);
-		cur = cur->next;
+	filter_trie_walk(f->filter_trie, &dump_filter_node, &printed);
+	if ( printed > XRIPD_FILTER_DUMP_MAX ) {
+		fprintf(stderr, "[filter]: Dump: ... and %d more.\n", printed - XRIPD_FILTER_DUMP_MAX);
 	}
+	fprintf(stderr, "[filter]: %u rule(s) compiled into %u trie node(s).\n", f->filter_trie->rules, f->filter_trie->count);
 	return;
 }
 
-// Given an input of address and mask, append to our filter list:
+// Given an input of address and mask, append to our filter list (an exact match of that route):
 int append_to_filter_list(filter_t *f, uint32_t addr, uint32_t mask) {
+	return append_range_to_filter_list(f, addr, mask, __builtin_popcount(mask), __builtin_popcount(mask));
+}
+
+// Given an input of address, mask and range of lengths, compile into our trie.
+// (A duplicate of a rule already held is quietly dropped):
+int append_range_to_filter_list(filter_t *f, uint32_t addr, uint32_t mask, uint8_t ge, uint8_t le) {
 
 #if XRIPD_DEBUG == 1
 	char ipaddr[16];
@@ -101,30 +107,16 @@ int append_to_filter_list(filter_t *f, uint32_t addr, uint32_t mask) {
 
 	inet_ntop(AF_INET, &addr, ipaddr, sizeof(ipaddr));
 	inet_ntop(AF_INET, &mask, subnet, sizeof(ipaddr));
-	fprintf(stderr, "[filter]: Appending to filter %s %s\n", ipaddr, subnet);
+	fprintf(stderr, "[filter]: Appending to filter %s %s ge %d le %d\n", ipaddr, subnet, ge, le);
 #endif
 
-	filter_list_t *fl = f->filter_list;
-
-	// First entry in our linked list:
-	if (fl-> tail == NULL ) {
-		fl->head = init_filter_node(addr, mask);
-		fl->tail = fl->head;
-		return 0;
-	} else {
-
-		// Allocate and assign to the last node in the list:
-		fl->tail->next = init_filter_node(addr, mask);
-		fl->tail = fl->tail->next;
-		return 0;
+	if ( filter_trie_insert(f->filter_trie, addr & mask, __builtin_popcount(mask), ge, le) == 1 ) {
+		return 1;
 	}
+	return 0;
 }
 
 static int filter_route_blacklist(filter_t *f, uint32_t *addr, uint32_t *mask) {
-	
-	// Assign cur iterator:
-	filter_list_t *fl = f->filter_list;
-	filter_node_t *cur = fl->head;
 
 #if XRIPD_DEBUG == 1
 	char ipaddr[16];
@@ -137,19 +129,12 @@ static int filter_route_blacklist(filter_t *f, uint32_t *addr, uint32_t *mask) {
 	fprintf(stderr, "[filter]: Running %s %s through filter.\n", ipaddr, subnet);
 #endif
 
-	// Iterate over filter:
-	while (cur != NULL) {
-		// We have a match?
-		if (cur->ipaddr == *addr) {
-			if (cur->netmask == *mask) {
+	// We have a match?
+	if ( filter_trie_match(f->filter_trie, *addr, __builtin_popcount(*mask)) ) {
 #if XRIPD_DEBUG == 1
-				fprintf(stderr, "[filter]: Filter match for %s %s. ROUTE DENIED.\n", ipaddr, subnet);
+		fprintf(stderr, "[filter]: Filter match for %s %s. ROUTE DENIED.\n", ipaddr, subnet);
 #endif
-				return XRIPD_FILTER_RESULT_DENY;
-			}
-		}
-		// Iterate:
-		cur = cur->next;
+		return XRIPD_FILTER_RESULT_DENY;
 	}
 
 #if XRIPD_DEBUG == 1
@@ -159,10 +144,6 @@ static int filter_route_blacklist(filter_t *f, uint32_t *addr, uint32_t *mask) {
 }
 
 static int filter_route_whitelist(filter_t *f, uint32_t *addr, uint32_t *mask) {
-	
-	// Assign cur iterator:
-	filter_list_t *fl = f->filter_list;
-	filter_node_t *cur = fl->head;
 
 #if XRIPD_DEBUG == 1
 	char ipaddr[16];
@@ -175,19 +156,12 @@ static int filter_route_whitelist(filter_t *f, uint32_t *addr, uint32_t *mask) {
 	fprintf(stderr, "[filter]: Running %s %s through filter.\n", ipaddr, subnet);
 #endif
 
-	// Iterate over filter:
-	while (cur != NULL) {
-		// We have a match?
-		if (cur->ipaddr == *addr) {
-			if (cur->netmask == *mask) {
+	// We have a match?
+	if ( filter_trie_match(f->filter_trie, *addr, __builtin_popcount(*mask)) ) {
 #if XRIPD_DEBUG == 1
-				fprintf(stderr, "[filter]: Filter match for %s %s. Route Allowed.\n", ipaddr, subnet);
+		fprintf(stderr, "[filter]: Filter match for %s %s. Route Allowed.\n", ipaddr, subnet);
 #endif
-				return XRIPD_FILTER_RESULT_ALLOW;;
-			}
-		}
-		// Iterate:
-		cur = cur->next;
+		return XRIPD_FILTER_RESULT_ALLOW;
 	}
 
 #if XRIPD_DEBUG == 1
@@ -214,64 +188,295 @@ int filter_route(filter_t *f, uint32_t addr, uint32_t mask) {
 	return res;
 }
 
-// Import filter from filename:
+// Next whitespace separated token of the line at *p, stopping at the end of the line or a # comment.
+// Returns its length (0 at the end of the line), leaving *p just past it:
+static size_t filter_next_token(const char **p, const char *end, const char **token) {
+
+	const char *cur = *p;
+
+	while ( cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r') ) {
+		cur++;
+	}
+	*token = cur;
+	if ( cur == end || *cur == '\n' || *cur == '#' ) {
+		*p = cur;
+		return 0;
+	}
+	while ( cur < end && !isspace((unsigned char)*cur) && *cur != '#' ) {
+		cur++;
+	}
+	*p = cur;
+	return cur - *token;
+}
+
+// Parse a decimal number of no more than max. Returns 0 on success:
+static int filter_parse_number(const char *token, size_t len, uint32_t max, uint32_t *value) {
+
+	uint32_t v = 0;
+
+	if ( len == 0 || len > 10 ) {
+		return 1;
+	}
+	for ( size_t i = 0; i < len; i++ ) {
+		if ( token[i] < '0' || token[i] > '9' ) {
+			return 1;
+		}
+		v = (v * 10) + (token[i] - '0');
+	}
+	if ( v > max ) {
+		return 1;
+	}
+	*value = v;
+	return 0;
+}
+
+// Parse a dotted quad into an address (network order). Returns 0 on success:
+static int filter_parse_address(const char *token, size_t len, uint32_t *addr) {
+
+	uint32_t host = 0;
+	uint32_t octet = 0;
+	const char *cur = token;
+	const char *end = token + len;
+	const char *dot;
+
+	for ( int i = 0; i < 4; i++ ) {
+		dot = cur;
+		while ( dot < end && *dot != '.' ) {
+			dot++;
+		}
+		if ( (i < 3) != (dot < end) || dot - cur > 3 || filter_parse_number(cur, dot - cur, 255, &octet) != 0 ) {
+			return 1;
+		}
+		host = (host << 8) | octet;
+		cur = dot + 1;
+	}
+	*addr = htonl(host);
+	return 0;
+}
+
+// Parse one rule (a line holding anything but a comment) of our filter file into addr/mask/ge/le.
+// Returns NULL on success, otherwise what was wrong with it:
+static const char *filter_parse_rule(const char **p, const char *end, uint32_t *addr, uint32_t *mask, int *ge, int *le) {
+
+	const char *token;
+	const char *slash;
+	size_t len;
+	uint32_t cidr = 0;
+	uint32_t value = 0;
+	uint32_t host_mask;
+
+	// Address, as x.x.x.x/n or x.x.x.x y.y.y.y:
+	len = filter_next_token(p, end, &token);
+	slash = memchr(token, '/', len);
+	if ( slash != NULL ) {
+		if ( filter_parse_address(token, slash - token, addr) != 0 ) {
+			return "bad address";
+		}
+		if ( filter_parse_number(slash + 1, len - (slash - token) - 1, 32, &cidr) != 0 ) {
+			return "bad prefix length";
+		}
+		*mask = ( cidr == 0 ) ? 0 : htonl(0xFFFFFFFFu << (32 - cidr));
+	} else {
+		if ( filter_parse_address(token, len, addr) != 0 ) {
+			return "bad address";
+		}
+		len = filter_next_token(p, end, &token);
+		if ( len == 0 || filter_parse_address(token, len, mask) != 0 ) {
+			return "bad or missing netmask";
+		}
+		// A netmask is a run of ones:
+		host_mask = ntohl(*mask);
+		if ( (~host_mask & (~host_mask + 1)) != 0 ) {
+			return "netmask is not contiguous";
+		}
+		cidr = __builtin_popcount(host_mask);
+	}
+
+	// Optional ge/le range of route lengths:
+	*ge = -1;
+	*le = -1;
+	while ( (len = filter_next_token(p, end, &token)) != 0 ) {
+		int is_ge = ( len == 2 && memcmp(token, "ge", 2) == 0 );
+		int is_le = ( len == 2 && memcmp(token, "le", 2) == 0 );
+		if ( !is_ge && !is_le ) {
+			return "unknown keyword";
+		}
+		len = filter_next_token(p, end, &token);
+		if ( filter_parse_number(token, len, 32, &value) != 0 ) {
+			return "ge/le without a length";
+		}
+		if ( is_ge ) {
+			*ge = value;
+		} else {
+			*le = value;
+		}
+	}
+
+	// As a prefix-list: ge alone runs to /32, le alone from the prefix's own length, neither is an exact match:
+	if ( *ge < 0 ) {
+		*ge = cidr;
+	}
+	if ( *le < 0 ) {
+		*le = ( *ge > cidr ) ? 32 : *ge;
+	}
+	return NULL;
+}
+
+// Count the lines of a mapped filter file (a last line without its newline included):
+static uint32_t filter_count_lines(const char *map, size_t len) {
+
+	const char *p = map;
+	const char *end = map + len;
+	uint32_t lines = 0;
+
+	while ( p < end && (p = memchr(p, '\n', end - p)) != NULL ) {
+		lines++;
+		p++;
+	}
+	return ( len > 0 && map[len - 1] != '\n' ) ? lines + 1 : lines;
+}
+
+// Import filter from filename.
+// The file is mapped and parsed in place, straight into our trie (sized up front from the file), so a
+// list of hundreds of thousands of rules loads without a copy or allocation per line:
 int import_filter_from_file(filter_t *f, const char *filename) {
 
-	FILE *fp;
-	char *line = NULL;
-	size_t len = 0;
-	size_t read = 0;
+	int fd;
+	struct stat st;
+	char *map;
+	const char *p;
+	const char *end;
+	const char *error;
+	uint32_t line_no = 0;
+	uint32_t rules = 0;
+	uint32_t duplicates = 0;
 
 	uint32_t uaddr = 0;
 	uint32_t umask = 0;
+	int ge = 0;
+	int le = 0;
+	int res = 0;
 
 	// Open file or bomb out:
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
+	fd = open(filename, O_RDONLY);
+	if ( fd < 0 || fstat(fd, &st) != 0 ) {
 		fprintf(stderr, "[filter]: No file found by name %s\n", filename);
+		if ( fd >= 0 ) {
+			close(fd);
+		}
 		return 1;
 	}
-	
-#if XRIPD_DEBUG == 1
-	fprintf(stderr, "[filter]: Loading filter from filter file: %s\n", filename);
-#endif
-	// Read each line:
-	while ((read = getline(&line, &len, fp)) != -1) {
-		char *token;
-		// token = address
-		token = strtok(line, " ");
-		while (token != NULL) {
 
 #if XRIPD_DEBUG == 1
-			fprintf(stderr, "[filter]: Filter Rule Address: %s\n", token);
-#endif
-			inet_pton(AF_INET, token, &uaddr);
-
-			// token == subnet?
-			token = strtok(NULL, " \n");
-			if ( token != NULL ) {
-#if XRIPD_DEBUG == 1
-				fprintf(stderr, "[filter]: Filter Rule Mask: %s\n", token);
-				
+	fprintf(stderr, "[filter]: Loading filter from filter file: %s\n", filename);
 #endif
-				// If we get to here, we are good to create a filter list:
-				inet_pton(AF_INET, token, &umask);
-				append_to_filter_list(f, uaddr, umask);
+	// Nothing to map:
+	if ( st.st_size == 0 ) {
+		close(fd);
+		return 0;
+	}
 
-				// Loop (token = NULL):
-				token = strtok(NULL, " ");
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( map == MAP_FAILED ) {
+		fprintf(stderr, "[filter]: Unable to map filter file %s.\n", filename);
+		return 1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	// Each line holds at most one rule, and each rule adds at most two nodes to our trie:
+	filter_trie_reserve(f->filter_trie, f->filter_trie->count + 2 * filter_count_lines(map, st.st_size));
+
+	p = map;
+	end = map + st.st_size;
+	while ( p < end ) {
+		const char *token;
+		const char *line = p;
+		line_no++;
+
+		// Skip blank lines and # comments:
+		if ( filter_next_token(&p, end, &token) != 0 ) {
+			p = line;
+			if ( (error = filter_parse_rule(&p, end, &uaddr, &umask, &ge, &le)) != NULL ) {
+				fprintf(stderr, "[filter]: Error with filter file format at %s line %u, %s.\n", filename, line_no, error);
+				res = 1;
+				break;
+			}
+			res = filter_trie_insert(f->filter_trie, uaddr & umask, __builtin_popcount(umask), ge, le);
+			if ( res == 1 ) {
+				fprintf(stderr, "[filter]: Error with filter file format at %s line %u, bad range ge %d le %d for a /%d.\n",
+					filename, line_no, ge, le, __builtin_popcount(umask));
+				break;
+			}
+			if ( res == FILTER_TRIE_DUPLICATE ) {
+				duplicates++;
 			} else {
-				fprintf(stderr, "[filter]: Error with filter file format.\n");
-				fclose(fp);
-				return 1;
+				rules++;
 			}
+			res = 0;
+		}
+
+		// On to the next line:
+		while ( p < end && *p != '\n' ) {
+			p++;
 		}
+		p++;
 	}
 
-	fclose(fp);
-	if (line) {
-		free(line);
+	munmap(map, st.st_size);
+	if ( res == 0 ) {
+		fprintf(stderr, "[filter]: Loaded %u rule(s) from %s (%u duplicate(s) dropped).\n", rules, filename, duplicates);
 	}
+	return res;
+}
+
+// Import filter from filename, through a precompiled image of it in cachefile:
+int import_filter_cached(filter_t *f, const char *filename, const char *cachefile) {
 
+	struct stat st;
+	int64_t mtime;
+	filter_trie_t *t;
+
+	if ( stat(filename, &st) != 0 ) {
+		fprintf(stderr, "[filter]: No file found by name %s\n", filename);
+		return 1;
+	}
+	mtime = ((int64_t)st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+
+	// Compiled from the filter file as it stands? Take it as our trie:
+	t = filter_trie_load(cachefile, st.st_size, mtime);
+	if ( t != NULL ) {
+		destroy_filter_trie(f->filter_trie);
+		f->filter_trie = t;
+		fprintf(stderr, "[filter]: Loaded %u rule(s) from filter cache %s.\n", t->rules, cachefile);
+		return 0;
+	}
+
+	// Otherwise, compile it afresh and rewrite our image:
+	fprintf(stderr, "[filter]: Filter cache %s missing or stale, compiling %s.\n", cachefile, filename);
+	if ( import_filter_from_file(f, filename) != 0 ) {
+		return 1;
+	}
+	filter_trie_save(f->filter_trie, cachefile, st.st_size, mtime);
 	return 0;
 }
+
+// Create a filter of mode, and import filename into it:
+filter_t *load_filter(uint8_t mode, const char *filename, const char *cachefile) {
+
+	int res = 0;
+	filter_t *f = init_filter(mode);
+
+	// Through our compiled image of it if we have been given one:
+	if ( strcmp(cachefile, "") != 0 ) {
+		res = import_filter_cached(f, filename, cachefile);
+	} else {
+		res = import_filter_from_file(f, filename);
+	}
+
+	if ( res != 0 ) {
+		filter_put(f);
+		return NULL;
+	}
+	return f;
+}
@@ -3,6 +3,7 @@
 
 #include "xripd.h"
 #include "rib.h"
+#include "filter-trie.h"
 
 // Standard Includes:
 #include <stdio.h>
@@ -10,7 +11,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
-#include <unistd.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Network Specific:
 #include <arpa/inet.h>
@@ -33,40 +37,53 @@
 #define XRIPD_FILTER_RESULT_DENY 0x00
 #define XRIPD_FILTER_RESULT_ALLOW 0x01
 
-// Individual nodes of our filter:
-typedef struct filter_node_t {
-	uint32_t ipaddr;
-	uint32_t netmask;
-	uint8_t cidr; // Maybe not required?
-	struct filter_node_t *next;
-} filter_node_t;
-
-// Linked List of nodes:
-typedef struct filter_list_t {
-	filter_node_t *head;
-	filter_node_t *tail;
-} filter_list_t;
-
-// Filter struct holding our settings and datastructure:
+// Filter struct holding our settings and datastructure.
+// Our rules are compiled straight into filter_trie as loaded (see filter-trie.h), a path compressed trie of at most
+// two nodes per distinct prefix rather than one allocation per rule, which also leaves duplicate rules with nothing to add:
+// A filter may be replaced (reloaded) while in use, so it is reference counted. Whoever publishes it holds the first
+// reference, and each user outside the publisher's lock takes its own (filter_get()/filter_put()):
 typedef struct filter_t {
 	uint8_t filter_mode;
-	filter_list_t *filter_list;
+	filter_trie_t *filter_trie;
+	uint32_t refs;
 } filter_t;
 
+// Most rules listed by dump_filter_list():
+#define XRIPD_FILTER_DUMP_MAX 64
+
 // Create/Destroy our filter struct (and substructs):
 filter_t *init_filter(uint8_t mode);
 void destroy_filter(filter_t *f);
 
-// Append a route to the end of our filter list:
+// Take/Drop a reference on f (NULL is passed through). The last reference dropped destroys f.
+// filter_get() must be called under the lock f is published under, so f can't be dropped by its publisher in between:
+filter_t *filter_get(filter_t *f);
+void filter_put(filter_t *f);
+
+// Append a route to the end of our filter list (matching that exact route):
 int append_to_filter_list(filter_t *f, uint32_t addr, uint32_t mask);
 
+// Append a rule matching routes under addr/mask with a length between ge and le (inclusive) to our filter list.
+// Returns 1 if the range is invalid (len <= ge <= le <= 32):
+int append_range_to_filter_list(filter_t *f, uint32_t addr, uint32_t mask, uint8_t ge, uint8_t le);
+
 // Pass our network (addr/mask) through the filter
 // and return a XRIPD_FILTER_RESULT__ value
 int filter_route(filter_t *f, uint32_t addr, uint32_t mask);
 
-// Given a filename, import routes into filter_t:
+// Given a filename, import routes into filter_t.
+// 1 rule per line: x.x.x.x y.y.y.y [ge n] [le n] or x.x.x.x/n [ge n] [le n] (ge/le as in a prefix-list,
+// ie. 10.0.0.0/8 le 32 matches 10.0.0.0/8 and everything longer within it):
 int import_filter_from_file(filter_t *f, const char *filename);
 
+// As import_filter_from_file(), through a precompiled image of the filter in cachefile.
+// The image is used if it was compiled from filename as it stands, otherwise filename is parsed and the image rewritten:
+int import_filter_cached(filter_t *f, const char *filename, const char *cachefile);
+
+// Create a filter of mode, and import filename into it (through cachefile, unless "").
+// Returns NULL if the filter file can't be loaded:
+filter_t *load_filter(uint8_t mode, const char *filename, const char *cachefile);
+
 void dump_filter_list(filter_t *f);
 
 #endif
@@ -0,0 +1,314 @@
+#include "filter-trie.h"
+
+// Grow our array of nodes to hold at least capacity nodes.
+// A trie mapped from a cache image is copied onto the heap first:
+static int filter_trie_grow(filter_trie_t *t, uint32_t capacity) {
+
+	filter_trie_node_t *nodes;
+
+	if ( capacity <= t->capacity && t->map_len == 0 ) {
+		return 0;
+	}
+	if ( capacity < t->count ) {
+		capacity = t->count;
+	}
+
+	if ( t->map_len != 0 ) {
+		nodes = (filter_trie_node_t*)malloc(capacity * sizeof(filter_trie_node_t));
+		if ( nodes == NULL ) {
+			return 1;
+		}
+		memcpy(nodes, t->nodes, t->count * sizeof(filter_trie_node_t));
+		munmap((void *)(((char *)t->nodes) - sizeof(filter_trie_image_t)), t->map_len);
+		t->map_len = 0;
+	} else {
+		nodes = (filter_trie_node_t*)realloc(t->nodes, capacity * sizeof(filter_trie_node_t));
+		if ( nodes == NULL ) {
+			return 1;
+		}
+	}
+
+	t->nodes = nodes;
+	t->capacity = capacity;
+	return 0;
+}
+
+// Take a brand new (empty) node, returning its index:
+static uint32_t filter_trie_new_node(filter_trie_t *t) {
+
+	if ( t->count == t->capacity || t->map_len != 0 ) {
+		if ( filter_trie_grow(t, (t->capacity < 64) ? 64 : t->capacity * 2) != 0 ) {
+			fprintf(stderr, "[filter]: Unable to grow filter trie past %u nodes.\n", t->capacity);
+			exit(1);
+		}
+	}
+	memset(&(t->nodes[t->count]), 0, sizeof(filter_trie_node_t));
+	return t->count++;
+}
+
+// Create a trie, holding just its root (0.0.0.0/0):
+filter_trie_t *init_filter_trie(void) {
+
+	filter_trie_t *t = (filter_trie_t*)malloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	filter_trie_new_node(t);
+	return t;
+}
+
+void destroy_filter_trie(filter_trie_t *t) {
+
+	if ( t->map_len != 0 ) {
+		munmap((void *)(((char *)t->nodes) - sizeof(filter_trie_image_t)), t->map_len);
+	} else {
+		free(t->nodes);
+	}
+	free(t);
+}
+
+// Make room for at least nodes nodes up front:
+int filter_trie_reserve(filter_trie_t *t, uint32_t nodes) {
+	return filter_trie_grow(t, nodes);
+}
+
+// Netmask (host order) of a prefix length:
+static uint32_t filter_trie_mask(uint8_t len) {
+	return ( len == 0 ) ? 0 : (0xFFFFFFFFU << (32 - len));
+}
+
+// Bit n of host (most significant first):
+static int filter_trie_bit(uint32_t host, uint8_t n) {
+	return (host >> (31 - n)) & 1;
+}
+
+// Take a new node for prefix/len, returning its index:
+static uint32_t filter_trie_new_prefix(filter_trie_t *t, uint32_t prefix, uint8_t len) {
+
+	uint32_t node = filter_trie_new_node(t);
+
+	t->nodes[node].prefix = prefix & filter_trie_mask(len);
+	t->nodes[node].len = len;
+	return node;
+}
+
+// Add a rule, matching routes under addr/len with a length between ge and le (inclusive):
+int filter_trie_insert(filter_trie_t *t, uint32_t addr, uint8_t len, uint8_t ge, uint8_t le) {
+
+	uint32_t cur = 0;
+	uint32_t next = 0;
+	uint32_t split = 0;
+	uint32_t host = ntohl(addr);
+	uint64_t lengths = 0;
+	uint8_t common = 0;
+	int bit;
+
+	if ( len > 32 || ge < len || le < ge || le > 32 ) {
+		return 1;
+	}
+	host &= filter_trie_mask(len);
+
+	// Walk (creating as we go) down to the node for addr/len.
+	// (Indexes rather than pointers, as creating a node may move our array):
+	while ( t->nodes[cur].len < len ) {
+
+		bit = filter_trie_bit(host, t->nodes[cur].len);
+		next = t->nodes[cur].child[bit];
+
+		// Nothing further down this way, hang our prefix straight off cur:
+		if ( next == 0 ) {
+			next = filter_trie_new_prefix(t, host, len);
+			t->nodes[cur].child[bit] = next;
+			cur = next;
+			break;
+		}
+
+		// How far do we agree with next (up to the shorter of our prefixes)?
+		for ( common = t->nodes[cur].len + 1; common < len && common < t->nodes[next].len; common++ ) {
+			if ( filter_trie_bit(host, common) != filter_trie_bit(t->nodes[next].prefix, common) ) {
+				break;
+			}
+		}
+
+		// next covers our prefix, carry on down:
+		if ( common == t->nodes[next].len ) {
+			cur = next;
+			continue;
+		}
+
+		// We part ways with next at bit common. Our prefix goes in between (if it ends there),
+		// otherwise a new node branches to next and to our prefix:
+		if ( common == len ) {
+			split = filter_trie_new_prefix(t, host, len);
+			t->nodes[split].child[filter_trie_bit(t->nodes[next].prefix, len)] = next;
+			t->nodes[cur].child[bit] = split;
+			cur = split;
+		} else {
+			split = filter_trie_new_prefix(t, host, common);
+			t->nodes[split].child[filter_trie_bit(t->nodes[next].prefix, common)] = next;
+			t->nodes[cur].child[bit] = split;
+			next = filter_trie_new_prefix(t, host, len);
+			t->nodes[split].child[filter_trie_bit(host, common)] = next;
+			cur = next;
+		}
+		break;
+	}
+
+	// Lengths ge through le:
+	lengths = ((1ULL << (le + 1)) - 1) & ~((1ULL << ge) - 1);
+
+	// Nothing new, a duplicate (or covered by an earlier rule on the same prefix):
+	if ( (t->nodes[cur].lengths & lengths) == lengths ) {
+		return FILTER_TRIE_DUPLICATE;
+	}
+
+	if ( t->map_len != 0 && filter_trie_grow(t, t->count) != 0 ) {
+		return 1;
+	}
+	t->nodes[cur].lengths |= lengths;
+	t->rules++;
+
+	return 0;
+}
+
+// Does the route addr/len match any rule?
+// Check every covering prefix of the route (each node on its path), for a rule taking routes of its length:
+int filter_trie_match(const filter_trie_t *t, uint32_t addr, uint8_t len) {
+
+	uint32_t cur = 0;
+	uint32_t host = ntohl(addr);
+	const filter_trie_node_t *node;
+
+	if ( len > 32 ) {
+		return 0;
+	}
+
+	while (1) {
+		node = &(t->nodes[cur]);
+		// Past the route, or off its path (collapsed bits of the node differ from ours):
+		if ( node->len > len || ((host ^ node->prefix) & filter_trie_mask(node->len)) != 0 ) {
+			break;
+		}
+		if ( node->lengths & (1ULL << len) ) {
+			return 1;
+		}
+		if ( node->len == len ) {
+			break;
+		}
+		cur = node->child[filter_trie_bit(host, node->len)];
+		if ( cur == 0 ) {
+			break;
+		}
+	}
+	return 0;
+}
+
+// Walk below node, calling callback on every node holding rules:
+static void filter_trie_walk_node(const filter_trie_t *t, uint32_t node,
+		void (*callback)(uint32_t addr, uint8_t len, uint64_t lengths, void *arg), void *arg) {
+
+	if ( t->nodes[node].lengths != 0 ) {
+		(*callback)(htonl(t->nodes[node].prefix), t->nodes[node].len, t->nodes[node].lengths, arg);
+	}
+	if ( t->nodes[node].child[0] != 0 ) {
+		filter_trie_walk_node(t, t->nodes[node].child[0], callback, arg);
+	}
+	if ( t->nodes[node].child[1] != 0 ) {
+		filter_trie_walk_node(t, t->nodes[node].child[1], callback, arg);
+	}
+}
+
+void filter_trie_walk(const filter_trie_t *t, void (*callback)(uint32_t addr, uint8_t len, uint64_t lengths, void *arg), void *arg) {
+	filter_trie_walk_node(t, 0, callback, arg);
+}
+
+// Write the trie out as a cache image. Written to a temporary file and renamed into place,
+// so a reader never maps a half written image:
+int filter_trie_save(const filter_trie_t *t, const char *path, uint64_t source_size, int64_t source_mtime) {
+
+	filter_trie_image_t image;
+	char tmp_path[PATH_MAX];
+	FILE *fp;
+	int ok = 1;
+
+	memset(&image, 0, sizeof(image));
+	memcpy(image.magic, FILTER_TRIE_MAGIC, sizeof(FILTER_TRIE_MAGIC));
+	image.version = FILTER_TRIE_VERSION;
+	image.count = t->count;
+	image.rules = t->rules;
+	image.node_size = sizeof(filter_trie_node_t);
+	image.source_size = source_size;
+	image.source_mtime = source_mtime;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fp = fopen(tmp_path, "w");
+	if ( fp == NULL ) {
+		fprintf(stderr, "[filter]: Unable to write filter cache %s.\n", tmp_path);
+		return 1;
+	}
+
+	ok &= ( fwrite(&image, sizeof(image), 1, fp) == 1 );
+	ok &= ( fwrite(t->nodes, sizeof(filter_trie_node_t), t->count, fp) == t->count );
+	ok &= ( fclose(fp) == 0 );
+
+	if ( !ok || rename(tmp_path, path) != 0 ) {
+		fprintf(stderr, "[filter]: Unable to write filter cache %s.\n", path);
+		unlink(tmp_path);
+		return 1;
+	}
+	return 0;
+}
+
+// Map a cache image back in:
+filter_trie_t *filter_trie_load(const char *path, uint64_t source_size, int64_t source_mtime) {
+
+	int fd;
+	struct stat st;
+	void *map;
+	filter_trie_image_t *image;
+	filter_trie_t *t;
+
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 ) {
+		return NULL;
+	}
+	if ( fstat(fd, &st) != 0 || st.st_size < sizeof(filter_trie_image_t) ) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( map == MAP_FAILED ) {
+		return NULL;
+	}
+
+	// Ours, of this filter file, and whole?
+	image = (filter_trie_image_t *)map;
+	if ( memcmp(image->magic, FILTER_TRIE_MAGIC, sizeof(FILTER_TRIE_MAGIC)) != 0 || image->version != FILTER_TRIE_VERSION ||
+		image->node_size != sizeof(filter_trie_node_t) || image->count == 0 ||
+		image->source_size != source_size || image->source_mtime != source_mtime ||
+		st.st_size != sizeof(filter_trie_image_t) + ((off_t)image->count * sizeof(filter_trie_node_t)) ) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	t = (filter_trie_t*)malloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	t->nodes = (filter_trie_node_t *)(((char *)map) + sizeof(filter_trie_image_t));
+	t->count = image->count;
+	t->capacity = image->count;
+	t->rules = image->rules;
+	t->map_len = st.st_size;
+
+	// A damaged image could send a lookup off the end of our nodes, or around in circles (each child must be longer):
+	for ( uint32_t i = 0; i < t->count; i++ ) {
+		if ( t->nodes[i].child[0] >= t->count || t->nodes[i].child[1] >= t->count || t->nodes[i].len > 32 || t->nodes[0].len != 0 ||
+			(t->nodes[i].child[0] != 0 && t->nodes[t->nodes[i].child[0]].len <= t->nodes[i].len) ||
+			(t->nodes[i].child[1] != 0 && t->nodes[t->nodes[i].child[1]].len <= t->nodes[i].len) ) {
+			fprintf(stderr, "[filter]: Filter cache %s is damaged, ignoring.\n", path);
+			destroy_filter_trie(t);
+			return NULL;
+		}
+	}
+
+	return t;
+}
@@ -0,0 +1,89 @@
+#ifndef XRIPD_FILTER_TRIE_H
+#define XRIPD_FILTER_TRIE_H
+
+#include "xripd.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Path compressed binary trie (Patricia) of filter prefixes, branching on the bits of the address (most significant first).
+// A rule of prefix/len with a ge/le range of route lengths marks those lengths in the node for prefix/len.
+// A route matches if any node on its path (each of its covering prefixes) has its length marked, so a
+// lookup walks at most 33 nodes, however many rules the filter holds.
+// Chains of single children are collapsed: each node holds its own prefix/len, and only splits where two of its
+// prefixes part ways. A node either holds rules or branches (the root aside), so a trie of n rules has under 2n nodes:
+//
+//   root (0.0.0.0/0) -+- child[0] (10.0.0.0/8) -+- child[0] (10.0.0.0/16)
+//                     |                         +- child[1] (10.128.0.0/9)
+//                     +- child[1] (192.168.1.0/24)
+//
+// Nodes live in one flat array and refer to their children by index, so the whole trie can be written out
+// and mapped back in as a single image (our cache):
+typedef struct filter_trie_node_t {
+	uint32_t child[2]; // Index into nodes, 0 for none (the root, node 0, is never a child)
+	uint64_t lengths; // Bit n set: routes of length n under this prefix match
+	uint32_t prefix; // Host order, bits past len are 0
+	uint8_t len; // Longer than that of our parent, child[n] continues with bit len == n
+} filter_trie_node_t;
+
+typedef struct filter_trie_t {
+	filter_trie_node_t *nodes;
+	uint32_t count; // Nodes in use
+	uint32_t capacity;
+	uint32_t rules; // Distinct rules inserted
+	size_t map_len; // Non-zero if nodes is mapped from a cache image (read only until copied)
+} filter_trie_t;
+
+// filter_trie_insert() return for a rule already wholly covered by the trie:
+#define FILTER_TRIE_DUPLICATE 2
+
+// Header of a cache image, followed by count nodes.
+// The image is in our native byte order, and records the size/mtime of the filter file it was compiled from:
+#define FILTER_TRIE_MAGIC "XRIPDFT"
+#define FILTER_TRIE_VERSION 2
+
+typedef struct filter_trie_image_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint32_t rules;
+	uint32_t node_size;
+	uint64_t source_size;
+	int64_t source_mtime;
+} filter_trie_image_t;
+
+// Create/Destroy a trie:
+filter_trie_t *init_filter_trie(void);
+void destroy_filter_trie(filter_trie_t *t);
+
+// Make room for at least nodes nodes up front (bulk loads). Each rule adds at most two:
+int filter_trie_reserve(filter_trie_t *t, uint32_t nodes);
+
+// Add a rule, matching routes under addr/len (network order) with a length between ge and le (inclusive).
+// Returns 1 if the rule is malformed (len <= ge <= le <= 32 must hold), or FILTER_TRIE_DUPLICATE:
+int filter_trie_insert(filter_trie_t *t, uint32_t addr, uint8_t len, uint8_t ge, uint8_t le);
+
+// Does the route addr/len (network order) match any rule? Returns 1 if so:
+int filter_trie_match(const filter_trie_t *t, uint32_t addr, uint8_t len);
+
+// Call callback for every node holding rules, with its prefix (network order) and its bitmap of lengths:
+void filter_trie_walk(const filter_trie_t *t, void (*callback)(uint32_t addr, uint8_t len, uint64_t lengths, void *arg), void *arg);
+
+// Write the trie to path as a cache image, compiled from a filter file of source_size/source_mtime:
+int filter_trie_save(const filter_trie_t *t, const char *path, uint64_t source_size, int64_t source_mtime);
+
+// Map a cache image back in. Returns NULL if there is none, it is damaged, or it is not of
+// a filter file of source_size/source_mtime:
+filter_trie_t *filter_trie_load(const char *path, uint64_t source_size, int64_t source_mtime);
+
+#endif
@@ -0,0 +1,372 @@
+#include "policy.h"
+
+// Take a reference on p:
+policy_t *policy_get(policy_t *p) {
+	if ( p != NULL ) {
+		__atomic_add_fetch(&(p->refs), 1, __ATOMIC_RELAXED);
+	}
+	return p;
+}
+
+// Destroy a policy, and its decision tables:
+static void destroy_policy(policy_t *p) {
+
+	for ( int dir = 0; dir < POLICY_DIRS; dir++ ) {
+		for ( uint32_t i = 0; i < p->table_count[dir]; i++ ) {
+			free(p->tables[dir][i].rules);
+		}
+		free(p->tables[dir]);
+	}
+	free(p);
+}
+
+// Drop a reference on p, destroying it with the last:
+void policy_put(policy_t *p) {
+	if ( p != NULL && __atomic_sub_fetch(&(p->refs), 1, __ATOMIC_ACQ_REL) == 0 ) {
+		destroy_policy(p);
+	}
+}
+
+// Parse a number between min and max. Returns 0 on success:
+static int policy_parse_number(const char *token, long min, long max, long *value) {
+
+	char *end = NULL;
+
+	if ( token == NULL ) {
+		return 1;
+	}
+	*value = strtol(token, &end, 10);
+	if ( end == token || *end != '\0' || *value < min || *value > max ) {
+		return 1;
+	}
+	return 0;
+}
+
+// Parse a single rule (line) of a policy file, holding tokens, into rule/dir/neighbour.
+// Returns NULL on success, otherwise what was wrong with it:
+static const char *policy_parse_rule(char *line, policy_rule_t *rule, uint8_t *dir, uint32_t *neighbour) {
+
+	char *token;
+	char *slash;
+	long value = 0;
+	long value_max = 0;
+	int len = 0;
+	int ge = -1;
+	int le = -1;
+
+	// Direction:
+	token = strtok(line, " \t\n");
+	if ( token != NULL && strcmp(token, "in") == 0 ) {
+		*dir = POLICY_DIR_IN;
+	} else if ( token != NULL && strcmp(token, "out") == 0 ) {
+		*dir = POLICY_DIR_OUT;
+	} else {
+		return "expected in or out";
+	}
+
+	// Neighbour:
+	token = strtok(NULL, " \t\n");
+	*neighbour = 0;
+	if ( token == NULL ) {
+		return "expected a neighbour, or any";
+	}
+	if ( strcmp(token, "any") != 0 ) {
+		if ( inet_pton(AF_INET, token, neighbour) != 1 || *neighbour == 0 ) {
+			return "bad neighbour address";
+		}
+		if ( *dir == POLICY_DIR_OUT ) {
+			return "out rules apply to every neighbour (our updates are multicast), use any";
+		}
+	}
+
+	// Action:
+	token = strtok(NULL, " \t\n");
+	if ( token != NULL && strcmp(token, "permit") == 0 ) {
+		rule->action = POLICY_ACTION_PERMIT;
+	} else if ( token != NULL && strcmp(token, "deny") == 0 ) {
+		rule->action = POLICY_ACTION_DENY;
+	} else {
+		return "expected permit or deny";
+	}
+
+	// Matches and sets:
+	while ( (token = strtok(NULL, " \t\n")) != NULL ) {
+
+		if ( strcmp(token, "prefix") == 0 ) {
+			token = strtok(NULL, " \t\n");
+			slash = ( token != NULL ) ? strchr(token, '/') : NULL;
+			if ( slash == NULL ) {
+				return "expected prefix x.x.x.x/n";
+			}
+			*slash = '\0';
+			if ( inet_pton(AF_INET, token, &(rule->prefix)) != 1 || policy_parse_number(slash + 1, 0, 32, &value) != 0 ) {
+				return "bad prefix";
+			}
+			len = value;
+			rule->mask = ( len == 0 ) ? 0 : (0xFFFFFFFFu << (32 - len));
+			rule->prefix = ntohl(rule->prefix) & rule->mask;
+			rule->match |= POLICY_MATCH_PREFIX;
+
+		} else if ( strcmp(token, "ge") == 0 || strcmp(token, "le") == 0 ) {
+			if ( !(rule->match & POLICY_MATCH_PREFIX) || policy_parse_number(strtok(NULL, " \t\n"), 0, 32, &value) != 0 ) {
+				return "ge/le need a prefix, and a length";
+			}
+			if ( token[0] == 'g' ) {
+				ge = value;
+			} else {
+				le = value;
+			}
+
+		} else if ( strcmp(token, "tag") == 0 ) {
+			if ( policy_parse_number(strtok(NULL, " \t\n"), 0, 65535, &value) != 0 ) {
+				return "bad tag";
+			}
+			rule->tag = value;
+			rule->match |= POLICY_MATCH_TAG;
+
+		} else if ( strcmp(token, "metric") == 0 ) {
+			token = strtok(NULL, " \t\n");
+			slash = ( token != NULL ) ? strchr(token, '-') : NULL;
+			if ( slash != NULL ) {
+				*slash = '\0';
+			}
+			if ( policy_parse_number(token, 1, RIP_METRIC_INFINITY, &value) != 0 ) {
+				return "bad metric";
+			}
+			value_max = value;
+			if ( slash != NULL && policy_parse_number(slash + 1, value, RIP_METRIC_INFINITY, &value_max) != 0 ) {
+				return "bad metric range";
+			}
+			rule->metric_min = value;
+			rule->metric_max = value_max;
+			rule->match |= POLICY_MATCH_METRIC;
+
+		} else if ( strcmp(token, "set-metric") == 0 ) {
+			token = strtok(NULL, " \t\n");
+			if ( token != NULL && token[0] == '+' ) {
+				token++;
+			}
+			if ( policy_parse_number(token, -(RIP_METRIC_INFINITY - 1), RIP_METRIC_INFINITY - 1, &value) != 0 ) {
+				return "bad set-metric offset";
+			}
+			rule->metric_offset = value;
+			rule->set |= POLICY_SET_METRIC;
+
+		} else if ( strcmp(token, "set-tag") == 0 ) {
+			if ( policy_parse_number(strtok(NULL, " \t\n"), 0, 65535, &value) != 0 ) {
+				return "bad set-tag";
+			}
+			rule->set_tag = value;
+			rule->set |= POLICY_SET_TAG;
+
+		} else {
+			return "unknown keyword";
+		}
+	}
+
+	// Prefix lengths as in our filter (a prefix-list): ge alone runs to /32, le alone from the prefix's own length:
+	if ( rule->match & POLICY_MATCH_PREFIX ) {
+		if ( ge < 0 ) {
+			ge = len;
+		}
+		if ( le < 0 ) {
+			le = ( ge > len ) ? 32 : ge;
+		}
+		if ( ge < len || le < ge ) {
+			return "bad ge/le range";
+		}
+		rule->ge = ge;
+		rule->le = le;
+	}
+
+	if ( rule->action == POLICY_ACTION_DENY && rule->set != 0 ) {
+		return "set-metric/set-tag on a deny rule";
+	}
+	return NULL;
+}
+
+// Compile the rules of direction dir into their decision tables. Table 0 holds the rules for any neighbour,
+// then a table for each neighbour named, holding its own rules and those for any neighbour, in file order:
+static void policy_compile(policy_t *p, uint8_t dir, const policy_rule_t *rules, const uint8_t *dirs,
+		const uint32_t *neighbours, uint32_t count) {
+
+	policy_table_t *table;
+	uint32_t t;
+
+	// Table 0, plus one for each distinct neighbour:
+	p->tables[dir] = (policy_table_t *)calloc(1, sizeof(policy_table_t));
+	p->table_count[dir] = 1;
+	for ( uint32_t i = 0; i < count; i++ ) {
+		if ( dirs[i] != dir || neighbours[i] == 0 ) {
+			continue;
+		}
+		for ( t = 1; t < p->table_count[dir] && p->tables[dir][t].neighbour != neighbours[i]; t++ );
+		if ( t == p->table_count[dir] ) {
+			p->tables[dir] = (policy_table_t *)realloc(p->tables[dir], (t + 1) * sizeof(policy_table_t));
+			memset(&(p->tables[dir][t]), 0, sizeof(policy_table_t));
+			p->tables[dir][t].neighbour = neighbours[i];
+			p->table_count[dir]++;
+		}
+	}
+
+	for ( t = 0; t < p->table_count[dir]; t++ ) {
+		table = &(p->tables[dir][t]);
+		table->rules = (policy_rule_t *)calloc(count > 0 ? count : 1, sizeof(policy_rule_t));
+		for ( uint32_t i = 0; i < count; i++ ) {
+			if ( dirs[i] == dir && (neighbours[i] == 0 || neighbours[i] == table->neighbour) ) {
+				memcpy(&(table->rules[table->count++]), &(rules[i]), sizeof(policy_rule_t));
+			}
+		}
+	}
+}
+
+// Load and compile a policy file:
+policy_t *load_policy(const char *filename) {
+
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	uint32_t line_no = 0;
+	const char *error = NULL;
+
+	// Our rules as parsed, with their direction and neighbour:
+	policy_rule_t *rules = (policy_rule_t *)calloc(POLICY_MAX_RULES, sizeof(policy_rule_t));
+	uint8_t dirs[POLICY_MAX_RULES];
+	uint32_t neighbours[POLICY_MAX_RULES];
+	uint32_t count = 0;
+	policy_t *p = NULL;
+
+	fp = fopen(filename, "r");
+	if ( fp == NULL ) {
+		fprintf(stderr, "[policy]: No file found by name %s\n", filename);
+		free(rules);
+		return NULL;
+	}
+
+	while ( getline(&line, &len, fp) != -1 ) {
+		line_no++;
+
+		// Skip blank lines and # comments:
+		char *start = line + strspn(line, " \t");
+		if ( *start == '\n' || *start == '\0' || *start == '#' ) {
+			continue;
+		}
+		if ( count == POLICY_MAX_RULES ) {
+			error = "too many rules";
+			break;
+		}
+		rules[count].line = line_no;
+		if ( (error = policy_parse_rule(start, &(rules[count]), &(dirs[count]), &(neighbours[count]))) != NULL ) {
+			break;
+		}
+		count++;
+	}
+
+	fclose(fp);
+	free(line);
+
+	if ( error != NULL ) {
+		fprintf(stderr, "[policy]: Error with policy file format at %s line %u, %s.\n", filename, line_no, error);
+		free(rules);
+		return NULL;
+	}
+
+	p = (policy_t *)calloc(1, sizeof(policy_t));
+	p->rules = count;
+	p->refs = 1;
+	for ( uint8_t dir = 0; dir < POLICY_DIRS; dir++ ) {
+		policy_compile(p, dir, rules, dirs, neighbours, count);
+	}
+	free(rules);
+
+	fprintf(stderr, "[policy]: Loaded %u rule(s) from %s.\n", count, filename);
+	return p;
+}
+
+// Run a route through the rules of direction dir:
+int policy_evaluate(const policy_t *p, uint8_t dir, uint32_t neighbour, uint32_t addr, uint32_t subnet,
+		uint32_t metric, uint16_t tag, policy_result_t *result) {
+
+	const policy_table_t *table = &(p->tables[dir][0]);
+	const policy_rule_t *rule;
+	uint32_t host = ntohl(addr);
+	uint8_t len = __builtin_popcount(subnet);
+
+	// The decision table for our neighbour (if it has one of its own):
+	for ( uint32_t t = 1; t < p->table_count[dir]; t++ ) {
+		if ( p->tables[dir][t].neighbour == neighbour ) {
+			table = &(p->tables[dir][t]);
+			break;
+		}
+	}
+
+	for ( uint32_t i = 0; i < table->count; i++ ) {
+		rule = &(table->rules[i]);
+
+		if ( (rule->match & POLICY_MATCH_PREFIX) &&
+			((host & rule->mask) != rule->prefix || len < rule->ge || len > rule->le) ) {
+			continue;
+		}
+		if ( (rule->match & POLICY_MATCH_TAG) && tag != rule->tag ) {
+			continue;
+		}
+		if ( (rule->match & POLICY_MATCH_METRIC) && (metric < rule->metric_min || metric > rule->metric_max) ) {
+			continue;
+		}
+
+		result->action = rule->action;
+		result->set = rule->set;
+		result->metric_offset = rule->metric_offset;
+		result->tag = rule->set_tag;
+		return result->action;
+	}
+
+	// No rule matched:
+	memset(result, 0, sizeof(policy_result_t));
+	result->action = POLICY_ACTION_PERMIT;
+	return result->action;
+}
+
+// Apply the sets of a permitted result to an RTE:
+void policy_apply(const policy_result_t *result, rip_msg_entry_t *entry) {
+
+	int metric = ntohl(entry->metric);
+
+	// An unreachable route stays unreachable:
+	if ( (result->set & POLICY_SET_METRIC) && metric < RIP_METRIC_INFINITY ) {
+		metric += result->metric_offset;
+		if ( metric < 1 ) {
+			metric = 1;
+		} else if ( metric > RIP_METRIC_INFINITY ) {
+			metric = RIP_METRIC_INFINITY;
+		}
+		entry->metric = htonl(metric);
+	}
+	if ( result->set & POLICY_SET_TAG ) {
+		entry->tag = htons(result->tag);
+	}
+}
+
+void dump_policy(const policy_t *p) {
+
+	const policy_table_t *table;
+	char neighbour[16];
+
+	fprintf(stderr, "[policy]: Dumping Policy, %u rule(s).\n", p->rules);
+	for ( int dir = 0; dir < POLICY_DIRS; dir++ ) {
+		for ( uint32_t t = 0; t < p->table_count[dir]; t++ ) {
+			table = &(p->tables[dir][t]);
+			if ( t == 0 ) {
+				strcpy(neighbour, "any other");
+			} else {
+				inet_ntop(AF_INET, &(table->neighbour), neighbour, sizeof(neighbour));
+			}
+			fprintf(stderr, "[policy]: Dump: %s, neighbour %s: %u rule(s), from line(s):",
+					(dir == POLICY_DIR_IN) ? "in" : "out", neighbour, table->count);
+			for ( uint32_t i = 0; i < table->count; i++ ) {
+				fprintf(stderr, " %u", table->rules[i].line);
+			}
+			fprintf(stderr, "\n");
+		}
+	}
+}
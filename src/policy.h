@@ -0,0 +1,107 @@
+#ifndef XRIPD_POLICY_H
+#define XRIPD_POLICY_H
+
+#include "xripd.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Route policy (after a route-map), on top of our allow/deny filter.
+// A policy file holds an ordered list of rules, each for a direction (in: routes learnt from our neighbours,
+// out: routes we advertise), optionally a neighbour, a number of matches and what to do with a matching route:
+//
+//   <in|out> <neighbour|any> <permit|deny> [prefix x.x.x.x/n [ge n] [le n]] [tag n] [metric n[-n]] [set-metric +/-n] [set-tag n]
+//
+// The first rule to match a route decides it, a route matching no rule is permitted as is.
+// Our updates are multicast to every neighbour at once, so out rules can only be given for any neighbour.
+
+// Directions:
+#define POLICY_DIR_IN 0x00
+#define POLICY_DIR_OUT 0x01
+#define POLICY_DIRS 2
+
+// Actions:
+#define POLICY_ACTION_DENY 0x00
+#define POLICY_ACTION_PERMIT 0x01
+
+// What a rule matches on (besides its neighbour), policy_rule_t.match:
+#define POLICY_MATCH_PREFIX 0x01
+#define POLICY_MATCH_TAG 0x02
+#define POLICY_MATCH_METRIC 0x04
+
+// What a rule sets on a permitted route, policy_rule_t.set / policy_result_t.set:
+#define POLICY_SET_METRIC 0x01
+#define POLICY_SET_TAG 0x02
+
+// Most rules in a policy file:
+#define POLICY_MAX_RULES 1024
+
+// One row of our decision table, a compiled rule (24 bytes).
+// Addresses are held in host order, so a prefix match is a single mask and compare:
+typedef struct policy_rule_t {
+	uint32_t prefix; // Masked
+	uint32_t mask;
+	uint16_t tag;
+	uint16_t set_tag;
+	uint8_t match; // POLICY_MATCH_*
+	uint8_t ge;
+	uint8_t le;
+	uint8_t metric_min;
+	uint8_t metric_max;
+	uint8_t action; // POLICY_ACTION_*
+	uint8_t set; // POLICY_SET_*
+	int8_t metric_offset;
+	uint32_t line; // Of the policy file, for our dumps
+} policy_rule_t;
+
+// Rules are compiled per direction into a decision table for each neighbour named in a rule, holding the rules
+// for that neighbour and for any neighbour (in file order), plus table 0 for every other neighbour.
+// A route is then run through the rules that can apply to it alone, without testing neighbours:
+typedef struct policy_table_t {
+	uint32_t neighbour; // Network order, 0 for table 0
+	policy_rule_t *rules;
+	uint32_t count;
+} policy_table_t;
+
+// Like the filter, a policy may be replaced (reloaded) while in use, so it is reference counted
+// (see filter-ll.h):
+typedef struct policy_t {
+	policy_table_t *tables[POLICY_DIRS];
+	uint32_t table_count[POLICY_DIRS];
+	uint32_t rules; // Rules in the policy file
+	uint32_t refs;
+} policy_t;
+
+// Outcome of running a route through a policy:
+typedef struct policy_result_t {
+	uint8_t action; // POLICY_ACTION_*
+	uint8_t set; // POLICY_SET_*
+	int8_t metric_offset;
+	uint16_t tag; // Host order
+} policy_result_t;
+
+// Load and compile a policy file. Returns NULL if it can't be loaded:
+policy_t *load_policy(const char *filename);
+
+// Take/Drop a reference on p (NULL is passed through), as filter_get()/filter_put():
+policy_t *policy_get(policy_t *p);
+void policy_put(policy_t *p);
+
+// Run a route (addr/subnet/neighbour network order, metric/tag host order) through the rules of direction dir.
+// Returns result->action:
+int policy_evaluate(const policy_t *p, uint8_t dir, uint32_t neighbour, uint32_t addr, uint32_t subnet,
+		uint32_t metric, uint16_t tag, policy_result_t *result);
+
+// Apply the sets of a permitted result to an RTE (metric kept within 1 - RIP_METRIC_INFINITY):
+void policy_apply(const policy_result_t *result, rip_msg_entry_t *entry);
+
+void dump_policy(const policy_t *p);
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
 
 #include "xripd.h"
 #include "rib.h"
@@ -17,6 +18,14 @@
 // Daemon REQUEST routing table dump from rib (RIPv2 REQUEST triggered):
 #define RIB_CTL_HDR_MSGTYPE_REQUESTALL 0x1A
 
+// Daemon LOOKUP of specific routes from rib (RIPv2 REQUEST triggered),
+// rib will return a single LOOKUPREPLY with the metrics filled in:
+#define RIB_CTL_HDR_MSGTYPE_LOOKUP 0x1B
+#define RIB_CTL_HDR_MSGTYPE_LOOKUPREPLY 0x24
+
+// Reload our filter file (as SIGHUP to the daemon), a bare header. No reply is sent:
+#define RIB_CTL_HDR_MSGTYPE_RELOAD 0x1C
+
 // In reponse to REQUEST, rib will return REPLY messages
 // ENDREPLY messages will signify end of response stream
 #define RIB_CTL_HDR_MSGTYPE_REPLY 0x22
@@ -35,6 +44,34 @@ typedef struct rib_ctl_hdr_t {
 	uint8_t msgtype;
 } rib_ctl_hdr_t;
 
+// REPLY and UNSOLICITED messages carry a single route:
+typedef struct rib_ctl_reply_t {
+	rib_ctl_hdr_t header;
+	rib_entry_t entry;
+} rib_ctl_reply_t;
+
+// REQUEST and REQUESTALL messages carry the address the dump is destined for on the network,
+// which the rib echoes back in its ENDREPLY:
+typedef struct rib_ctl_request_t {
+	rib_ctl_hdr_t header;
+	struct sockaddr_in reply_to;
+} rib_ctl_request_t;
+
+// LOOKUP and LOOKUPREPLY messages carry the requested entries of a RIPv2 REQUEST:
+typedef struct rib_ctl_lookup_t {
+	rib_ctl_hdr_t header;
+	struct sockaddr_in reply_to;
+	uint8_t count;
+	rip_msg_entry_t entries[RIP_MAX_ENTRIES];
+} rib_ctl_lookup_t;
+
+// ENDUNSOLICITED carries whether the changes are urgent (a link or address has been lost),
+// urgent changes are sent onto the network without the triggered update holdoff:
+typedef struct rib_ctl_endunsolicited_t {
+	rib_ctl_hdr_t header;
+	uint8_t urgent;
+} rib_ctl_endunsolicited_t;
+
 typedef struct sun_addresses_t {
 	int socketfd;
 	struct sockaddr_un sockaddr_un_daemon;
@@ -0,0 +1,117 @@
+#include "rib-damp.h"
+
+// Our penalties, only used from the rib thread (under mutex_rib_lock):
+static rib_damp_t *damp_hash[RIB_DAMP_HASH_SIZE];
+static time_t damp_last_sweep = 0;
+
+// Hash a prefix into a bucket:
+static uint32_t rib_damp_hash(uint32_t ipaddr, uint32_t subnet) {
+	return ((ipaddr * 2654435761u) ^ subnet) % RIB_DAMP_HASH_SIZE;
+}
+
+// Find the record for a prefix (if any):
+static rib_damp_t *rib_damp_find(uint32_t ipaddr, uint32_t subnet) {
+
+	rib_damp_t *cur = damp_hash[rib_damp_hash(ipaddr, subnet)];
+
+	while ( cur != NULL ) {
+		if ( cur->ipaddr == ipaddr && cur->subnet == subnet ) {
+			return cur;
+		}
+		cur = cur->next;
+	}
+	return NULL;
+}
+
+// Bring a record's penalty forward to now:
+static void rib_damp_decay(rib_damp_t *damp, time_t now) {
+
+	if ( now > damp->updated ) {
+		damp->penalty *= exp2(-(double)(now - damp->updated) / RIB_DAMP_HALF_LIFE);
+		damp->updated = now;
+	}
+}
+
+// Log a change in suppression of a prefix:
+static void rib_damp_log(const rib_damp_t *damp, const char *event) {
+
+	char ipaddr[16];
+	inet_ntop(AF_INET, &(damp->ipaddr), ipaddr, sizeof(ipaddr));
+	fprintf(stderr, "[damp]: %s/%d %s (penalty %.0f).\n", ipaddr, __builtin_popcount(damp->subnet), event, damp->penalty);
+}
+
+// Charge a withdrawal to a prefix. Returns 1 if this has left the prefix suppressed:
+int rib_damp_withdraw(uint32_t ipaddr, uint32_t subnet, time_t now) {
+
+	rib_damp_t *damp = rib_damp_find(ipaddr, subnet);
+	uint32_t bucket;
+	double ceiling = RIB_DAMP_REUSE * exp2((double)RIB_DAMP_MAX_SUPPRESS / RIB_DAMP_HALF_LIFE);
+
+	if ( damp == NULL ) {
+		damp = (rib_damp_t *)malloc(sizeof(rib_damp_t));
+		memset(damp, 0, sizeof(rib_damp_t));
+		damp->ipaddr = ipaddr;
+		damp->subnet = subnet;
+		damp->updated = now;
+
+		bucket = rib_damp_hash(ipaddr, subnet);
+		damp->next = damp_hash[bucket];
+		damp_hash[bucket] = damp;
+	}
+
+	rib_damp_decay(damp, now);
+	damp->penalty += RIB_DAMP_PENALTY_WITHDRAW;
+	if ( damp->penalty > ceiling ) {
+		damp->penalty = ceiling;
+	}
+
+	if ( !damp->suppressed && damp->penalty >= RIB_DAMP_SUPPRESS ) {
+		damp->suppressed = 1;
+		rib_damp_log(damp, "is flapping, suppressed");
+	}
+	return damp->suppressed;
+}
+
+// Is the prefix suppressed? Lifts the suppression once the penalty has decayed below RIB_DAMP_REUSE:
+int rib_damp_suppressed(uint32_t ipaddr, uint32_t subnet, time_t now) {
+
+	rib_damp_t *damp = rib_damp_find(ipaddr, subnet);
+
+	if ( damp == NULL || !damp->suppressed ) {
+		return 0;
+	}
+
+	rib_damp_decay(damp, now);
+	if ( damp->penalty < RIB_DAMP_REUSE ) {
+		damp->suppressed = 0;
+		rib_damp_log(damp, "has settled, reused");
+	}
+	return damp->suppressed;
+}
+
+// Free the records of prefixes that have stopped flapping (at most every RIB_DAMP_SWEEP_INTERVAL).
+// A record is kept until half way to reuse, so a prefix that has just been reused doesn't start again from nothing:
+void rib_damp_expire(time_t now) {
+
+	rib_damp_t **cur;
+	rib_damp_t *del;
+
+	if ( now - damp_last_sweep < RIB_DAMP_SWEEP_INTERVAL ) {
+		return;
+	}
+	damp_last_sweep = now;
+
+	for ( int bucket = 0; bucket < RIB_DAMP_HASH_SIZE; bucket++ ) {
+		cur = &(damp_hash[bucket]);
+		while ( *cur != NULL ) {
+			rib_damp_decay(*cur, now);
+			if ( !(*cur)->suppressed && (*cur)->penalty < (RIB_DAMP_REUSE / 2) ) {
+				del = *cur;
+				*cur = del->next;
+				free(del);
+			} else {
+				cur = &((*cur)->next);
+			}
+		}
+	}
+}
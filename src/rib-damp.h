@@ -0,0 +1,53 @@
+#ifndef XRIPD_RIB_DAMP_H
+#define XRIPD_RIB_DAMP_H
+
+#include "xripd.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Route flap damping (after RFC 2439), with its timescales brought down to those of RIP.
+// Each withdrawal of a remote route (poisoned by its neighbour) adds to the prefix's penalty, which halves every
+// RIB_DAMP_HALF_LIFE seconds. Once over RIB_DAMP_SUPPRESS, re-advertisements of the prefix are held (kept at
+// RIP_METRIC_INFINITY, not installed or advertised) until the penalty has decayed below RIB_DAMP_REUSE:
+#define RIB_DAMP_PENALTY_WITHDRAW 1000
+#define RIB_DAMP_SUPPRESS 2000
+#define RIB_DAMP_REUSE 750
+#define RIB_DAMP_HALF_LIFE 60
+
+// Longest a prefix may stay suppressed (seconds) after its last flap, caps the penalty at
+// RIB_DAMP_REUSE * 2^(RIB_DAMP_MAX_SUPPRESS / RIB_DAMP_HALF_LIFE):
+#define RIB_DAMP_MAX_SUPPRESS 300
+
+// Buckets in our prefix -> penalty hash, and how often (seconds) decayed records are swept out of it:
+#define RIB_DAMP_HASH_SIZE 1024
+#define RIB_DAMP_SWEEP_INTERVAL 10
+
+// Damping state of a prefix:
+typedef struct rib_damp_t {
+	uint32_t ipaddr;
+	uint32_t subnet;
+	double penalty; // As of updated
+	time_t updated;
+	uint8_t suppressed;
+	struct rib_damp_t *next;
+} rib_damp_t;
+
+// Charge a withdrawal to a prefix. Returns 1 if this has left the prefix suppressed:
+int rib_damp_withdraw(uint32_t ipaddr, uint32_t subnet, time_t now);
+
+// Is the prefix suppressed? Lifts the suppression once the penalty has decayed below RIB_DAMP_REUSE:
+int rib_damp_suppressed(uint32_t ipaddr, uint32_t subnet, time_t now);
+
+// Free the records of prefixes that have stopped flapping (at most every RIB_DAMP_SWEEP_INTERVAL):
+void rib_damp_expire(time_t now);
+
+#endif
@@ -0,0 +1,213 @@
+#include "rib-ingest.h"
+
+// Our queues, only used from the rib thread:
+static rib_ingest_queue_t *ingest_hash[RIB_INGEST_HASH_SIZE];
+static uint32_t ingest_queue_count = 0;
+static uint32_t ingest_backlog = 0;
+
+// Round robin of queues with routes waiting. The queue at the head (active_tail->next_active) is the one being serviced:
+static rib_ingest_queue_t *active_tail = NULL;
+
+// A route read in part off the pipe (a read() need not end on a route boundary):
+static uint8_t partial[sizeof(rib_entry_t)];
+static size_t partial_len = 0;
+
+// Hash a neighbour into a bucket:
+static uint32_t rib_ingest_hash(uint32_t neighbour) {
+	return (neighbour * 2654435761u) % RIB_INGEST_HASH_SIZE;
+}
+
+// Take a drained queue back off our hash, to be handed to a new neighbour. Returns NULL if every queue has routes waiting:
+static rib_ingest_queue_t *rib_ingest_reclaim(void) {
+
+	rib_ingest_queue_t **prev;
+	rib_ingest_queue_t *queue;
+
+	for ( int bucket = 0; bucket < RIB_INGEST_HASH_SIZE; bucket++ ) {
+		for ( prev = &ingest_hash[bucket]; (queue = *prev) != NULL; prev = &queue->next ) {
+			if ( !queue->active ) {
+				*prev = queue->next;
+				ingest_queue_count--;
+				return queue;
+			}
+		}
+	}
+	return NULL;
+}
+
+// Find the queue for a neighbour, creating it if we haven't queued a route from it before.
+// Once we're at RIB_INGEST_MAX_QUEUES, a drained queue is taken over (keeping its buffer). Only while every one of
+// them has routes waiting do routes from new neighbours share the queue of 0.0.0.0:
+static rib_ingest_queue_t *rib_ingest_lookup(uint32_t neighbour) {
+
+	uint32_t bucket = rib_ingest_hash(neighbour);
+	rib_ingest_queue_t *queue = ingest_hash[bucket];
+	rib_entry_t *entries = NULL;
+	uint32_t capacity = 0;
+
+	while ( queue != NULL ) {
+		if ( queue->neighbour == neighbour ) {
+			return queue;
+		}
+		queue = queue->next;
+	}
+
+	if ( ingest_queue_count >= RIB_INGEST_MAX_QUEUES ) {
+		queue = rib_ingest_reclaim();
+		if ( queue == NULL ) {
+			if ( neighbour != 0 ) {
+				return rib_ingest_lookup(0);
+			}
+		} else {
+			entries = queue->entries;
+			capacity = queue->capacity;
+		}
+	}
+
+	if ( queue == NULL ) {
+		queue = (rib_ingest_queue_t *)malloc(sizeof(rib_ingest_queue_t));
+	}
+	memset(queue, 0, sizeof(rib_ingest_queue_t));
+	queue->neighbour = neighbour;
+	queue->entries = entries;
+	queue->capacity = capacity;
+	queue->next = ingest_hash[bucket];
+	ingest_hash[bucket] = queue;
+	ingest_queue_count++;
+
+	return queue;
+}
+
+// Append a route to the tail of a queue, growing it as needed:
+static void rib_ingest_push(rib_ingest_queue_t *queue, const rib_entry_t *entry) {
+
+	rib_entry_t *entries;
+	uint32_t capacity;
+
+	if ( queue->count == queue->capacity ) {
+		// Grow, unwrapping our ring into the new buffer:
+		capacity = ( queue->capacity == 0 ) ? RIB_INGEST_QUEUE_INITIAL : queue->capacity * 2;
+		entries = (rib_entry_t *)malloc(capacity * sizeof(rib_entry_t));
+		for ( uint32_t i = 0; i < queue->count; i++ ) {
+			memcpy(&(entries[i]), &(queue->entries[(queue->head + i) % queue->capacity]), sizeof(rib_entry_t));
+		}
+		free(queue->entries);
+		queue->entries = entries;
+		queue->capacity = capacity;
+		queue->head = 0;
+	}
+
+	memcpy(&(queue->entries[(queue->head + queue->count) % queue->capacity]), entry, sizeof(rib_entry_t));
+	queue->count++;
+	queue->received++;
+	ingest_backlog++;
+
+	// Join the tail of our round robin:
+	if ( !queue->active ) {
+		queue->active = 1;
+		queue->deficit = 0;
+		if ( active_tail == NULL ) {
+			queue->next_active = queue;
+		} else {
+			queue->next_active = active_tail->next_active;
+			active_tail->next_active = queue;
+		}
+		active_tail = queue;
+	}
+}
+
+// Drain what we can from the pipe into our queues:
+int rib_ingest_read(int fd) {
+
+	uint8_t buf[RIB_INGEST_READ_BATCH * sizeof(rib_entry_t)];
+	ssize_t len;
+	size_t offset = 0;
+	int queued = 0;
+	rib_entry_t entry;
+
+	while ( ingest_backlog < RIB_INGEST_BACKLOG_MAX ) {
+
+		memcpy(buf, partial, partial_len);
+		len = read(fd, buf + partial_len, sizeof(buf) - partial_len);
+		if ( len == 0 ) {
+			return -1;
+		} else if ( len < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			return ( errno == EAGAIN || errno == EWOULDBLOCK ) ? queued : -1;
+		}
+		len += partial_len;
+
+		for ( offset = 0; offset + sizeof(rib_entry_t) <= (size_t)len; offset += sizeof(rib_entry_t) ) {
+			memcpy(&entry, buf + offset, sizeof(rib_entry_t));
+			rib_ingest_push(rib_ingest_lookup(entry.recv_from.sin_addr.s_addr), &entry);
+			queued++;
+		}
+
+		// Keep any trailing part of a route for our next read():
+		partial_len = len - offset;
+		memcpy(partial, buf + offset, partial_len);
+	}
+
+	return queued;
+}
+
+// Routes waiting in our queues:
+uint32_t rib_ingest_backlog(void) {
+	return ingest_backlog;
+}
+
+// Service up to budget routes from our queues, deficit round robin:
+int rib_ingest_service(void (*callback)(rib_entry_t *entry, void *arg), void *arg, int budget) {
+
+	rib_ingest_queue_t *queue;
+	int serviced = 0;
+
+	while ( active_tail != NULL && serviced < budget ) {
+
+		queue = active_tail->next_active;
+
+		// A fresh turn, credit the queue its quantum:
+		if ( queue->deficit == 0 ) {
+			queue->deficit = RIB_INGEST_QUANTUM;
+		}
+
+		while ( queue->count > 0 && queue->deficit > 0 && serviced < budget ) {
+			callback(&(queue->entries[queue->head]), arg);
+			queue->head = (queue->head + 1) % queue->capacity;
+			queue->count--;
+			queue->deficit--;
+			ingest_backlog--;
+			serviced++;
+		}
+
+		if ( queue->count == 0 ) {
+			// Drained, leave the round robin (any credit left is forfeit):
+			queue->active = 0;
+			queue->deficit = 0;
+			queue->head = 0;
+			if ( queue == active_tail ) {
+				active_tail = NULL;
+			} else {
+				active_tail->next_active = queue->next_active;
+			}
+			if ( queue->capacity > RIB_INGEST_QUEUE_SHRINK ) {
+				free(queue->entries);
+				queue->entries = NULL;
+				queue->capacity = 0;
+			}
+		} else if ( queue->deficit == 0 ) {
+			// Turn over, on to the next queue:
+			active_tail = queue;
+		}
+		// Otherwise our budget has run out mid turn, the queue picks up where it left off next cycle.
+	}
+
+#if XRIPD_DEBUG == 1
+	if ( serviced > 0 ) {
+		fprintf(stderr, "[rib]: Serviced %d route(s) from our ingest queues, %u route(s) waiting.\n", serviced, ingest_backlog);
+	}
+#endif
+	return serviced;
+}
@@ -0,0 +1,65 @@
+#ifndef XRIPD_RIB_INGEST_H
+#define XRIPD_RIB_INGEST_H
+
+#include "xripd.h"
+#include "rib.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Per-neighbour ingest queues for routes passed to us by the daemon.
+// Routes are drained off the pipe into a queue for the neighbour they were learnt from, and the queues are then
+// serviced deficit round robin: each turn a queue is credited RIB_INGEST_QUANTUM routes, and any credit left unspent
+// when our budget for the cycle runs out carries over to the next. A neighbour sending a full table is then worked
+// through a quantum at a time, and a neighbour sending a handful of changes is never queued behind it.
+
+// Routes a queue is credited with each turn:
+#define RIB_INGEST_QUANTUM 16
+
+// Buckets in our neighbour -> queue hash, and the most queues we keep. Past this a drained queue is handed to
+// the next new neighbour, routes from further neighbours only share queue 0.0.0.0 while every queue has routes waiting:
+#define RIB_INGEST_HASH_SIZE 64
+#define RIB_INGEST_MAX_QUEUES 256
+
+// Initial capacity of a queue (doubled as needed). A drained queue over RIB_INGEST_QUEUE_SHRINK is freed back down:
+#define RIB_INGEST_QUEUE_INITIAL 64
+#define RIB_INGEST_QUEUE_SHRINK 4096
+
+// Most routes held across all our queues. Past this we stop draining the pipe, and let it push back on the daemon:
+#define RIB_INGEST_BACKLOG_MAX 65536
+
+// Most routes read off the pipe in a single read():
+#define RIB_INGEST_READ_BATCH 64
+
+typedef struct rib_ingest_queue_t {
+	uint32_t neighbour; // Network order
+	rib_entry_t *entries; // Ring buffer
+	uint32_t head;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t deficit; // Routes we may still service this turn
+	uint8_t active; // On our round robin of queues with routes waiting
+	uint64_t received; // Routes queued since start
+	struct rib_ingest_queue_t *next; // Hash chain
+	struct rib_ingest_queue_t *next_active; // Round robin
+} rib_ingest_queue_t;
+
+// Drain what we can from the pipe fd (non blocking) into our queues.
+// Returns the number of routes queued, or -1 if the pipe is closed or errored:
+int rib_ingest_read(int fd);
+
+// Routes waiting in our queues:
+uint32_t rib_ingest_backlog(void);
+
+// Service up to budget routes from our queues, deficit round robin, passing each to callback.
+// Returns the number of routes serviced:
+int rib_ingest_service(void (*callback)(rib_entry_t *entry, void *arg), void *arg, int budget);
+
+#endif
@@ -1,4 +1,5 @@
 #include "rib-ll.h"
+#include "rib-neigh.h"
 
 // Comparison return values:
 #define LL_CMP_NO_MATCH 0x00
@@ -16,6 +17,7 @@
 
 typedef struct rib_ll_node_t {
 	rib_entry_t entry;
+	rib_neigh_link_t neigh_link; // On the route list of the neighbour this route is counted against (see rib-neigh.h)
 	struct rib_ll_node_t *next;
 } rib_ll_node_t;
 
@@ -35,7 +37,9 @@ static int rib_ll_new_node(rib_ll_node_t *new, const rib_entry_t *in_entry, rib_
 	new = (rib_ll_node_t*)malloc(sizeof(rib_ll_node_t));
 	memset(new, 0, sizeof(rib_ll_node_t));
 	memcpy(&(new->entry), in_entry, sizeof(rib_entry_t));
+	new->entry.changed = 1;
 	new->next = NULL;
+	rib_neigh_account(&(new->neigh_link), &(new->entry));
 
 	// If input is NOT head:
 	if ( last != NULL ) {
@@ -127,6 +131,64 @@ int rib_ll_serialise_rib(char *buf, const uint32_t *count) {
 	return index;
 }
 
+// Call callback on every entry of our rib, allowing it to inspect/modify the entry in place.
+// Walk stops early if callback returns non-zero. Returns the number of entries visited:
+int rib_ll_walk_rib(int (*callback)(rib_entry_t*, void*), void *arg) {
+
+	rib_ll_node_t *cur = head;
+	int count = 0;
+
+	while ( cur != NULL ) {
+		count++;
+		if ( (*callback)(&(cur->entry), arg) != 0 ) {
+			rib_neigh_account(&(cur->neigh_link), &(cur->entry));
+			break;
+		}
+		// The callback may have invalidated the entry:
+		rib_neigh_account(&(cur->neigh_link), &(cur->entry));
+		cur = cur->next;
+	}
+	return count;
+}
+
+// Find the entry for an exact prefix (ipaddr/subnet), copy it into out.
+// Return 1 if the prefix is not in our rib:
+int rib_ll_lookup_rib(uint32_t ipaddr, uint32_t subnet, rib_entry_t *out) {
+
+	rib_ll_node_t *cur = head;
+
+	while ( cur != NULL ) {
+		if ( cur->entry.rip_msg_entry.ipaddr == ipaddr && cur->entry.rip_msg_entry.subnet == subnet ) {
+			memcpy(out, &(cur->entry), sizeof(rib_entry_t));
+			return 0;
+		}
+		cur = cur->next;
+	}
+	return 1;
+}
+
+// Record the kernel state of a prefix. RIB_FIB_PENDING records seq, any other state is
+// only applied if seq matches the last request sent for the prefix (older ACKs are stale).
+// Return 1 if not found (or stale):
+int rib_ll_update_fib_state(uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint8_t fib_state) {
+
+	rib_ll_node_t *cur = head;
+
+	while ( cur != NULL ) {
+		if ( cur->entry.rip_msg_entry.ipaddr == ipaddr && cur->entry.rip_msg_entry.subnet == subnet ) {
+			if ( fib_state == RIB_FIB_PENDING ) {
+				cur->entry.fib_seq = seq;
+			} else if ( cur->entry.fib_seq != seq ) {
+				return 1;
+			}
+			cur->entry.fib_state = fib_state;
+			return 0;
+		}
+		cur = cur->next;
+	}
+	return 1;
+}
+
 // Evaluate in_entry against our current RIB
 // Potentially return ins_route and/or del_route as return rib_entry_t types
 // which are used to add/delete desired routes from the kernel table:
@@ -145,7 +207,10 @@ int rib_ll_add_to_rib(int *route_ret, const rib_entry_t *in_entry, rib_entry_t *
 		if ( cur == NULL ) {
 			head = (rib_ll_node_t*)malloc(sizeof(rib_ll_node_t));
 			memcpy(&(head->entry), in_entry, sizeof(rib_entry_t));
+			head->entry.changed = 1;
 			head->next = NULL;
+			memset(&(head->neigh_link), 0, sizeof(rib_neigh_link_t));
+			rib_neigh_account(&(head->neigh_link), &(head->entry));
 			// Prepare ins_route, and return:
 			// copy_rib_entry(in_entry, ins_route);
 			memcpy(ins_route, in_entry, sizeof(rib_entry_t));
@@ -203,6 +268,8 @@ int rib_ll_add_to_rib(int *route_ret, const rib_entry_t *in_entry, rib_entry_t *
 						}
 
 						memcpy(&(cur->entry), in_entry, sizeof(rib_entry_t));
+						cur->entry.changed = 1;
+						rib_neigh_account(&(cur->neigh_link), &(cur->entry));
 
 						// Return ins_route as our route to replace:
 						memcpy(ins_route, in_entry, sizeof(rib_entry_t));
@@ -246,6 +313,8 @@ int rib_ll_add_to_rib(int *route_ret, const rib_entry_t *in_entry, rib_entry_t *
 #endif
 					// Replace the entry in the rib with our invalidated in_entry
 					memcpy(&(cur->entry), in_entry, sizeof(rib_entry_t));
+					cur->entry.changed = 1;
+					rib_neigh_account(&(cur->neigh_link), &(cur->entry));
 
 					// Return with our invalidated route, ready to process:
 					memcpy(del_route, in_entry, sizeof(rib_entry_t));
@@ -270,6 +339,7 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 	rib_ll_node_t *cur = head;
 	rib_ll_node_t *last = head;
 	rib_ll_node_t *delnode;
+	int invcount = 0;
 
 	// Iterate over our linked list:
 	while ( cur != NULL ) {
@@ -283,6 +353,12 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 				(cur->entry.recv_time > gc_time) && 
 				(ntohl(cur->entry.rip_msg_entry.metric) < RIP_METRIC_INFINITY) &&
 				(cur->entry.origin != RIB_ORIGIN_LOCAL) ) {
+
+			// Invalidate, and flag for a triggered update:
+			cur->entry.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+			cur->entry.changed = 1;
+			rib_neigh_account(&(cur->neigh_link), &(cur->entry));
+			invcount++;
 #if XRIPD_DEBUG == 1
 			char ipaddr[16];
 			char subnet[16];
@@ -290,7 +366,6 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 			inet_ntop(AF_INET, &(cur->entry.rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
 			inet_ntop(AF_INET, &(cur->entry.rip_msg_entry.subnet), subnet, sizeof(subnet));
 			inet_ntop(AF_INET, &(cur->entry.recv_from.sin_addr.s_addr), nexthop, sizeof(nexthop));
-			cur->entry.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
 			fprintf(stderr, "[l-list]: Node Expired (Metric set to %d): %p IP: %s %s NH: %s Metric: %02d Timestamp: %lld Next: %p -- Current Time: %lld Expiration Time: %lld\n",
 					RIP_METRIC_INFINITY, cur, ipaddr, subnet, nexthop, 
 					ntohl(cur->entry.rip_msg_entry.metric), (long long)(cur->entry.recv_time), cur->next, (long long)now, (long long)expiration_time);
@@ -322,6 +397,7 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 
 				// Free our current node for deletion, and reset current and last to new head node:
 				(*delcount)++;
+				rib_neigh_account(&(cur->neigh_link), NULL);
 				free(cur);
 				cur = head;
 				last = head;
@@ -337,6 +413,7 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 				cur = cur->next;
 				// Delete from memory
 				(*delcount)++;
+				rib_neigh_account(&(delnode->neigh_link), NULL);
 				free(delnode);
 			}
 
@@ -347,7 +424,7 @@ int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delcount) {
 			cur = cur->next;
 		}
 	}
-	return 0;
+	return invcount;
 }
 
 // Traverse datastructure for RIB_ORIGIN_LOCAL routes
@@ -379,6 +456,7 @@ int rib_ll_invalidate_expired_local_routes(time_t last_run) {
 #endif
 			// Invalidate:
 			cur->entry.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+			cur->entry.changed = 1;
 			ret = 1;
 		}
 
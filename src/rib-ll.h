@@ -28,7 +28,7 @@ int rib_ll_init();
 // ins_rouce or del_route depending on return of the function
 int rib_ll_add_to_rib(int *route_ret, const rib_entry_t *in_entry, rib_entry_t *ins_route, rib_entry_t *del_route, int *rib_inc);
 
-// Expire out old entries out of the rib:
+// Expire out old entries out of the rib, returns the number of routes invalidated:
 int rib_ll_remove_expired_entries(const rip_timers_t *timers, int *delroute);
 
 // Traverse datastructure for RIB_ORIGIN_LOCAL routes
@@ -43,5 +43,15 @@ int rib_ll_dump_rib();
 
 int rib_ll_serialise_rib(char *buf, const uint32_t *count);
 
+// Call callback on every entry, stop if callback returns non-zero:
+int rib_ll_walk_rib(int (*callback)(rib_entry_t*, void*), void *arg);
+
+// Find the entry for an exact prefix, copy it into out. Return 1 if not found:
+int rib_ll_lookup_rib(uint32_t ipaddr, uint32_t subnet, rib_entry_t *out);
+
+// Record the kernel state of a prefix. RIB_FIB_PENDING records seq, any other state is
+// only applied if seq matches the last request. Return 1 if not found (or stale):
+int rib_ll_update_fib_state(uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint8_t fib_state);
+
 void rib_ll_destroy_rib();
 #endif
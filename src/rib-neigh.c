@@ -0,0 +1,166 @@
+#include "rib-neigh.h"
+
+// Our neighbours, only used from the rib thread (under mutex_rib_lock):
+static rib_neigh_t *neigh_hash[RIB_NEIGH_HASH_SIZE];
+static uint32_t neigh_count = 0;
+
+// Shared by every neighbour past RIB_NEIGH_MAX:
+static rib_neigh_t neigh_other;
+
+// Hash a neighbour into a bucket:
+static uint32_t rib_neigh_hash(uint32_t addr) {
+	return (addr * 2654435761u) % RIB_NEIGH_HASH_SIZE;
+}
+
+// Find the record for a neighbour, creating it if we don't yet have one:
+rib_neigh_t *rib_neigh_lookup(uint32_t addr) {
+
+	uint32_t bucket = rib_neigh_hash(addr);
+	rib_neigh_t *neigh = neigh_hash[bucket];
+
+	while ( neigh != NULL ) {
+		if ( neigh->addr == addr ) {
+			return neigh;
+		}
+		neigh = neigh->next;
+	}
+
+	if ( neigh_count >= RIB_NEIGH_MAX ) {
+		return &neigh_other;
+	}
+
+	neigh = (rib_neigh_t *)malloc(sizeof(rib_neigh_t));
+	memset(neigh, 0, sizeof(rib_neigh_t));
+	neigh->addr = addr;
+	neigh->next = neigh_hash[bucket];
+	neigh_hash[bucket] = neigh;
+	neigh_count++;
+
+	return neigh;
+}
+
+// Keep our route counts and lists exact. An entry counts against the neighbour it was learnt from while it is reachable:
+void rib_neigh_account(rib_neigh_link_t *link, rib_entry_t *entry) {
+
+	rib_neigh_t *neigh = NULL;
+
+	link->entry = entry;
+	if ( entry != NULL && entry->origin == RIB_ORIGIN_REMOTE && ntohl(entry->rip_msg_entry.metric) < RIP_METRIC_INFINITY ) {
+		// Already on the list of its neighbour, nothing has changed:
+		if ( link->neigh != NULL && link->neigh->addr == entry->recv_from.sin_addr.s_addr ) {
+			return;
+		}
+		neigh = rib_neigh_lookup(entry->recv_from.sin_addr.s_addr);
+	}
+
+	if ( neigh == link->neigh ) {
+		return;
+	}
+
+	// Off the list of the neighbour it counted against:
+	if ( link->neigh != NULL ) {
+		if ( link->prev != NULL ) {
+			link->prev->next = link->next;
+		} else {
+			link->neigh->head = link->next;
+		}
+		if ( link->next != NULL ) {
+			link->next->prev = link->prev;
+		}
+		link->neigh->routes--;
+	}
+
+	// Onto the head of its new neighbour's list:
+	link->prev = NULL;
+	link->next = NULL;
+	if ( neigh != NULL ) {
+		link->next = neigh->head;
+		if ( neigh->head != NULL ) {
+			neigh->head->prev = link;
+		}
+		neigh->head = link;
+		neigh->routes++;
+		// Routes not passed to us by the daemon (adopted from the kernel on a warm start) count as hearing from it:
+		if ( entry->recv_time > neigh->last_heard ) {
+			neigh->last_heard = entry->recv_time;
+		}
+	}
+	link->neigh = neigh;
+}
+
+// Call callback on each reachable route held from neigh:
+int rib_neigh_walk(rib_neigh_t *neigh, int (*callback)(rib_entry_t*, void*), void *arg) {
+
+	rib_neigh_link_t *link = neigh->head;
+	rib_neigh_link_t *next;
+	int count = 0;
+
+	while ( link != NULL ) {
+		// The callback may invalidate the route, taking it off our list:
+		next = link->next;
+		count++;
+		(*callback)(link->entry, arg);
+		rib_neigh_account(link, link->entry);
+		link = next;
+	}
+	return count;
+}
+
+// Call callback on each neighbour that still has reachable routes, but has not been heard from since before.
+// A neighbour left holding no routes is then forgotten (unless still held over its limit), freeing its slot:
+void rib_neigh_expire(time_t before, void (*callback)(rib_neigh_t*, void*), void *arg) {
+
+	rib_neigh_t **prev;
+	rib_neigh_t *neigh;
+	time_t now = time(NULL);
+
+	for ( int bucket = 0; bucket < RIB_NEIGH_HASH_SIZE; bucket++ ) {
+		prev = &neigh_hash[bucket];
+		while ( (neigh = *prev) != NULL ) {
+			if ( neigh->last_heard >= before ) {
+				prev = &neigh->next;
+				continue;
+			}
+			if ( neigh->routes > 0 ) {
+				(*callback)(neigh, arg);
+			}
+			if ( neigh->routes > 0 || neigh->held_until > now ) {
+				prev = &neigh->next;
+				continue;
+			}
+			*prev = neigh->next;
+			free(neigh);
+			neigh_count--;
+		}
+	}
+	if ( neigh_other.routes > 0 && neigh_other.last_heard < before ) {
+		(*callback)(&neigh_other, arg);
+	}
+}
+
+// Dump a neighbour:
+static void rib_neigh_dump_one(const rib_neigh_t *neigh) {
+
+	char addr[16];
+	inet_ntop(AF_INET, &(neigh->addr), addr, sizeof(addr));
+	fprintf(stderr, "[rib]: Neighbour: %s Routes: %u Last Heard: %lld Received: %llu Refused: %llu Timed Out: %llu\n",
+			addr, neigh->routes, (long long)neigh->last_heard, (unsigned long long)neigh->routes_received,
+			(unsigned long long)neigh->routes_refused, (unsigned long long)neigh->routes_timed_out);
+}
+
+// Dump our neighbour table:
+void rib_neigh_dump(void) {
+
+	rib_neigh_t *neigh;
+
+	fprintf(stderr, "[rib]: Start Neighbour Dump (%u neighbour(s))\n", neigh_count);
+	for ( int bucket = 0; bucket < RIB_NEIGH_HASH_SIZE; bucket++ ) {
+		for ( neigh = neigh_hash[bucket]; neigh != NULL; neigh = neigh->next ) {
+			rib_neigh_dump_one(neigh);
+		}
+	}
+	if ( neigh_other.routes_received > 0 ) {
+		rib_neigh_dump_one(&neigh_other);
+	}
+	fprintf(stderr, "[rib]: End Neighbour Dump\n");
+}
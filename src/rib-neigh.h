@@ -0,0 +1,66 @@
+#ifndef XRIPD_RIB_NEIGH_H
+#define XRIPD_RIB_NEIGH_H
+
+#include "xripd.h"
+#include "rib.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Buckets in our neighbour -> record hash, and the most neighbours we keep a record of at once
+// (routes from any further neighbours are counted against a shared record, 0.0.0.0, until a quiet neighbour is forgotten):
+#define RIB_NEIGH_HASH_SIZE 64
+#define RIB_NEIGH_MAX 256
+
+// Each neighbour's reachable routes are threaded onto a list through a link embedded in the datastore's node for the route,
+// so everything we hold from a neighbour can be reached (or invalidated) without a walk of the whole rib:
+//
+//   rib_neigh_t (192.0.2.50) -> [node: entry | link] <-> [node: entry | link] <-> ...
+//
+typedef struct rib_neigh_link_t {
+	struct rib_neigh_t *neigh; // Neighbour the route is counted against (NULL for none)
+	rib_entry_t *entry; // The route (in the datastore's node)
+	struct rib_neigh_link_t *prev;
+	struct rib_neigh_link_t *next;
+} rib_neigh_link_t;
+
+// Our neighbour table, what the rib knows of each neighbour it has heard from.
+// Only used from the rib thread (under mutex_rib_lock):
+typedef struct rib_neigh_t {
+	uint32_t addr; // Network order
+	time_t last_heard; // Last route received from this neighbour
+	uint32_t routes; // Reachable routes held from this neighbour (metric < RIP_METRIC_INFINITY), the length of head
+	rib_neigh_link_t *head;
+	uint64_t routes_received; // Routes passed to us by the daemon
+	uint64_t routes_refused; // New routes refused over our maximum prefix limit
+	uint64_t routes_timed_out; // Routes invalidated by the neighbour timing out
+	uint8_t limit_logged; // We have logged this neighbour as at its limit
+	time_t held_until; // Purged over its limit, its routes are refused until
+	struct rib_neigh_t *next;
+} rib_neigh_t;
+
+// Find the record for a neighbour, creating it if we don't yet have one:
+rib_neigh_t *rib_neigh_lookup(uint32_t addr);
+
+// Keep our route counts and lists exact. Called by the datastore whenever an entry is added, changed or removed (entry NULL),
+// with the link of its node, which is moved onto the list of the neighbour the entry now counts against (if any):
+void rib_neigh_account(rib_neigh_link_t *link, rib_entry_t *entry);
+
+// Call callback on each reachable route held from neigh (which may invalidate it). Returns the number of routes visited:
+int rib_neigh_walk(rib_neigh_t *neigh, int (*callback)(rib_entry_t*, void*), void *arg);
+
+// Call callback on each neighbour that still has reachable routes, but has not been heard from since before.
+// Neighbours not heard from since before that are left with no routes (and are not held) are then forgotten:
+void rib_neigh_expire(time_t before, void (*callback)(rib_neigh_t*, void*), void *arg);
+
+// Dump our neighbour table:
+void rib_neigh_dump(void);
+
+#endif
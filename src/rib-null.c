@@ -42,6 +42,27 @@ int rib_null_serialise_rib(char *buf, const uint32_t *count) {
 	return 0;
 }
 
+int rib_null_walk_rib(int (*callback)(rib_entry_t*, void*), void *arg) {
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[null]: Walking RIB, Empty no surprise ...\n");
+#endif
+	return 0;
+}
+
+int rib_null_lookup_rib(uint32_t ipaddr, uint32_t subnet, rib_entry_t *out) {
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[null]: Looking up RIB, Empty no surprise ...\n");
+#endif
+	return 1;
+}
+
+int rib_null_update_fib_state(uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint8_t fib_state) {
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[null]: Updating FIB state, Empty no surprise ...\n");
+#endif
+	return 1;
+}
+
 void rib_null_destroy_rib() {
 #if XRIPD_DEBUG == 1
 	fprintf(stderr, "[null]: Destroying RIB, Nothing to destroy ...\n");
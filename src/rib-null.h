@@ -26,6 +26,9 @@ int rib_null_invalidate_expired_local_routes(time_t last_run);
 int rib_null_remove_expired_entries(const rip_timers_t *timeers, int *delroute);
 
 int rib_null_serialise_rib(char *buf, const uint32_t *count);
+int rib_null_walk_rib(int (*callback)(rib_entry_t*, void*), void *arg);
+int rib_null_lookup_rib(uint32_t ipaddr, uint32_t subnet, rib_entry_t *out);
+int rib_null_update_fib_state(uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint8_t fib_state);
 int rib_null_dump_rib();
 
 void rib_null_destroy_rib();
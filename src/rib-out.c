@@ -1,4 +1,5 @@
 #include "rib-out.h"
+#include "route.h"
 
 // Given a sun_addresses_t struct, Populate our daemon and rib addresses, bind to the rib address
 // for an Abtract Unix Domain Socket
@@ -44,23 +45,18 @@ failed_socket_init:
 }
 
 // Send a serialise requeset to our rib, to return our routes into a buffer,
-// Send these via the 'rib_ctl' buffer back to the daemon via a reply message:
-static void send_rib_ctl_reply(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses) {
+// Send these via the 'rib_ctl' buffer back to the daemon via a reply message.
+// reply_to is echoed back to the daemon in our ENDREPLY, it tells the daemon where to send the dump:
+static void send_rib_ctl_reply(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses, const struct sockaddr_in *reply_to) {
 
 	int len = 0;
 	int retval = 0;
 
 	int msgnum = 0;
 
-	// Used for sending the route through our filter:
-	uint32_t ip = 0;
-	uint32_t netmask = 0;
-
 	// rib_ctl_reply struct:
-	struct rib_ctl_reply {
-		rib_ctl_hdr_t header;
-		rib_entry_t entry;
-	} ctl_reply;
+	rib_ctl_reply_t ctl_reply;
+	rib_ctl_request_t ctl_endreply;
 
 	// Format header:
 	ctl_reply.header.version = RIB_CTL_HDR_VERSION_1;
@@ -80,25 +76,18 @@ static void send_rib_ctl_reply(xripd_settings_t *xripd_settings, const sun_addre
 		// Iterate over the buffer:
 		for ( int i = 0; i < len; i++ ) {
 
-			// Pass route through our filter (if it is configured):
-			if ( xripd_settings->filter_mode != XRIPD_FILTER_MODE_NULL ) {
-
-				// Pointer magic:
-				ip = ((rib_entry_t *)(buf + (i * sizeof(rib_entry_t))))->rip_msg_entry.ipaddr;
-				netmask = ((rib_entry_t *)(buf + (i * sizeof(rib_entry_t))))->rip_msg_entry.subnet;
-
-				// If the route does not pass through the filter, continue onto the next route:
-				if ( filter_route(xripd_settings->xripd_rib->filter, ip, 
-					netmask) != XRIPD_FILTER_RESULT_ALLOW ) {
+			// Skip routes our filter/policy denies (verdict cached in the entry by the rib):
+			if ( ((rib_entry_t *)(buf + (i * sizeof(rib_entry_t))))->out_denied ) {
 #if XRIPD_DEBUG == 1
-					fprintf(stderr, "[rib-out]: Filtered route from being sent via RIB_CTL_HDR_MSGTYPE_REPLY\n");
+				fprintf(stderr, "[rib-out]: Filtered route from being sent via RIB_CTL_HDR_MSGTYPE_REPLY\n");
 #endif
-					continue;
-				}
+				continue;
 			}
 
-			// Add entry to reply struct:
+			// Add entry to reply struct, with the next hop we advertise it with:
 			memcpy(&(ctl_reply.entry), (rib_entry_t*)(buf + (i * sizeof(rib_entry_t))), sizeof(rib_entry_t));
+			ctl_reply.entry.rip_msg_entry.nexthop = route_advertised_nexthop(xripd_settings, &(ctl_reply.entry));
+			policy_apply(&(ctl_reply.entry.out_policy), &(ctl_reply.entry.rip_msg_entry));
 			
 			// Send reply via socket back to the daemon:
 			retval = sendto(sun_addresses->socketfd, &ctl_reply, sizeof(ctl_reply), 
@@ -108,44 +97,216 @@ static void send_rib_ctl_reply(xripd_settings_t *xripd_settings, const sun_addre
 			fprintf(stderr, "[rib-out]: Sent %d bytes in RIB_CTL_HDR_MSGTYPE_REPLY Msg No: %d\n", retval, msgnum);
 #endif
 		}
+	}
 
-		// Format header for ENDREPLY, this it to let the daemon know we have reached the end of our datagram stream:
-		ctl_reply.header.version = RIB_CTL_HDR_VERSION_1;
-		ctl_reply.header.msgtype = RIB_CTL_HDR_MSGTYPE_ENDREPLY;
-		
-		// Send endreply via socket to the daemon:
-		retval = sendto(sun_addresses->socketfd, &(ctl_reply.header), sizeof(ctl_reply.header), 
-				0, (struct sockaddr *) &(sun_addresses->sockaddr_un_daemon), sizeof(struct sockaddr_un));
+	// Format header for ENDREPLY, this it to let the daemon know we have reached the end of our datagram stream.
+	// Always sent (even for an empty rib), so the daemon can finish the stream:
+	memset(&ctl_endreply, 0, sizeof(ctl_endreply));
+	ctl_endreply.header.version = RIB_CTL_HDR_VERSION_1;
+	ctl_endreply.header.msgtype = RIB_CTL_HDR_MSGTYPE_ENDREPLY;
+	memcpy(&(ctl_endreply.reply_to), reply_to, sizeof(struct sockaddr_in));
+	
+	// Send endreply via socket to the daemon:
+	retval = sendto(sun_addresses->socketfd, &ctl_endreply, sizeof(ctl_endreply), 
+			0, (struct sockaddr *) &(sun_addresses->sockaddr_un_daemon), sizeof(struct sockaddr_un));
 #if XRIPD_DEBUG == 1
-		fprintf(stderr, "[rib-out]: Sent %d bytes in RIB_CTL_HDR_MSGTYPE_ENDREPLY.\n", retval);
+	fprintf(stderr, "[rib-out]: Sent %d bytes in RIB_CTL_HDR_MSGTYPE_ENDREPLY.\n", retval);
 #endif
 
-	}
 	// Free up the heap:
 	free(buf);
 }
 
+// Growable buffer of rib entries, filled in by collect_changed_entry():
+typedef struct changed_routes_t {
+	rib_entry_t *entries;
+	uint32_t count;
+	uint32_t size;
+} changed_routes_t;
+
+// walk_rib callback. Copy out routes flagged as changed by the datastore, and clear the flag:
+static int collect_changed_entry(rib_entry_t *entry, void *arg) {
+
+	changed_routes_t *changed = (changed_routes_t *)arg;
+
+	if ( entry->changed == 0 ) {
+		return 0;
+	}
+
+	// Grow our buffer if required:
+	if ( changed->count == changed->size ) {
+		changed->size = (changed->size == 0) ? 16 : changed->size * 2;
+		changed->entries = (rib_entry_t *)realloc(changed->entries, changed->size * sizeof(rib_entry_t));
+	}
+
+	memcpy(&(changed->entries[changed->count]), entry, sizeof(rib_entry_t));
+	changed->count++;
+	entry->changed = 0;
+	entry->filter_withdraw = 0;
+
+	return 0;
+}
+
+// Triggered update. Pull all changed routes out of the rib, and send them to the daemon
+// as an UNSOLICITED stream, terminated by an ENDUNSOLICITED message.
+// The daemon is responsible for holding off and batching these onto the network:
+static void send_rib_ctl_unsolicited(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses) {
+
+	int retval = 0;
+	uint8_t urgent = 0;
+
+	changed_routes_t changed;
+	memset(&changed, 0, sizeof(changed));
+
+	rib_ctl_reply_t ctl_reply;
+	rib_ctl_endunsolicited_t ctl_end;
+
+	// Collect our changed routes, and allow the rib to signal us again:
+	pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+	(*xripd_settings->xripd_rib->walk_rib)(&collect_changed_entry, &changed);
+	xripd_settings->rib_shared.trigger_flag = 0;
+	urgent = xripd_settings->rib_shared.trigger_urgent;
+	xripd_settings->rib_shared.trigger_urgent = 0;
+	pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+
+	if ( changed.count == 0 ) {
+		return;
+	}
+
+	ctl_reply.header.version = RIB_CTL_HDR_VERSION_1;
+	ctl_reply.header.msgtype = RIB_CTL_HDR_MSGTYPE_UNSOLICITED;
+
+	for ( int i = 0; i < changed.count; i++ ) {
+
+		memcpy(&(ctl_reply.entry), &(changed.entries[i]), sizeof(rib_entry_t));
+
+		// Skip routes our filter denies.
+		// A route just denied by a reloaded filter is sent this once as unreachable, so our neighbours drop it now:
+		if ( changed.entries[i].out_denied ) {
+			if ( !changed.entries[i].filter_withdraw ) {
+				continue;
+			}
+			ctl_reply.entry.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+		} else {
+			policy_apply(&(ctl_reply.entry.out_policy), &(ctl_reply.entry.rip_msg_entry));
+		}
+
+		ctl_reply.entry.rip_msg_entry.nexthop = route_advertised_nexthop(xripd_settings, &(ctl_reply.entry));
+		retval = sendto(sun_addresses->socketfd, &ctl_reply, sizeof(ctl_reply), 
+				0, (struct sockaddr *) &(sun_addresses->sockaddr_un_daemon), sizeof(struct sockaddr_un));
+	}
+
+	// Signify the end of our stream:
+	memset(&ctl_end, 0, sizeof(ctl_end));
+	ctl_end.header.version = RIB_CTL_HDR_VERSION_1;
+	ctl_end.header.msgtype = RIB_CTL_HDR_MSGTYPE_ENDUNSOLICITED;
+	ctl_end.urgent = urgent;
+	retval = sendto(sun_addresses->socketfd, &ctl_end, sizeof(ctl_end), 
+			0, (struct sockaddr *) &(sun_addresses->sockaddr_un_daemon), sizeof(struct sockaddr_un));
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[rib-out]: Sent %d changed route(s) via RIB_CTL_HDR_MSGTYPE_UNSOLICITED (ENDUNSOLICITED %d bytes).\n", changed.count, retval);
+#endif
+
+	free(changed.entries);
+}
+
+// Answer a LOOKUP for specific routes (a RIPv2 REQUEST). Each requested entry gets the metric of the
+// matching prefix in our rib, or RIP_METRIC_INFINITY if we have no such route (or it is filtered).
+// Entries are returned in the order requested, with the same reply_to, in a single LOOKUPREPLY:
+static void send_rib_ctl_lookup_reply(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses, rib_ctl_lookup_t *lookup) {
+
+	int retval = 0;
+	rib_entry_t found;
+	rip_msg_entry_t *req_entry;
+
+	if ( lookup->count > RIP_MAX_ENTRIES ) {
+		lookup->count = RIP_MAX_ENTRIES;
+	}
+
+	pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+	for ( int i = 0; i < lookup->count; i++ ) {
+
+		req_entry = &(lookup->entries[i]);
+		req_entry->metric = htonl(RIP_METRIC_INFINITY);
+
+		// Unknown address family, or not in our rib:
+		if ( ntohs(req_entry->afi) != RIP_AFI_INET ||
+			(*xripd_settings->xripd_rib->lookup_rib)(req_entry->ipaddr, req_entry->subnet, &found) != 0 ) {
+			continue;
+		}
+
+		// Filtered routes are never advertised:
+		if ( found.out_denied ) {
+			continue;
+		}
+
+		policy_apply(&(found.out_policy), &(found.rip_msg_entry));
+		req_entry->metric = found.rip_msg_entry.metric;
+		req_entry->nexthop = route_advertised_nexthop(xripd_settings, &found);
+		req_entry->tag = found.rip_msg_entry.tag;
+	}
+	pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+
+	lookup->header.version = RIB_CTL_HDR_VERSION_1;
+	lookup->header.msgtype = RIB_CTL_HDR_MSGTYPE_LOOKUPREPLY;
+	retval = sendto(sun_addresses->socketfd, lookup, sizeof(rib_ctl_lookup_t), 
+			0, (struct sockaddr *) &(sun_addresses->sockaddr_un_daemon), sizeof(struct sockaddr_un));
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[rib-out]: Sent %d bytes in RIB_CTL_HDR_MSGTYPE_LOOKUPREPLY for %d entries.\n", retval, lookup->count);
+#endif
+}
+
 // Main Listening Loop
-// Wait on the Unix Socket, parse the message type, and then dispatch appropriately:
+// Wait on the Unix Socket and our trigger pipe, parse the message type, and then dispatch appropriately:
 static void listen_loop(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses) {
 
-	// Create a buffer that fits atleast 1 rib_ctl header and 1 rib entry:
+	// Create a buffer that fits our largest inbound message, a LOOKUP:
 	int len = 0;
-	char *buf = (char *)malloc((sizeof(rib_ctl_hdr_t)) + sizeof(rib_entry_t));
-	memset(buf, 0, (sizeof(rib_ctl_hdr_t) + sizeof(rib_entry_t)));
+	char *buf = (char *)malloc(sizeof(rib_ctl_lookup_t));
+	memset(buf, 0, sizeof(rib_ctl_lookup_t));
 
 	// Pointer used to parse our Header:
 	struct rib_ctl_hdr_t *rib_control_header;
 
+	// select() variables:
+	fd_set readfds;
+	struct timeval timeout;
+	int sret;
+	int trigger_fd = xripd_settings->rib_shared.p_trigger[0];
+	int max_fd = (sun_addresses->socketfd > trigger_fd) ? sun_addresses->socketfd : trigger_fd;
+	char trigger_drain[64];
+
 	// Listen Loop:
 	while (1) {
 
+		FD_ZERO(&readfds);
+		FD_SET(sun_addresses->socketfd, &readfds);
+		FD_SET(trigger_fd, &readfds);
+
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+
+		sret = select(max_fd + 1, &readfds, NULL, NULL, &timeout);
+		if ( sret <= 0 ) {
+			continue;
+		}
+
+		// The rib has signalled route changes, drain the pipe and send a triggered update:
+		if ( FD_ISSET(trigger_fd, &readfds) ) {
+			while ( read(trigger_fd, trigger_drain, sizeof(trigger_drain)) > 0 );
+			send_rib_ctl_unsolicited(xripd_settings, sun_addresses);
+		}
+
+		if ( !FD_ISSET(sun_addresses->socketfd, &readfds) ) {
+			continue;
+		}
+
 		// Read bytes from UNIX Socket, placing into buf:
-		len = read(sun_addresses->socketfd, buf, sizeof(buf));
+		len = read(sun_addresses->socketfd, buf, sizeof(rib_ctl_lookup_t));
 		
 		// If our datagram is incompletely formed, move along:
 		if ( len < sizeof(rib_ctl_hdr_t) ) {
-			break;
+			continue;
 		}
 		
 		// Cast our raw recieved bytes to retrieve our header:
@@ -154,14 +315,35 @@ static void listen_loop(xripd_settings_t *xripd_settings, const sun_addresses_t
 		// Only support VERSION_1 for now:
 		if ( rib_control_header->version != RIB_CTL_HDR_VERSION_1 ) {
 			fprintf(stderr, "[rib-out]: Received Unsupported Version.\n");
-			break;
+			continue;
 		}
 
 		// Parse our header:
 		switch (rib_control_header->msgtype) {
 			case RIB_CTL_HDR_MSGTYPE_REQUEST:
-				fprintf(stderr, "[rib-out]: Received RIB_CTRL_MSGTYPE_REQUEST from xripd-daemon.\n");
-				send_rib_ctl_reply(xripd_settings, sun_addresses);
+			case RIB_CTL_HDR_MSGTYPE_REQUESTALL:
+				if ( len < sizeof(rib_ctl_request_t) ) {
+					break;
+				}
+#if XRIPD_DEBUG == 1
+				fprintf(stderr, "[rib-out]: Received RIB_CTRL_MSGTYPE_REQUEST%s from xripd-daemon.\n", 
+						(rib_control_header->msgtype == RIB_CTL_HDR_MSGTYPE_REQUESTALL) ? "ALL" : "");
+#endif
+				send_rib_ctl_reply(xripd_settings, sun_addresses, &(((rib_ctl_request_t *)buf)->reply_to));
+				break;
+			case RIB_CTL_HDR_MSGTYPE_LOOKUP:
+				if ( len < sizeof(rib_ctl_lookup_t) ) {
+					break;
+				}
+#if XRIPD_DEBUG == 1
+				fprintf(stderr, "[rib-out]: Received RIB_CTRL_MSGTYPE_LOOKUP from xripd-daemon.\n");
+#endif
+				send_rib_ctl_lookup_reply(xripd_settings, sun_addresses, (rib_ctl_lookup_t *)buf);
+				break;
+			case RIB_CTL_HDR_MSGTYPE_RELOAD:
+				// As if the daemon had been sent SIGHUP. It reloads its own filter, and passes SIGHUP back on to us:
+				fprintf(stderr, "[rib-out]: Received RIB_CTRL_MSGTYPE_RELOAD, reloading filter.\n");
+				kill(getppid(), SIGHUP);
 				break;
 			default:
 				break;
@@ -1,12 +1,30 @@
 #include "rib.h"
+#include "rib-out.h"
 #include "route.h"
 #include "rib-ll.h"
 #include "rib-null.h"
+#include "fib-writer.h"
+#include "rib-damp.h"
+#include "rib-ingest.h"
+#include "rib-neigh.h"
 
 // Time to wait on reading the pipe from the daemon process, before proceeding with main loop:
 #define RIB_SELECT_TIMEOUT 1
-// Max amount of routes to read from the daemon process before proceeding with main loop:
-#define RIB_MAX_READ_IN 15
+// Max amount of routes to process from the daemon process (our ingest queues) before proceeding with main loop:
+#define RIB_MAX_READ_IN 128
+// Metric of a route adopted from the kernel on a warm start. Any real advertisement of the route will better it:
+#define RIB_PROVISIONAL_METRIC (RIP_METRIC_INFINITY - 1)
+// parse_local_route() return for a route we installed ourselves:
+#define RIB_KERNEL_ROUTE_OURS 2
+
+// Minimum time (seconds) between retries of routes the kernel failed to install/delete:
+#define RIB_FIB_RETRY_INTERVAL 5
+// Max amount of failed routes to retry per main loop iteration:
+#define RIB_FIB_RETRY_MAX 256
+
+// Set when the kernel has failed a route request, cleared once every failed route has been retried:
+static uint8_t fib_retry_pending = 0;
+static time_t fib_last_retry = 0;
 
 // Init our xripd_rib_t structure.
 // xripd_rib_t is an abstraction of function pointers which at init time
@@ -25,8 +43,9 @@ int init_rib(xripd_settings_t *xripd_settings, uint8_t rib_datastore) {
 	// Init our filter:
 	if (xripd_settings->filter_mode != XRIPD_FILTER_MODE_NULL ) {
 		if (strcmp(xripd_settings->filter_file, "") != 0) {
-			xripd_rib->filter = init_filter(xripd_settings->filter_mode);
-			if (import_filter_from_file(xripd_rib->filter, xripd_settings->filter_file) != 0) {
+			// Through our compiled image of it if we have been given one (-C):
+			xripd_rib->filter = load_filter(xripd_settings->filter_mode, xripd_settings->filter_file, xripd_settings->filter_cache);
+			if ( xripd_rib->filter == NULL ) {
 				fprintf(stderr, "[rib]: Unable to load filter file. Terminating.\n");
 				return 1;
 			} else {
@@ -38,6 +57,16 @@ int init_rib(xripd_settings_t *xripd_settings, uint8_t rib_datastore) {
 	}
 	//xripd_rib->filter = init_filter(XRIPD_FILTER_MODE_WHITELIST);
 
+	// Init our route policy (if any):
+	if ( strcmp(xripd_settings->policy_file, "") != 0 ) {
+		xripd_rib->policy = load_policy(xripd_settings->policy_file);
+		if ( xripd_rib->policy == NULL ) {
+			fprintf(stderr, "[rib]: Unable to load policy file. Terminating.\n");
+			return 1;
+		}
+		dump_policy(xripd_rib->policy);
+	}
+
 	// Assign our datastore function pointers
 	// (Implementation of our interface):
 	xripd_rib->rib_datastore = rib_datastore;
@@ -48,6 +77,9 @@ int init_rib(xripd_settings_t *xripd_settings, uint8_t rib_datastore) {
 		xripd_rib->remove_expired_entries = &rib_null_remove_expired_entries;
 		xripd_rib->invalidate_expired_local_routes = &rib_null_invalidate_expired_local_routes;
 		xripd_rib->serialise_rib = &rib_null_serialise_rib;
+		xripd_rib->walk_rib = &rib_null_walk_rib;
+		xripd_rib->lookup_rib = &rib_null_lookup_rib;
+		xripd_rib->update_fib_state = &rib_null_update_fib_state;
 		xripd_rib->destroy_rib = &rib_null_destroy_rib;
 
 		return 0;
@@ -58,6 +90,9 @@ int init_rib(xripd_settings_t *xripd_settings, uint8_t rib_datastore) {
 		xripd_rib->remove_expired_entries = &rib_ll_remove_expired_entries;
 		xripd_rib->invalidate_expired_local_routes = &rib_ll_invalidate_expired_local_routes;
 		xripd_rib->serialise_rib = &rib_ll_serialise_rib;
+		xripd_rib->walk_rib = &rib_ll_walk_rib;
+		xripd_rib->lookup_rib = &rib_ll_lookup_rib;
+		xripd_rib->update_fib_state = &rib_ll_update_fib_state;
 		xripd_rib->destroy_rib = &rib_ll_destroy_rib;
 
 		// We can call a function on initialisation:
@@ -71,10 +106,9 @@ int init_rib(xripd_settings_t *xripd_settings, uint8_t rib_datastore) {
 
 void destroy_rib(xripd_settings_t *xripd_settings) {
 
-	// Destroy filter struct:
-	if ( xripd_settings->xripd_rib->filter != NULL ) {
-		destroy_filter(xripd_settings->xripd_rib->filter);
-	}
+	// Drop our filter and policy:
+	filter_put(xripd_settings->xripd_rib->filter);
+	policy_put(xripd_settings->xripd_rib->policy);
 	
 	// Destroy our rib datastore:
 	(*xripd_settings->xripd_rib->destroy_rib)();
@@ -100,6 +134,310 @@ static void rib_route_print(const rib_entry_t *in_entry) {
 
 }
 
+// Let the rib-out thread know that routes have changed, and a triggered update is required.
+// Must be called with mutex_rib_lock held. Only the first change since the last triggered
+// update writes into the trigger pipe, subsequent changes are batched into the same update:
+static void rib_trigger_update(xripd_settings_t *xripd_settings) {
+
+	char trigger = 1;
+
+	// No rib-out thread to wake in passive mode:
+	if ( xripd_settings->passive_mode == XRIPD_PASSIVE_MODE_ENABLE ) {
+		return;
+	}
+
+	if ( xripd_settings->rib_shared.trigger_flag == 0 ) {
+		xripd_settings->rib_shared.trigger_flag = 1;
+		write(xripd_settings->rib_shared.p_trigger[1], &trigger, sizeof(trigger));
+#if XRIPD_DEBUG == 1
+		fprintf(stderr, "[rib]: Route change, signalling rib-out for a triggered update.\n");
+#endif
+	}
+}
+
+// Hand op (FIB_OP_*) for entry to the FIB writer thread, and mark the prefix as pending in our rib.
+// The writer records the real seq once it sends the request, until then any older ACK for the prefix is stale (seq 0):
+static void rib_fib_queue(xripd_settings_t *xripd_settings, uint8_t op, const rib_entry_t *entry) {
+	fib_writer_queue(op, entry);
+	(*xripd_settings->xripd_rib->update_fib_state)(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet, 
+			0, RIB_FIB_PENDING);
+}
+
+// Record the kernel's ACK (error == 0) or NACK for the route request with sequence number seq:
+void rib_fib_ack(xripd_settings_t *xripd_settings, uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint16_t nlmsg_type, int error) {
+
+	uint8_t fib_state = RIB_FIB_INSTALLED;
+
+	if ( nlmsg_type == RTM_DELROUTE ) {
+		// Deleting a route the kernel no longer holds is as good as success:
+		fib_state = ( error == 0 || error == -ESRCH ) ? RIB_FIB_NONE : RIB_FIB_FAILED;
+	} else if ( error != 0 ) {
+		fib_state = RIB_FIB_FAILED;
+	}
+
+	// A stale ACK (the prefix has since been reprogrammed), or a prefix that has left our rib:
+	if ( (*xripd_settings->xripd_rib->update_fib_state)(ipaddr, subnet, seq, fib_state) != 0 ) {
+		return;
+	}
+
+	if ( fib_state == RIB_FIB_FAILED ) {
+		char ipaddr_str[16];
+		char subnet_str[16];
+		inet_ntop(AF_INET, &ipaddr, ipaddr_str, sizeof(ipaddr_str));
+		inet_ntop(AF_INET, &subnet, subnet_str, sizeof(subnet_str));
+		fprintf(stderr, "[rib]: Kernel failed %s for %s %s: %s. Will retry.\n", 
+				(nlmsg_type == RTM_DELROUTE) ? "RTM_DELROUTE" : "RTM_NEWROUTE", ipaddr_str, subnet_str, strerror(-error));
+		fib_retry_pending = 1;
+	}
+}
+
+// State for settle_group_entry():
+typedef struct fib_group_ack_t {
+	uint32_t seq;
+	uint8_t fib_state;
+	int count;
+} fib_group_ack_t;
+
+// walk_rib callback. Settle a route waiting on the nexthop message of its group:
+static int settle_group_entry(rib_entry_t *entry, void *arg) {
+
+	fib_group_ack_t *group = (fib_group_ack_t *)arg;
+
+	if ( entry->fib_state == RIB_FIB_PENDING && entry->fib_seq == group->seq ) {
+		entry->fib_state = group->fib_state;
+		group->count++;
+	}
+	return 0;
+}
+
+// Record the kernel's answer to the RTM_DELNEXTHOP (or RTM_NEWNEXTHOP) standing for a group of routes, each stamped with its seq.
+// The routes can't outlive their nexthop, so one that was already gone (ENOENT) is a success:
+void rib_fib_group_ack(xripd_settings_t *xripd_settings, uint32_t seq, uint16_t nlmsg_type, int error) {
+
+	fib_group_ack_t group;
+
+	group.seq = seq;
+	group.count = 0;
+	if ( nlmsg_type == RTM_DELNEXTHOP ) {
+		group.fib_state = ( error == 0 || error == -ENOENT ) ? RIB_FIB_NONE : RIB_FIB_FAILED;
+	} else {
+		group.fib_state = ( error == 0 ) ? RIB_FIB_INSTALLED : RIB_FIB_FAILED;
+	}
+
+	(*xripd_settings->xripd_rib->walk_rib)(&settle_group_entry, &group);
+
+	if ( group.fib_state == RIB_FIB_FAILED && group.count > 0 ) {
+		fprintf(stderr, "[rib]: Kernel failed %s for %d route(s): %s. Will retry.\n", 
+				(nlmsg_type == RTM_DELNEXTHOP) ? "RTM_DELNEXTHOP" : "RTM_NEWNEXTHOP", group.count, strerror(-error));
+		fib_retry_pending = 1;
+	}
+}
+
+// walk_rib callback. Any route still waiting on an ACK will never get one, fail it so it is retried:
+static int fail_pending_entry(rib_entry_t *entry, void *arg) {
+
+	if ( entry->fib_state == RIB_FIB_PENDING ) {
+		entry->fib_state = RIB_FIB_FAILED;
+	}
+	return 0;
+}
+
+// ACKs from the kernel have been lost (socket overrun), every pending route is marked for a retry:
+void rib_fib_acks_lost(xripd_settings_t *xripd_settings) {
+
+	fprintf(stderr, "[rib]: Netlink ACKs lost, retrying all pending routes.\n");
+	(*xripd_settings->xripd_rib->walk_rib)(&fail_pending_entry, NULL);
+	fib_retry_pending = 1;
+}
+
+// State for retry_failed_entry():
+typedef struct fib_retry_t {
+	xripd_settings_t *xripd_settings;
+	int count;
+} fib_retry_t;
+
+// walk_rib callback. Requeue a failed route to the kernel, stop once we have a full batch of retries.
+// Installs are retried as a replace, so that a route left behind in the kernel does not fail us again:
+static int retry_failed_entry(rib_entry_t *entry, void *arg) {
+
+	fib_retry_t *retry = (fib_retry_t *)arg;
+
+	if ( entry->fib_state != RIB_FIB_FAILED || entry->origin != RIB_ORIGIN_REMOTE ) {
+		return 0;
+	}
+
+	if ( ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY ) {
+		fib_writer_queue(FIB_OP_DELETE, entry);
+	} else {
+		fib_writer_queue(FIB_OP_REPLACE | FIB_OP_FORCE, entry);
+	}
+	entry->fib_state = RIB_FIB_PENDING;
+	entry->fib_seq = 0;
+
+	retry->count++;
+	return ( retry->count >= RIB_FIB_RETRY_MAX );
+}
+
+// Requeue a batch of routes the kernel has failed, at most every RIB_FIB_RETRY_INTERVAL seconds.
+// Must be called with mutex_rib_lock held:
+static void retry_failed_fib_routes(xripd_settings_t *xripd_settings) {
+
+	time_t now = time(NULL);
+	fib_retry_t retry;
+
+	if ( fib_retry_pending == 0 || (now - fib_last_retry) < RIB_FIB_RETRY_INTERVAL ) {
+		return;
+	}
+
+	retry.xripd_settings = xripd_settings;
+	retry.count = 0;
+	(*xripd_settings->xripd_rib->walk_rib)(&retry_failed_entry, &retry);
+
+	// A full batch may have left failed routes behind, otherwise we have retried them all:
+	fib_retry_pending = ( retry.count >= RIB_FIB_RETRY_MAX );
+	fib_last_retry = now;
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[rib]: Retrying %d route(s) failed by the kernel.\n", retry.count);
+#endif
+}
+
+// As rib_trigger_update(), but the changes follow the loss of a link. The rib-out thread
+// tells the daemon to send them straight away, without the triggered update holdoff:
+static void rib_trigger_urgent_update(xripd_settings_t *xripd_settings) {
+	xripd_settings->rib_shared.trigger_urgent = 1;
+	rib_trigger_update(xripd_settings);
+}
+
+// State for invalidate_link_entry():
+typedef struct link_down_t {
+	xripd_settings_t *xripd_settings;
+	int ifindex;
+	int count;
+} link_down_t;
+
+// walk_rib callback. Invalidate a route reached through a downed interface.
+// Local routes through the interface, and every remote route if it is our own (our neighbours are gone):
+static int invalidate_link_entry(rib_entry_t *entry, void *arg) {
+
+	link_down_t *link = (link_down_t *)arg;
+
+	if ( ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY || entry->ifindex != link->ifindex ) {
+		return 0;
+	}
+
+	entry->rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+	entry->changed = 1;
+	link->count++;
+
+	// Pull remote routes out of the kernel:
+	if ( entry->origin == RIB_ORIGIN_REMOTE ) {
+		fib_writer_queue(FIB_OP_DELETE, entry);
+		entry->fib_state = RIB_FIB_PENDING;
+		entry->fib_seq = 0;
+	}
+	return 0;
+}
+
+// Interface ifindex has lost its carrier (or our address). Invalidate every route reached through it,
+// and send an urgent triggered update:
+void rib_link_down(xripd_settings_t *xripd_settings, int ifindex) {
+
+	link_down_t link;
+	link.xripd_settings = xripd_settings;
+	link.ifindex = ifindex;
+	link.count = 0;
+
+	(*xripd_settings->xripd_rib->walk_rib)(&invalidate_link_entry, &link);
+
+	if ( link.count > 0 ) {
+		fprintf(stderr, "[rib]: Interface index %d is down, invalidated %d route(s).\n", ifindex, link.count);
+		rib_trigger_urgent_update(xripd_settings);
+	}
+}
+
+// walk_rib callback. A remote route that has timed out (invalidated by the datastore) is still in the kernel,
+// hand its deletion to the FIB writer:
+static int delete_expired_entry(rib_entry_t *entry, void *arg) {
+
+	if ( entry->origin == RIB_ORIGIN_REMOTE && entry->fib_state == RIB_FIB_INSTALLED &&
+		ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY ) {
+		fib_writer_queue(FIB_OP_DELETE, entry);
+		entry->fib_state = RIB_FIB_PENDING;
+		entry->fib_seq = 0;
+	}
+	return 0;
+}
+
+// The kernel has deleted one of our routes, without us asking (ie. ip route del by hand).
+// If the rib still holds it as installed, put it back. Our own deletes find the route invalidated, and are ignored:
+static void rib_fib_route_lost(xripd_settings_t *xripd_settings, const rib_entry_t *lost) {
+
+	rib_entry_t entry;
+
+	if ( (*xripd_settings->xripd_rib->lookup_rib)(lost->rip_msg_entry.ipaddr, lost->rip_msg_entry.subnet, &entry) != 0 ) {
+		return;
+	}
+	if ( entry.origin != RIB_ORIGIN_REMOTE || entry.fib_state != RIB_FIB_INSTALLED ||
+		ntohl(entry.rip_msg_entry.metric) >= RIP_METRIC_INFINITY ) {
+		return;
+	}
+
+	char ipaddr[16];
+	inet_ntop(AF_INET, &(entry.rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
+	fprintf(stderr, "[rib]: Our route for %s/%d was removed from the kernel, reinstalling.\n", ipaddr, 
+			netmask_to_cidr(ntohl(entry.rip_msg_entry.subnet)));
+
+	// Our shadow FIB still holds it, so force the install through:
+	rib_fib_queue(xripd_settings, FIB_OP_REPLACE | FIB_OP_FORCE, &entry);
+}
+
+// A suppressed (flapping) prefix has been re-advertised. Poison it straight back in the datastore,
+// so it is neither installed nor advertised. The next advertisement after its penalty has decayed brings it back.
+// Returns 1 if the datastore did not take our poison, and the route is left in the rib as advertised:
+static int rib_damp_hold(xripd_settings_t *xripd_settings, const rib_entry_t *entry) {
+
+	rib_entry_t held;
+	rib_entry_t ins_route;
+	rib_entry_t del_route;
+	int add_rib_ret = 0;
+	int route_incremental = 0;
+
+	memcpy(&held, entry, sizeof(rib_entry_t));
+	held.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+	(*xripd_settings->xripd_rib->add_to_rib)(&add_rib_ret, &held, &ins_route, &del_route, &route_incremental);
+	xripd_settings->xripd_rib->size += route_incremental;
+
+	// The route was never queued to the kernel, so there is nothing to delete from it:
+	if ( add_rib_ret != RIB_RET_INVALIDATE ) {
+		char ipaddr[16];
+		inet_ntop(AF_INET, &(entry->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
+		fprintf(stderr, "[rib]: Unable to hold down suppressed route for %s/%d (add_to_rib result: %d), installing it.\n", ipaddr,
+				netmask_to_cidr(ntohl(entry->rip_msg_entry.subnet)), add_rib_ret);
+		return 1;
+	}
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[rib]: Route suppressed (flapping), held down.\n");
+#endif
+	return 0;
+}
+
+// Cache our filter's and outbound policy's verdict on whether (and how) entry may be advertised in the entry itself,
+// so rib-out tests a flag rather than running each route through them on every update. Returns 1 if our filter denies the route:
+static int rib_entry_set_verdict(filter_t *filter, const policy_t *policy, rib_entry_t *entry) {
+
+	int filter_denied = ( filter != NULL && filter_route(filter, entry->rip_msg_entry.ipaddr, 
+				entry->rip_msg_entry.subnet) != XRIPD_FILTER_RESULT_ALLOW );
+
+	entry->out_denied = filter_denied;
+	memset(&(entry->out_policy), 0, sizeof(policy_result_t));
+	if ( !filter_denied && policy != NULL && policy_evaluate(policy, POLICY_DIR_OUT, 0, entry->rip_msg_entry.ipaddr, 
+			entry->rip_msg_entry.subnet, ntohl(entry->rip_msg_entry.metric), ntohs(entry->rip_msg_entry.tag), 
+			&(entry->out_policy)) != POLICY_ACTION_PERMIT ) {
+		entry->out_denied = 1;
+	}
+	return filter_denied;
+}
+
 // Handler function:
 // Recieves rib_entry_t as in_entry, and returns a add_rib_ret ret value depending on next action required re: kernel table:
 //	Pass in_entry to RIB
@@ -110,8 +448,16 @@ static void rib_route_print(const rib_entry_t *in_entry) {
 static void add_entry_to_rib(xripd_settings_t *xripd_settings, int *add_rib_ret, const rib_entry_t *in_entry, rib_entry_t *ins_route, rib_entry_t *del_route) {
 
 	int route_incremental = 0;
+	rib_entry_t entry;
+
+	// Our copy of in_entry, carrying its verdict into the rib.
+	// Remote routes have already been let in by the very same filter, only local routes need a filter lookup:
+	memcpy(&entry, in_entry, sizeof(rib_entry_t));
+	rib_entry_set_verdict(( entry.origin == RIB_ORIGIN_LOCAL ) ? xripd_settings->xripd_rib->filter : NULL, 
+			xripd_settings->xripd_rib->policy, &entry);
+
 	// Pass argument pointers straight through to the add_to_rib function:
-	(*xripd_settings->xripd_rib->add_to_rib)(add_rib_ret, in_entry, ins_route, del_route, &route_incremental);
+	(*xripd_settings->xripd_rib->add_to_rib)(add_rib_ret, &entry, ins_route, del_route, &route_incremental);
 
 	// Switch on the RIB's return behaviour
 	switch (*add_rib_ret) {
@@ -128,8 +474,15 @@ static void add_entry_to_rib(xripd_settings_t *xripd_settings, int *add_rib_ret,
 #endif
 			// If the route was learnt via network/RIP, install into routing table:
 			xripd_settings->xripd_rib->size += route_incremental;
+			// Unless it is flapping, in which case it is held down until it has settled (if the datastore lets us):
+			if ( ins_route->origin == RIB_ORIGIN_REMOTE && 
+				rib_damp_suppressed(ins_route->rip_msg_entry.ipaddr, ins_route->rip_msg_entry.subnet, time(NULL)) &&
+				rib_damp_hold(xripd_settings, ins_route) == 0 ) {
+				break;
+			}
+			rib_trigger_update(xripd_settings);
 			if ( ins_route->origin == RIB_ORIGIN_REMOTE ) {
-				netlink_install_new_route(xripd_settings, ins_route);
+				rib_fib_queue(xripd_settings, FIB_OP_INSTALL, ins_route);
 			} else {
 #if XRIPD_DEBUG == 1
 				fprintf(stderr, "[rib]: Route origin not remote. No need to Netlink install.\n");
@@ -141,9 +494,10 @@ static void add_entry_to_rib(xripd_settings_t *xripd_settings, int *add_rib_ret,
 #if XRIPD_DEBUG == 1
 			fprintf(stderr, "[rib]: add_to_rib result: REPLACE. Replacing route with another.\n");
 #endif
+			rib_trigger_update(xripd_settings);
 			// If the route was learnt remotely, let's blow it out of our kernel's table:
 			if ( ins_route->origin == RIB_ORIGIN_REMOTE ) {
-				netlink_replace_new_route(xripd_settings, ins_route);
+				rib_fib_queue(xripd_settings, FIB_OP_REPLACE, ins_route);
 			} else {
 #if XRIPD_DEBUG == 1
 				fprintf(stderr, "[rib]: Route origin not remote. No need to Netlink replace.\n");
@@ -155,9 +509,11 @@ static void add_entry_to_rib(xripd_settings_t *xripd_settings, int *add_rib_ret,
 #if XRIPD_DEBUG == 1
 			fprintf(stderr, "[rib]: add_to_rib result: INVALIDATE. Deleting route.\n");
 #endif
+			rib_trigger_update(xripd_settings);
 			// If the route was learnt remotely, let's blow it out of our kernel's table:
 			if ( del_route->origin == RIB_ORIGIN_REMOTE ) {
-				netlink_delete_new_route(xripd_settings, del_route);
+				rib_fib_queue(xripd_settings, FIB_OP_DELETE, del_route);
+				rib_damp_withdraw(del_route->rip_msg_entry.ipaddr, del_route->rip_msg_entry.subnet, time(NULL));
 			} else {
 #if XRIPD_DEBUG == 1
 				fprintf(stderr, "[rib]: Route origin not remote. No need to Netlink delete.\n");
@@ -174,9 +530,10 @@ static void add_entry_to_rib(xripd_settings_t *xripd_settings, int *add_rib_ret,
 
 }
 
-// Function called on each successive iteration of route returned from kernel via netlink.
-// Parses the netlink message, converts to a rib_entry_t struct, and passes control to the add_entry_to_rib function (above)
-int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr) {
+// Parse a kernel route (RTM_NEWROUTE/RTM_DELROUTE) pointed to by nlhdr into in_entry, as a local route.
+// Returns 1 if the route is not one we track (not the main table, or unusable),
+// or RIB_KERNEL_ROUTE_OURS if it is one we have installed ourselves (RTPROT_XRIPD):
+static int parse_local_route(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr, rib_entry_t *in_entry) {
 
 	// Pointer to our rtmsg. Each rtmsg may contain multiple attributes:
 	struct rtmsg *route_entry;
@@ -184,17 +541,9 @@ int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsgh
 
 	// Attribute length
 	int len = 0;
+	uint32_t nh_id = 0;
 
-	rib_entry_t in_entry;
-	memset(&in_entry, 0, sizeof(rib_entry_t));
-
-	// For our add_entry_to_rib call:
-	int add_rib_ret = 0;
-	rib_entry_t ins_route;
-	rib_entry_t del_route;
-
-	memset(&ins_route, 0, sizeof(ins_route));
-	memset(&del_route, 0, sizeof(del_route));
+	memset(in_entry, 0, sizeof(rib_entry_t));
 
 	// NLMSG_DATA()
 	// Return a pointer to the payload associated with the passed
@@ -206,8 +555,9 @@ int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsgh
 		return 1;
 	}
 
-	// Ignore routes that we've installed ourselves (stop circular route installation)
-	if (route_entry->rtm_protocol == RTPROT_XRIPD ) {
+	// The kernel keeps routes over an interface that has lost its carrier, flagged as linkdown.
+	// They are unusable, so treat them as absent:
+	if (route_entry->rtm_flags & (RTNH_F_LINKDOWN | RTNH_F_DEAD)) {
 		return 1;
 	}
 
@@ -228,10 +578,18 @@ int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsgh
 
 		switch (route_attribute->rta_type) {
 			case RTA_DST:
-				memcpy(&(in_entry.rip_msg_entry.ipaddr), RTA_DATA(route_attribute), sizeof(in_entry.rip_msg_entry.ipaddr));
+				memcpy(&(in_entry->rip_msg_entry.ipaddr), RTA_DATA(route_attribute), sizeof(in_entry->rip_msg_entry.ipaddr));
 				break;
 			case RTA_GATEWAY:
-				memcpy(&(in_entry.rip_msg_entry.nexthop), RTA_DATA(route_attribute), sizeof(in_entry.rip_msg_entry.nexthop));
+				memcpy(&(in_entry->rip_msg_entry.nexthop), RTA_DATA(route_attribute), sizeof(in_entry->rip_msg_entry.nexthop));
+				break;
+			case RTA_OIF:
+				memcpy(&(in_entry->ifindex), RTA_DATA(route_attribute), sizeof(in_entry->ifindex));
+				break;
+			// Installed through one of our nexthop objects by a previous run:
+			case RTA_NH_ID:
+				memcpy(&nh_id, RTA_DATA(route_attribute), sizeof(nh_id));
+				netlink_nexthop_lookup(nh_id, &(in_entry->rip_msg_entry.nexthop), &(in_entry->ifindex));
 				break;
 		}
 
@@ -239,20 +597,124 @@ int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsgh
 		route_attribute = RTA_NEXT(route_attribute, len);
 	}
 
-	in_entry.rip_msg_entry.afi = htons(AF_INET);
-	in_entry.rip_msg_entry.metric = htonl(0);
-	in_entry.recv_from.sin_addr.s_addr = htonl(0); 
-	in_entry.rip_msg_entry.tag = 0;
-	in_entry.recv_time = (*xripd_settings->xripd_rib).last_local_poll;
-	in_entry.origin = RIB_ORIGIN_LOCAL;
+	in_entry->rip_msg_entry.afi = htons(AF_INET);
+	in_entry->rip_msg_entry.metric = htonl(0);
+	in_entry->recv_from.sin_addr.s_addr = htonl(0); 
+	in_entry->rip_msg_entry.tag = 0;
+	in_entry->recv_time = (*xripd_settings->xripd_rib).last_local_poll;
+	in_entry->origin = RIB_ORIGIN_LOCAL;
 
 	// Process netmask (Convert from dstlen cidr to an actual netmask:
-	in_entry.rip_msg_entry.subnet = cidr_to_netmask_netorder(route_entry->rtm_dst_len);
+	in_entry->rip_msg_entry.subnet = cidr_to_netmask_netorder(route_entry->rtm_dst_len);
+
+	// Flag routes that we've installed ourselves (stop circular route installation)
+	if (route_entry->rtm_protocol == RTPROT_XRIPD ) {
+		return RIB_KERNEL_ROUTE_OURS;
+	}
+
+	return 0;
+}
+
+// Adopt a route we installed in a previous run (found in the kernel on startup) as a provisional remote route.
+// It is already in the kernel, so it goes straight into the datastore, bypassing the FIB writer.
+// With a metric of RIB_PROVISIONAL_METRIC any real advertisement replaces it, and if no neighbour advertises it
+// within the invalid interval it is expired (and deleted from the kernel) as any other remote route:
+static void add_provisional_route_to_rib(xripd_settings_t *xripd_settings, rib_entry_t *in_entry) {
+
+	int add_rib_ret = 0;
+	int route_incremental = 0;
+	rib_entry_t ins_route;
+	rib_entry_t del_route;
+
+	memset(&ins_route, 0, sizeof(ins_route));
+	memset(&del_route, 0, sizeof(del_route));
+
+	// The gateway stands in for the neighbour that advertised it:
+	in_entry->recv_from.sin_family = AF_INET;
+	in_entry->recv_from.sin_addr.s_addr = in_entry->rip_msg_entry.nexthop;
+	in_entry->rip_msg_entry.metric = htonl(RIB_PROVISIONAL_METRIC);
+	in_entry->recv_time = time(NULL);
+	in_entry->origin = RIB_ORIGIN_REMOTE;
+	in_entry->fib_state = RIB_FIB_INSTALLED;
+	rib_entry_set_verdict(NULL, xripd_settings->xripd_rib->policy, in_entry);
+
+	(*xripd_settings->xripd_rib->add_to_rib)(&add_rib_ret, in_entry, &ins_route, &del_route, &route_incremental);
+	xripd_settings->xripd_rib->size += route_incremental;
+
+	if ( add_rib_ret == RIB_RET_INSTALL_NEW ) {
+		char ipaddr[16];
+		char gw[16];
+		inet_ntop(AF_INET, &(in_entry->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
+		inet_ntop(AF_INET, &(in_entry->rip_msg_entry.nexthop), gw, sizeof(gw));
+		fprintf(stderr, "[rib]: Warm start, adopted %s/%d via %s from the kernel.\n", ipaddr, 
+				netmask_to_cidr(ntohl(in_entry->rip_msg_entry.subnet)), gw);
+	}
+}
+
+// Function called on each successive iteration of route returned from kernel via netlink
+// (from our full dump, or an RTM_NEWROUTE event).
+// Parses the netlink message, converts to a rib_entry_t struct, and passes control to the add_entry_to_rib function (above)
+int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr) {
+
+	rib_entry_t in_entry;
+
+	// For our add_entry_to_rib call:
+	int add_rib_ret = 0;
+	rib_entry_t ins_route;
+	rib_entry_t del_route;
+
+	memset(&ins_route, 0, sizeof(ins_route));
+	memset(&del_route, 0, sizeof(del_route));
+
+	switch ( parse_local_route(xripd_settings, nlhdr, &in_entry) ) {
+		case 0:
+			break;
+		// One of ours, left from a previous run:
+		case RIB_KERNEL_ROUTE_OURS:
+			if ( xripd_settings->xripd_rib->warm_start && in_entry.rip_msg_entry.nexthop != 0 ) {
+				add_provisional_route_to_rib(xripd_settings, &in_entry);
+			}
+			return 1;
+		default:
+			return 1;
+	}
 
 	add_entry_to_rib(xripd_settings, &add_rib_ret, &in_entry, &ins_route, &del_route);
 	return 0;
 }
 
+// Called on an RTM_DELROUTE event from the kernel. The local route has gone,
+// pass it through add_entry_to_rib as an invalidation (metric = RIP_METRIC_INFINITY):
+int del_local_route_from_rib(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr) {
+
+	rib_entry_t in_entry;
+
+	// For our add_entry_to_rib call:
+	int add_rib_ret = 0;
+	rib_entry_t ins_route;
+	rib_entry_t del_route;
+
+	memset(&ins_route, 0, sizeof(ins_route));
+	memset(&del_route, 0, sizeof(del_route));
+
+	switch ( parse_local_route(xripd_settings, nlhdr, &in_entry) ) {
+		case 0:
+			break;
+		// One of ours has gone from the kernel:
+		case RIB_KERNEL_ROUTE_OURS:
+			rib_fib_route_lost(xripd_settings, &in_entry);
+			return 1;
+		default:
+			return 1;
+	}
+
+	in_entry.rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+	add_entry_to_rib(xripd_settings, &add_rib_ret, &in_entry, &ins_route, &del_route);
+	return 0;
+}
+
+// Full resync of our local routes. Only required at startup, or if we have lost route events (ENOBUFS),
+// from then on we track the kernel through RTM_NEWROUTE/RTM_DELROUTE events.
 // Scan through our local routes, and find anything in our RIB that no longer matches 
 // local routes. If that's the case, invalidate our routes in the RIB as required
 static void refresh_local_routes_into_rib(xripd_settings_t *xripd_settings) {
@@ -272,11 +734,142 @@ static void refresh_local_routes_into_rib(xripd_settings_t *xripd_settings) {
 	// At this point, all kernel routes are in the RIB, however
 	// the RIB may contain outdated local routes that are no longer in the local
 	// kernel table anymore (local interfaces have been disabled or have failed)
-	(*xripd_settings->xripd_rib->invalidate_expired_local_routes)((*xripd_settings->xripd_rib).last_local_poll);
+	if ( (*xripd_settings->xripd_rib->invalidate_expired_local_routes)((*xripd_settings->xripd_rib).last_local_poll) != 0 ) {
+		rib_trigger_update(xripd_settings);
+	}
 	
 	return;
 }
 
+// State for refilter_entry():
+typedef struct filter_reload_t {
+	filter_t *new_filter;
+	policy_t *new_policy;
+	int withdrawn;
+	int allowed;
+	int updated;
+} filter_reload_t;
+
+// walk_rib callback. Run a route past the reloaded filter and policy, and act on those whose verdict has changed from that cached in the entry.
+// A newly denied route is advertised once as unreachable (and a remote one denied by our filter pulled out of the rib and the kernel,
+// as it would never have been let in). A newly allowed route, or one whose outbound sets have changed, is advertised in our triggered update:
+static int refilter_entry(rib_entry_t *entry, void *arg) {
+
+	filter_reload_t *reload = (filter_reload_t *)arg;
+	uint8_t was_denied = entry->out_denied;
+	policy_result_t was_policy = entry->out_policy;
+	int filter_denied = rib_entry_set_verdict(reload->new_filter, reload->new_policy, entry);
+
+	if ( ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY ) {
+		return 0;
+	}
+
+	if ( was_denied == entry->out_denied ) {
+		if ( !entry->out_denied && (was_policy.set != entry->out_policy.set || 
+			was_policy.metric_offset != entry->out_policy.metric_offset || was_policy.tag != entry->out_policy.tag) ) {
+			entry->changed = 1;
+			reload->updated++;
+		}
+		return 0;
+	}
+
+	entry->changed = 1;
+	if ( !entry->out_denied ) {
+		entry->filter_withdraw = 0;
+		reload->allowed++;
+		return 0;
+	}
+
+	entry->filter_withdraw = 1;
+	reload->withdrawn++;
+	if ( entry->origin == RIB_ORIGIN_REMOTE && filter_denied ) {
+		entry->rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+		fib_writer_queue(FIB_OP_DELETE, entry);
+		entry->fib_state = RIB_FIB_PENDING;
+		entry->fib_seq = 0;
+	}
+	return 0;
+}
+
+// Reload our filter and policy files, without a restart.
+// The new filter/policy are built without holding the rib, then swapped in (under mutex_rib_lock) for the old in a single pointer store each,
+// so a lookup sees one or the other, never a half loaded one. Only routes whose verdict has changed are touched.
+// Routes newly allowed in from our neighbours are not yet in the rib (they were dropped on arrival), and are learnt
+// from their next regular update:
+static void rib_filter_reload(xripd_settings_t *xripd_settings) {
+
+	filter_t *old_filter = NULL;
+	policy_t *old_policy = NULL;
+	filter_reload_t reload;
+	memset(&reload, 0, sizeof(reload));
+
+	if ( xripd_settings->xripd_rib->filter == NULL && xripd_settings->xripd_rib->policy == NULL ) {
+		fprintf(stderr, "[rib]: No filter or policy configured, nothing to reload.\n");
+		return;
+	}
+
+	// Both or neither:
+	if ( xripd_settings->xripd_rib->filter != NULL ) {
+		fprintf(stderr, "[rib]: Reloading filter from %s.\n", xripd_settings->filter_file);
+		reload.new_filter = load_filter(xripd_settings->filter_mode, xripd_settings->filter_file, xripd_settings->filter_cache);
+		if ( reload.new_filter == NULL ) {
+			fprintf(stderr, "[rib]: Unable to reload filter file, keeping our current filter and policy.\n");
+			return;
+		}
+#if XRIPD_DEBUG == 1
+		dump_filter_list(reload.new_filter);
+#endif
+	}
+	if ( xripd_settings->xripd_rib->policy != NULL ) {
+		fprintf(stderr, "[rib]: Reloading policy from %s.\n", xripd_settings->policy_file);
+		reload.new_policy = load_policy(xripd_settings->policy_file);
+		if ( reload.new_policy == NULL ) {
+			fprintf(stderr, "[rib]: Unable to reload policy file, keeping our current filter and policy.\n");
+			filter_put(reload.new_filter);
+			return;
+		}
+#if XRIPD_DEBUG == 1
+		dump_policy(reload.new_policy);
+#endif
+	}
+
+	pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+	if ( reload.new_filter != NULL ) {
+		old_filter = __atomic_exchange_n(&(xripd_settings->xripd_rib->filter), reload.new_filter, __ATOMIC_ACQ_REL);
+	}
+	if ( reload.new_policy != NULL ) {
+		old_policy = __atomic_exchange_n(&(xripd_settings->xripd_rib->policy), reload.new_policy, __ATOMIC_ACQ_REL);
+	}
+	(*xripd_settings->xripd_rib->walk_rib)(&refilter_entry, &reload);
+	if ( reload.withdrawn + reload.allowed + reload.updated > 0 ) {
+		rib_trigger_update(xripd_settings);
+	}
+	pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+
+	fprintf(stderr, "[rib]: Reloaded, %d route(s) newly denied, %d route(s) newly allowed, %d route(s) with new outbound sets.\n",
+			reload.withdrawn, reload.allowed, reload.updated);
+
+	filter_put(old_filter);
+	policy_put(old_policy);
+}
+
+// Entry point for our filter/policy reload thread. SIGHUP is held (blocked) in every thread of the process,
+// and collected here, so a reload never interrupts a system call elsewhere:
+static void *rib_reload_spawn(void *arg) {
+
+	xripd_settings_t *xripd_settings = (xripd_settings_t *)arg;
+	sigset_t sighup;
+	int sig = 0;
+
+	sigemptyset(&sighup);
+	sigaddset(&sighup, SIGHUP);
+
+	while ( sigwait(&sighup, &sig) == 0 ) {
+		rib_filter_reload(xripd_settings);
+	}
+	return NULL;
+}
+
 /*
 static void rib_test_filter_init(xripd_rib_t *xripd_rib) {
 
@@ -295,14 +888,142 @@ static void rib_test_filter_init(xripd_rib_t *xripd_rib) {
 }
 */
 
+// rib_neigh_walk callback. Invalidate a reachable route learnt from neighbour (arg, or from any if NULL), as a link down:
+static int invalidate_neigh_entry(rib_entry_t *entry, void *arg) {
+
+	if ( entry->origin != RIB_ORIGIN_REMOTE || ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY ||
+		(arg != NULL && entry->recv_from.sin_addr.s_addr != *(uint32_t *)arg) ) {
+		return 0;
+	}
+
+	entry->rip_msg_entry.metric = htonl(RIP_METRIC_INFINITY);
+	entry->changed = 1;
+	fib_writer_queue(FIB_OP_DELETE, entry);
+	entry->fib_state = RIB_FIB_PENDING;
+	entry->fib_seq = 0;
+	return 0;
+}
+
+// Log a neighbour's route count against our limit:
+static void rib_max_prefix_log(const rib_neigh_t *neigh, uint32_t max, const char *event) {
+
+	char addr[16];
+	inet_ntop(AF_INET, &(neigh->addr), addr, sizeof(addr));
+	fprintf(stderr, "[rib]: Neighbour %s has reached its limit of %u route(s) (holding %u), %s.\n", addr, max, neigh->routes, event);
+}
+
+// Hold the routes we take from each neighbour to our maximum prefix limit (if any).
+// Returns 1 if entry may be added to the rib. Updates to routes a neighbour already gives us are always let through:
+static int rib_max_prefix_admit(xripd_settings_t *xripd_settings, rib_neigh_t *neigh, const rib_entry_t *entry) {
+
+	uint32_t max = xripd_settings->max_prefix;
+	uint32_t addr = entry->recv_from.sin_addr.s_addr;
+	rib_entry_t found;
+	time_t now;
+
+	// Our shared record (0.0.0.0) holds the routes of many neighbours, none of which it would be fair to refuse or purge:
+	if ( max == 0 || neigh->addr == 0 || ntohl(entry->rip_msg_entry.metric) >= RIP_METRIC_INFINITY ) {
+		return 1;
+	}
+
+	now = time(NULL);
+	if ( neigh->held_until > now ) {
+		neigh->routes_refused++;
+		return 0;
+	}
+	if ( neigh->routes < max ) {
+		neigh->limit_logged = 0;
+		return 1;
+	}
+	if ( (*xripd_settings->xripd_rib->lookup_rib)(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet, &found) == 0 &&
+		found.origin == RIB_ORIGIN_REMOTE && found.recv_from.sin_addr.s_addr == addr &&
+		ntohl(found.rip_msg_entry.metric) < RIP_METRIC_INFINITY ) {
+		return 1;
+	}
+
+	switch ( xripd_settings->max_prefix_action ) {
+
+		case XRIPD_MAX_PREFIX_WARN:
+			if ( !neigh->limit_logged ) {
+				rib_max_prefix_log(neigh, max, "still accepting its routes");
+				neigh->limit_logged = 1;
+			}
+			return 1;
+
+		case XRIPD_MAX_PREFIX_STOP:
+			if ( !neigh->limit_logged ) {
+				rib_max_prefix_log(neigh, max, "refusing any more of its routes");
+				neigh->limit_logged = 1;
+			}
+			neigh->routes_refused++;
+			return 0;
+
+		default:
+			rib_max_prefix_log(neigh, max, "purging its routes");
+			rib_neigh_walk(neigh, &invalidate_neigh_entry, &addr);
+			rib_trigger_update(xripd_settings);
+			neigh->held_until = now + xripd_settings->rip_timers.route_flush;
+			neigh->routes_refused++;
+			return 0;
+	}
+}
+
+// rib_neigh_expire callback. We've not heard from a neighbour within the route timeout, invalidate everything we
+// hold from it in one go (rather than finding its routes one by one in a walk of the rib):
+static void rib_neigh_timed_out(rib_neigh_t *neigh, void *arg) {
+
+	xripd_settings_t *xripd_settings = (xripd_settings_t *)arg;
+	char addr[16];
+	uint32_t routes = neigh->routes;
+
+	// Our shared record holds routes of many neighbours, only those that have themselves timed out are invalidated
+	// (by remove_expired_entries):
+	if ( neigh->addr == 0 ) {
+		return;
+	}
+
+	rib_neigh_walk(neigh, &invalidate_neigh_entry, NULL);
+	neigh->routes_timed_out += routes;
+	rib_trigger_update(xripd_settings);
+
+	inet_ntop(AF_INET, &(neigh->addr), addr, sizeof(addr));
+	fprintf(stderr, "[rib]: Neighbour %s has timed out, invalidated %u route(s).\n", addr, routes);
+}
+
+// rib_ingest_service() callback, for a route passed to us by the daemon (called under mutex_rib_lock):
+static void rib_ingest_entry(rib_entry_t *in_entry, void *arg) {
+
+	xripd_settings_t *xripd_settings = (xripd_settings_t *)arg;
+	int add_rib_ret = RIB_RET_NO_ACTION;
+	rib_entry_t ins_route; // route to add to our kernel table (if any?)
+	rib_entry_t del_route; // route to delete from our kernel table (if any?)
+	rib_neigh_t *neigh = rib_neigh_lookup(in_entry->recv_from.sin_addr.s_addr);
+
+	memset(&ins_route, 0, sizeof(ins_route));
+	memset(&del_route, 0, sizeof(del_route));
+#if XRIPD_DEBUG == 1
+	rib_route_print(in_entry);
+#endif
+	neigh->last_heard = in_entry->recv_time;
+	neigh->routes_received++;
+
+	// If filter exists, pass route through filter, and if success, proceed with adding to rib/kernel.
+	// The daemon has already dropped routes denied by its copy of the filter, this catches routes passed to us
+	// across a reload (under the lock, so a filter reload sees every route let in by the filter it replaces):
+	if ( xripd_settings->filter_mode != XRIPD_FILTER_MODE_NULL && filter_route(xripd_settings->xripd_rib->filter, 
+			in_entry->rip_msg_entry.ipaddr, in_entry->rip_msg_entry.subnet) != XRIPD_FILTER_RESULT_ALLOW ) {
+		return;
+	}
+	if ( !rib_max_prefix_admit(xripd_settings, neigh, in_entry) ) {
+		return;
+	}
+	add_entry_to_rib(xripd_settings, &add_rib_ret, in_entry, &ins_route, &del_route);
+}
+
 // Post-fork() entry, our process enters into this function
 // This is our main execution loop
 void rib_main_loop(xripd_settings_t *xripd_settings) {
 
-	// Our RIB struct that the daemon passes to us:
-	rib_entry_t in_entry;
-	memset(&in_entry, 0, sizeof(in_entry));
-
 	// select() variables:
 	fd_set readfds; // Set of file descriptors (in our case, only one) for select() to watch for
 	struct timeval timeout; // Time to wait for data in our select()ed socket
@@ -313,15 +1034,23 @@ void rib_main_loop(xripd_settings_t *xripd_settings) {
 	int entry_count = 0;
 	int dump_count = 1;
 
-	// Variables to handle the add_to_rib function:
-	int add_rib_ret = 0; // result of our add_to_rib function:
-	rib_entry_t ins_route; // route to add to our kernel table (if any?)
-	rib_entry_t del_route; // route to delete from our kernel table (if any?)
-
 	int delcount = 0;
 
+	// Set when our view of the kernel's routes needs a full resync:
+	int local_resync = 0;
+	int maxfd = 0;
+
 	// Spawn our rib_out thread:
 	if ( xripd_settings->passive_mode != XRIPD_PASSIVE_MODE_ENABLE ) {
+
+		// Pipe used to wake rib-out for triggered updates, never block the rib on it:
+		if ( pipe(xripd_settings->rib_shared.p_trigger) == -1 ) {
+			fprintf(stderr, "[rib]: Unable to create trigger pipe.\n");
+			return;
+		}
+		fcntl(xripd_settings->rib_shared.p_trigger[0], F_SETFL, O_NONBLOCK);
+		fcntl(xripd_settings->rib_shared.p_trigger[1], F_SETFL, O_NONBLOCK);
+
 		pthread_t ribout_thread;
 		pthread_create(&ribout_thread, NULL, &rib_out_spawn, (void *)xripd_settings);
 	} else {
@@ -330,6 +1059,16 @@ void rib_main_loop(xripd_settings_t *xripd_settings) {
 #endif
 	}
 
+	// Spawn our FIB writer thread, all kernel route programming goes through it:
+	if ( fib_writer_init(xripd_settings) != 0 ) {
+		fprintf(stderr, "[rib]: Unable to start FIB writer.\n");
+		return;
+	}
+
+	// Spawn our filter/policy reload thread (SIGHUP, or a RIB_CTL_HDR_MSGTYPE_RELOAD):
+	pthread_t reload_thread;
+	pthread_create(&reload_thread, NULL, &rib_reload_spawn, (void *)xripd_settings);
+
 	//rib_test_filter_init(xripd_settings->xripd_rib);
 
 	// To start with, add local routes to our RIB:
@@ -337,16 +1076,19 @@ void rib_main_loop(xripd_settings_t *xripd_settings) {
 	fprintf(stderr, "[rib]: Locking RIB, Adding Local Kernel Routes to RIB\n");
 #endif
 
+	// Our route event socket is already subscribed, so nothing is missed between this dump and our first event.
+	// Adopt any routes left in the kernel by a previous run, rather than tearing them down:
 	pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
-	(*xripd_settings->xripd_rib).last_local_poll = time(NULL);
-	if ( netlink_add_local_routes_to_rib(xripd_settings) == 0 ) {
-#if XRIPD_DEBUG == 1
-		fprintf(stderr, "[rib]: Added routes from Kernel to RIB.\n");
-		(*xripd_settings->xripd_rib->dump_rib)();
-#endif
-	}
+	xripd_settings->xripd_rib->warm_start = 1;
+	refresh_local_routes_into_rib(xripd_settings);
+	xripd_settings->xripd_rib->warm_start = 0;
 	pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
 
+	maxfd = ( xripd_settings->p_rib_in[0] > xripd_settings->nlmon_sd ) ? xripd_settings->p_rib_in[0] : xripd_settings->nlmon_sd;
+
+	// Our pipe is drained into our ingest queues as far as it will go, never block on it:
+	fcntl(xripd_settings->p_rib_in[0], F_SETFL, O_NONBLOCK);
+
 #if XRIPD_DEBUG == 1
 	fprintf(stderr, "[rib]: Unlocking RIB, Main Loop Started\n");
 #endif
@@ -354,76 +1096,80 @@ void rib_main_loop(xripd_settings_t *xripd_settings) {
 	// Start recieving routes from xripd-daemon picked up over the network:
 	while (1) {
 
-		// Zeroise our return values for route table manipulations:
-		add_rib_ret = RIB_RET_NO_ACTION;
-		memset(&ins_route, 0, sizeof(ins_route));
-		memset(&del_route, 0, sizeof(del_route));
-
-		// Read up to RIB_MAX_READ_IN RIP Message Entries at a time:
+		// Process up to RIB_MAX_READ_IN RIP Message Entries at a time:
 		while ( entry_count < RIB_MAX_READ_IN ) {
 
-			// Wipe our set of fds, and monitor our input pipe descriptor:
+			// Wipe our set of fds, and monitor our input pipe descriptor (unless our ingest queues are full) and kernel route events:
 			FD_ZERO(&readfds);
-			FD_SET(xripd_settings->p_rib_in[0], &readfds);
+			if ( rib_ingest_backlog() < RIB_INGEST_BACKLOG_MAX ) {
+				FD_SET(xripd_settings->p_rib_in[0], &readfds);
+			}
+			FD_SET(xripd_settings->nlmon_sd, &readfds);
 
-			// Timeout value; (how often to poll)
-			timeout.tv_sec = RIB_SELECT_TIMEOUT;
+			// Timeout value; (how often to poll). Don't wait if we have routes queued:
+			timeout.tv_sec = ( rib_ingest_backlog() > 0 ) ? 0 : RIB_SELECT_TIMEOUT;
 			timeout.tv_usec = 0;
 
 			// Wait up to a second for a msg entry to come in
-			sret = select(xripd_settings->p_rib_in[0] + 1, &readfds, NULL, NULL, &timeout);
+			sret = select(maxfd + 1, &readfds, NULL, NULL, &timeout);
 
 			// Error:
 			if (sret < 0) {
 				fprintf(stderr, "[rib]: Unable to select() on pipe.\n");
 				return;
 
-			// Pipe sd is ready to be read:
-			} else if (sret) { 
+			// Kernel route table has changed, apply the deltas to our rib:
+			} else if ( sret && FD_ISSET(xripd_settings->nlmon_sd, &readfds) ) {
 
-				// Read struct sent from listening daemon over anon pipe:
-				// This is a blocking function, not an issue as we have select()ed on the 
-				// fdset containing the socket beforehand:
-				read(xripd_settings->p_rib_in[0], &in_entry, sizeof(rib_entry_t));
-				++entry_count;
-#if XRIPD_DEBUG == 1
-				rib_route_print(&in_entry);
-#endif
+				pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+				if ( netlink_read_route_events(xripd_settings) != 0 ) {
+					local_resync = 1;
+				}
+				pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+
+			// Pipe sd is ready to be read, drain it into the ingest queue of each route's neighbour:
+			} else if (sret) { 
 
-				// If filter exists:
-				if ( xripd_settings->filter_mode != XRIPD_FILTER_MODE_NULL ) {
-					// Pass route through filter, and if success, proceed with adding to rib/kernel:
-					if ( filter_route(xripd_settings->xripd_rib->filter, in_entry.rip_msg_entry.ipaddr, 
-						in_entry.rip_msg_entry.subnet) == XRIPD_FILTER_RESULT_ALLOW ) {
-
-						// Lock, Add Entry, Unlock:
-						pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
-						add_entry_to_rib(xripd_settings, &add_rib_ret, &in_entry, &ins_route, &del_route);
-						pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
-					}
-				} else {
-				
-					// Don't worry about filter, process straight through our rib:
-					pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
-					add_entry_to_rib(xripd_settings, &add_rib_ret, &in_entry, &ins_route, &del_route);
-					pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+				if ( rib_ingest_read(xripd_settings->p_rib_in[0]) < 0 ) {
+					fprintf(stderr, "[rib]: Unable to read from pipe.\n");
+					return;
 				}
 
-			// Select Timeout triggered, break out of loop:
-			} else {
+			// Select Timeout triggered with nothing queued, break out of loop:
+			} else if ( rib_ingest_backlog() == 0 ) {
 				break;
 			}
+
+			// Process our queued routes, a fair share (deficit round robin) from each neighbour:
+			pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+			entry_count += rib_ingest_service(&rib_ingest_entry, xripd_settings, RIB_MAX_READ_IN - entry_count);
+			pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
 		}
 
-		// Refresh RIB's view of local routes. Invalidate any routes that are no longer local in the RIB:
+		// Hand any routes the kernel has failed back to the FIB writer:
 		pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
-		refresh_local_routes_into_rib(xripd_settings);
+		retry_failed_fib_routes(xripd_settings);
 		pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+
+		// We've lost route events (or a link has come back up). Refresh RIB's view of local routes, and invalidate any routes that are no longer local in the RIB:
+		if ( local_resync ) {
+			fprintf(stderr, "[rib]: Resyncing local routes with the kernel.\n");
+			pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
+			refresh_local_routes_into_rib(xripd_settings);
+			pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
+			local_resync = 0;
+		}
 		
-		// Set Metric = 16 for routes that have exceeded their time to live
+		// Set Metric = 16 for routes that have exceeded their time to live.
+		// Neighbours that have gone quiet altogether first, straight from our neighbour table:
 		delcount = 0;
 		pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
-		(*xripd_settings->xripd_rib->remove_expired_entries)(&(xripd_settings->rip_timers), &delcount);
+		rib_neigh_expire(time(NULL) - xripd_settings->rip_timers.route_invalid, &rib_neigh_timed_out, xripd_settings);
+		if ( (*xripd_settings->xripd_rib->remove_expired_entries)(&(xripd_settings->rip_timers), &delcount) > 0 ) {
+			(*xripd_settings->xripd_rib->walk_rib)(&delete_expired_entry, NULL);
+			rib_trigger_update(xripd_settings);
+		}
+		rib_damp_expire(time(NULL));
 		pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
 		xripd_settings->xripd_rib->size -= delcount;
 
@@ -433,6 +1179,7 @@ void rib_main_loop(xripd_settings_t *xripd_settings) {
 		if ( (dump_count % 5) == 0 ) {
 			pthread_mutex_lock(&(xripd_settings->rib_shared.mutex_rib_lock));
 			(*xripd_settings->xripd_rib->dump_rib)();
+			rib_neigh_dump();
 			pthread_mutex_unlock(&(xripd_settings->rib_shared.mutex_rib_lock));
 			dump_count = 1;
 		} else {
@@ -2,8 +2,8 @@
 #define XRIPD_RIB_H
 
 #include "xripd.h"
-#include "rib-out.h"
 #include "filter-ll.h"
+#include "policy.h"
 
 // Standard Includes:
 #include <stdio.h>
@@ -12,6 +12,8 @@
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 // Network Specific:
 #include <arpa/inet.h>
@@ -44,6 +46,12 @@
 #define RIB_ORIGIN_LOCAL 0x00 // Locally originated from local interface
 #define RIB_ORIGIN_REMOTE 0x01 // Remotely learnt
 
+// State of a route in the kernel's table (fib_state):
+#define RIB_FIB_NONE 0x00 // Not programmed into the kernel (local route, or deleted)
+#define RIB_FIB_PENDING 0x01 // Sent to the kernel, awaiting its ACK
+#define RIB_FIB_INSTALLED 0x02 // Kernel has ACKed the route
+#define RIB_FIB_FAILED 0x03 // Kernel rejected the request (or the ACK was lost). Retried by the rib
+
 // The Rib is comprised of a logical ordering of rib_entry_t's
 // The raw data from a rip msg is held in rip_msg_entry and
 // related useful information is also packed in:
@@ -52,6 +60,13 @@ typedef struct rib_entry_t {
 	time_t recv_time;
 	rip_msg_entry_t rip_msg_entry;
 	uint8_t origin;
+	uint8_t changed; // Set by the datastore when the route is installed/replaced/invalidated, cleared once advertised in a triggered update
+	uint8_t fib_state; // RIB_FIB_*, kernel install state of this route
+	uint32_t fib_seq; // Netlink sequence number of the last request sent to the kernel for this route
+	int ifindex; // Interface the route is reached through (kernel RTA_OIF for local routes, our interface for remote routes)
+	uint8_t out_denied; // Our filter (or outbound policy) denies advertising this route. Cached when the route is added (or the filter reloaded)
+	policy_result_t out_policy; // Our outbound policy's sets for this route, applied as it is advertised
+	uint8_t filter_withdraw; // Newly denied by a reloaded filter, advertised once as unreachable in our next triggered update
 } rib_entry_t;
 
 // Abstraction, comprised of function pointers to underlying
@@ -61,15 +76,23 @@ typedef struct xripd_rib_t {
 	uint8_t rib_datastore;
 	time_t last_local_poll; // Time of our last netlink poll. Used to sync our rib with our local routes (determined through netlink).
 	struct filter_t *filter; // Pointer to our filter struct for filtering routes in/out of the RIB
+	struct policy_t *policy; // Our route policy (NULL if none), outbound rules are applied by the rib (inbound by the daemon)
 
 	uint32_t size;
 
+	// Set through our startup dump of the kernel table. Our own (RTPROT_XRIPD) routes left behind by a previous run
+	// are adopted as provisional routes, rather than ignored:
+	uint8_t warm_start;
+
 	// Function pointers for underlying datastore implementations:
 	int (*add_to_rib)(int*, const rib_entry_t*, rib_entry_t*, rib_entry_t*, int*);
 	int (*invalidate_expired_local_routes)(); // Metric = 16 for old local routes that are no longer in the kernel table
-	int (*remove_expired_entries)(const rip_timers_t*, int*);
+	int (*remove_expired_entries)(const rip_timers_t*, int*); // Returns the number of routes invalidated
 	int (*dump_rib)();
 	int (*serialise_rib)(char *buf, const uint32_t *count);
+	int (*walk_rib)(int (*callback)(rib_entry_t*, void*), void *arg); // Call callback on every entry, stop when it returns non-zero
+	int (*lookup_rib)(uint32_t ipaddr, uint32_t subnet, rib_entry_t *out); // Copy the entry for a prefix into out. Returns 1 if not found
+	int (*update_fib_state)(uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint8_t fib_state); // Record kernel state of a prefix. Returns 1 if not found, or seq is stale
 	void (*destroy_rib)();
 
 } xripd_rib_t;
@@ -87,6 +110,25 @@ void copy_rib_entry(rib_entry_t *src, rib_entry_t *dst);
 // Add a local route pointed to by nlmsghdr to the local rib:
 int add_local_route_to_rib(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr);
 
+// Invalidate a local route (pointed to by nlmsghdr) that has been deleted from the kernel:
+int del_local_route_from_rib(xripd_settings_t *xripd_settings, const struct nlmsghdr *nlhdr);
+
+// Interface ifindex has lost its carrier (or our address). Invalidate every route reached through it,
+// and send an urgent triggered update. Must be called with mutex_rib_lock held:
+void rib_link_down(xripd_settings_t *xripd_settings, int ifindex);
+
+// Record the kernel's ACK (error == 0) or NACK for the route request with sequence number seq.
+// Must be called with mutex_rib_lock held:
+void rib_fib_ack(xripd_settings_t *xripd_settings, uint32_t ipaddr, uint32_t subnet, uint32_t seq, uint16_t nlmsg_type, int error);
+
+// Record the kernel's answer to the nexthop message (RTM_DELNEXTHOP or RTM_NEWNEXTHOP) standing for every route stamped with seq.
+// Must be called with mutex_rib_lock held:
+void rib_fib_group_ack(xripd_settings_t *xripd_settings, uint32_t seq, uint16_t nlmsg_type, int error);
+
+// ACKs from the kernel have been lost (socket overrun), every pending route is marked for a retry.
+// Must be called with mutex_rib_lock held:
+void rib_fib_acks_lost(xripd_settings_t *xripd_settings);
+
 // Destroy RIB completely
 void destroy_rib(xripd_settings_t *xripd_settings);
 #endif
@@ -6,10 +6,86 @@ typedef struct req_t {
 	char buf[1024];
 } req_t;
 
+// Route messages waiting to be sent to the kernel.
+// Messages are appended back to back (NLMSG_ALIGNed), and sent in a single sendmsg() by netlink_flush_routes():
+typedef struct netlink_batch_t {
+	char buf[NETLINK_BATCH_SIZE];
+	uint32_t len;
+	uint32_t count;
+	uint32_t seq;
+} netlink_batch_t;
+
+// Outstanding route request, indexed by seq % NETLINK_ACK_RING_SIZE.
+// A successful ACK only echoes our nlmsghdr, so we need our own record of which prefix the seq was for:
+typedef struct netlink_ack_slot_t {
+	uint32_t seq;
+	uint32_t ipaddr;
+	uint32_t subnet;
+	uint16_t nlmsg_type;
+	int nh;
+	uint8_t group; // A nexthop message standing for the routes of a group, its answer is theirs
+} netlink_ack_slot_t;
+
+// A kernel nexthop object, shared by every route we install through the same gateway (neighbour):
+typedef struct netlink_nh_t {
+	uint32_t gw;
+	int oif;
+	uint32_t refs; // Prefixes we have installed through it
+	// Within a group (see netlink_group_add()):
+	uint32_t dying; // Prefixes through it being deleted
+	uint32_t moving; // Prefixes through it moving to one other gateway (move_gw out of move_oif)
+	uint32_t move_gw;
+	int move_oif;
+	uint8_t held; // A prefix through it stays put, or moves elsewhere. It can't be deleted or moved whole
+	uint8_t whole; // NETLINK_NH_DIE or NETLINK_NH_MOVE, once netlink_group_apply() has done so
+	uint32_t group_seq; // Seq of the RTM_DELNEXTHOP or RTM_NEWNEXTHOP standing for its routes
+	uint8_t used;
+	uint8_t installed;
+	uint8_t pinned; // Left by a previous run, routes we adopted on a warm start may still use it
+} netlink_nh_t;
+
+// Shadow FIB entry, what we have programmed into the kernel for a prefix:
+// its gateway (0 if unknown, ie. the kernel failed us), interface and the nexthop object it is installed through:
+typedef struct netlink_shadow_t {
+	uint32_t ipaddr;
+	uint32_t subnet;
+	uint32_t gw;
+	int oif;
+	int nh;
+	struct netlink_shadow_t *next;
+} netlink_shadow_t;
+
+// Only the FIB writer thread programs the kernel, our batch and ACK ring are its alone:
+static netlink_batch_t nl_batch;
+static netlink_ack_slot_t nl_acks[NETLINK_ACK_RING_SIZE];
+
+// Sequence numbers for our dumps (on nlsd, in the rib thread):
+static uint32_t nl_dump_seq = 0;
+
+// Dump receive buffer, grown to the largest datagram the kernel has sent us:
+static char *nl_dump_buf = NULL;
+static size_t nl_dump_buf_len = 0;
+
+// Nexthop objects, and our shadow FIB. FIB writer thread only
+// (pinned slots are written before the thread starts, and never change after):
+static int nl_nh_supported = 0;
+static netlink_nh_t nl_nh[NETLINK_NH_MAX];
+static netlink_shadow_t *nl_shadow[NETLINK_SHADOW_HASH];
+
+static void netlink_nh_probe(xripd_settings_t *xripd_settings);
+
+// Links we have seen go down (by ifindex, 0 for a free slot), so we act on a link going down or coming back up once,
+// not on every event it raises. Route monitor (rib thread) only:
+static int nl_links_down[NETLINK_LINK_DOWN_MAX];
+
+// Does the kernel honour our dump filters (NETLINK_GET_STRICT_CHK, Linux 4.20+)?
+static int nl_strict_chk = 0;
+
 // Function to create our netlink interface (used to install routes etc..):
 int init_netlink(xripd_settings_t *xripd_settings) {
 
 	struct sockaddr_nl netlink_address;
+	int on = 1;
 
 	// Spawn our NETLINK_ROUTE AF_NETLINK socket
 	xripd_settings->nlsd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -40,6 +116,15 @@ int init_netlink(xripd_settings_t *xripd_settings) {
 #endif
 	}
 
+	// Ask for strict checking of our dump requests, so the kernel filters dumps by table for us.
+	// Older kernels don't know the option, and we fall back to filtering in userspace:
+	if ( setsockopt(xripd_settings->nlsd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &on, sizeof(on)) == 0 ) {
+		nl_strict_chk = 1;
+	} else {
+		nl_strict_chk = 0;
+		fprintf(stderr, "[route]: Kernel lacks strict netlink checking, filtering route dumps ourselves.\n");
+	}
+
 // Success:
 	return 0;
 }
@@ -48,6 +133,78 @@ int init_netlink(xripd_settings_t *xripd_settings) {
 int del_netlink(xripd_settings_t *xripd_settings) {
 	close(xripd_settings->nlsd);
 	xripd_settings->nlsd = 0;
+	if ( xripd_settings->nlmon_sd > 0 ) {
+		close(xripd_settings->nlmon_sd);
+		xripd_settings->nlmon_sd = 0;
+	}
+	return 0;
+}
+
+// Function to create the netlink socket the FIB writer thread programs routes through.
+// Kept apart from nlsd, so its ACKs never mix with our dumps:
+int init_netlink_fib(xripd_settings_t *xripd_settings) {
+
+	struct sockaddr_nl netlink_address;
+	int rcvbuf = NETLINK_FIB_RCVBUF;
+
+	xripd_settings->nlfib_sd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if ( xripd_settings->nlfib_sd < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to open AF_NETLINK FIB Socket..\n");
+		return 1;
+	}
+
+	// Every message of a batch is answered with an ACK of its own, all queued before we read the first:
+	setsockopt(xripd_settings->nlfib_sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	// Let the kernel pick our address (nl_pid = 0):
+	memset(&netlink_address, 0, sizeof(netlink_address));
+	netlink_address.nl_family = AF_NETLINK;
+	netlink_address.nl_pid = 0;
+	netlink_address.nl_groups = 0;
+
+	if (bind(xripd_settings->nlfib_sd, (struct sockaddr*) &netlink_address, sizeof(netlink_address)) < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to bind AF_NETLINK FIB Socket..\n");
+		close(xripd_settings->nlfib_sd);
+		return 1;
+	}
+
+	// Can we install routes through nexthop objects?
+	netlink_nh_probe(xripd_settings);
+
+	return 0;
+}
+
+// Function to create our netlink route monitor, subscribed to the kernel's IPv4 route multicast group.
+// Lets us track local routes by their changes, rather than by dumping the whole table:
+int init_netlink_monitor(xripd_settings_t *xripd_settings) {
+
+	struct sockaddr_nl netlink_address;
+	int rcvbuf = NETLINK_MONITOR_RCVBUF;
+
+	xripd_settings->nlmon_sd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if ( xripd_settings->nlmon_sd < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to open AF_NETLINK monitor Socket..\n");
+		return 1;
+	}
+
+	// Route bursts (an interface going down) can be large:
+	setsockopt(xripd_settings->nlmon_sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	// Our first socket already holds our pid as its address, let the kernel pick one for us (nl_pid = 0):
+	memset(&netlink_address, 0, sizeof(netlink_address));
+	netlink_address.nl_family = AF_NETLINK;
+	netlink_address.nl_pid = 0;
+	netlink_address.nl_groups = RTMGRP_IPV4_ROUTE | RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+	if (bind(xripd_settings->nlmon_sd, (struct sockaddr*) &netlink_address, sizeof(netlink_address)) < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to bind AF_NETLINK monitor Socket to RTMGRP_IPV4_ROUTE|RTMGRP_LINK|RTMGRP_IPV4_IFADDR..\n");
+		close(xripd_settings->nlmon_sd);
+		return 1;
+	}
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[route]: Subscribed to RTMGRP_IPV4_ROUTE|RTMGRP_LINK|RTMGRP_IPV4_IFADDR.\n");
+#endif
+
 	return 0;
 }
 
@@ -95,6 +252,47 @@ uint32_t cidr_to_netmask_netorder(int cidr) {
 	}
 }
 
+// Is ipaddr (network order) directly reachable on our interface's subnet (and not ourselves)?
+int route_nexthop_onlink(const xripd_settings_t *xripd_settings, uint32_t ipaddr) {
+
+	uint32_t self = xripd_settings->self_ip.sin_addr.s_addr;
+	uint32_t netmask = xripd_settings->iface_netmask;
+
+	if ( ipaddr == 0 || netmask == 0 || ipaddr == self ) {
+		return 0;
+	}
+	return ( (ipaddr & netmask) == (self & netmask) );
+}
+
+// Gateway to install into the kernel for a remotely learnt route.
+// A next hop of 0 (or one we can't reach directly) means route via the advertising router:
+uint32_t route_gateway(const xripd_settings_t *xripd_settings, const rib_entry_t *entry) {
+
+	if ( route_nexthop_onlink(xripd_settings, entry->rip_msg_entry.nexthop) ) {
+		return entry->rip_msg_entry.nexthop;
+	}
+	return entry->recv_from.sin_addr.s_addr;
+}
+
+// Next hop to place into our own advertisement of entry.
+// Routes we forward via another router on the same segment are advertised with that router as the next hop,
+// so our neighbours can forward to it directly, rather than through us. Everything else is 0 (via ourselves):
+uint32_t route_advertised_nexthop(const xripd_settings_t *xripd_settings, const rib_entry_t *entry) {
+
+	uint32_t gw = 0;
+
+	if ( entry->origin == RIB_ORIGIN_LOCAL ) {
+		gw = entry->rip_msg_entry.nexthop; // Kernel gateway (if any)
+	} else {
+		gw = route_gateway(xripd_settings, entry);
+	}
+
+	if ( route_nexthop_onlink(xripd_settings, gw) ) {
+		return gw;
+	}
+	return 0;
+}
+
 // Given a reference to req, prepare the netlink header
 // nlmsg_type (ex. RTM_NEWROUTE) must be provided
 static void prepare_req_nlhdr_rtm(req_t *req, int nlmsg_type, rib_entry_t *entry, int replace_flag) {
@@ -103,12 +301,11 @@ static void prepare_req_nlhdr_rtm(req_t *req, int nlmsg_type, rib_entry_t *entry
 	// Datagram orientated REQUEST message, and request to CREATE a new object:
 	req->nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)); // Set length of msg in header:
 
-	// Replace or append:
+	// Replace or append, always ask the kernel to ACK:
 	if ( replace_flag ) {
-		fprintf(stderr, "REEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEEPLACE\n");
-		req->nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_REPLACE;
+		req->nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_REPLACE | NLM_F_CREATE;
 	} else {
-		req->nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
+		req->nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE;
 	}
 	
 	// Assign our type:
@@ -130,26 +327,32 @@ static void prepare_req_nlhdr_rtm(req_t *req, int nlmsg_type, rib_entry_t *entry
 	return;
 }
 
-// Prepare the RTAs for a RTM_NEWROUTE message:
-static void prepare_req_rtm_newroute_rtas(req_t *req, xripd_settings_t *xripd_settings, rib_entry_t *entry) {
+// Prepare the RTAs for a RTM_NEWROUTE message, through our nexthop object nh (or its own gateway if nh < 0):
+static void prepare_req_rtm_newroute_rtas(req_t *req, xripd_settings_t *xripd_settings, rib_entry_t *entry, int nh) {
 	
 	// Attribute Variables:
 	int index = 0;
 	uint8_t dst[4];
-	uint8_t gw[4];
+	uint32_t gw = 0;
+	uint32_t nh_id = 0;
 
 	// Format and copy attributes into our message:
 	index = xripd_settings->iface_index;
 	memcpy(dst, &(entry->rip_msg_entry.ipaddr), 4);
-	memcpy(gw, &(entry->recv_from.sin_addr.s_addr), 4);
+	gw = route_gateway(xripd_settings, entry);
 
-	addattr_l(&req->nl, sizeof(*req), RTA_OIF, &index, sizeof(index));
 	addattr_l(&req->nl, sizeof(*req), RTA_DST, dst, 4);
-	addattr_l(&req->nl, sizeof(*req), RTA_GATEWAY, gw, 4);
+	if ( nh >= 0 ) {
+		nh_id = NETLINK_NH_ID_BASE + nh;
+		addattr_l(&req->nl, sizeof(*req), RTA_NH_ID, &nh_id, sizeof(nh_id));
+	} else {
+		addattr_l(&req->nl, sizeof(*req), RTA_OIF, &index, sizeof(index));
+		addattr_l(&req->nl, sizeof(*req), RTA_GATEWAY, &gw, 4);
+	}
 }
 
-// Format and prepare msghdr (which is used in the sendmsg abi):
-static void prepare_msghdr(struct msghdr *rtnl_msghdr, struct iovec *io_vec, struct req_t *req, struct sockaddr_nl *kernel_address) {
+// Format and prepare msghdr (which is used in the sendmsg abi), given a buffer of len bytes of netlink messages:
+static void prepare_msghdr(struct msghdr *rtnl_msghdr, struct iovec *io_vec, void *buf, uint32_t len, struct sockaddr_nl *kernel_address) {
 
 	// Address of our destination (the kernel):
 	kernel_address->nl_family = AF_NETLINK;
@@ -157,8 +360,8 @@ static void prepare_msghdr(struct msghdr *rtnl_msghdr, struct iovec *io_vec, str
 	kernel_address->nl_groups = 0; // MCAST not a requirement
 
 	// Format for sendmsg:
-	io_vec->iov_base = &(req->nl);
-	io_vec->iov_len = req->nl.nlmsg_len;
+	io_vec->iov_base = buf;
+	io_vec->iov_len = len;
 
 	rtnl_msghdr->msg_name = kernel_address;
 	rtnl_msghdr->msg_namelen = sizeof(*kernel_address);
@@ -169,142 +372,691 @@ static void prepare_msghdr(struct msghdr *rtnl_msghdr, struct iovec *io_vec, str
 	return;
 }
 
-// Given a new route (install_rib), install this into the routing table:
-int netlink_install_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib) {
-
-	// rtmsg struct with netlink message header:
-	req_t req;
+// Send every route message held in our batch to the kernel, in a single sendmsg():
+int netlink_flush_routes(xripd_settings_t *xripd_settings) {
 
 	int len = 0;
-	
+
 	// Netlink socket address for the kernel:
 	struct sockaddr_nl kernel_address;
 
 	// Structs for sendmsg()
-	// Netlink packets get packed/referenced into these:
 	struct msghdr rtnl_msghdr;
 	struct iovec io_vec;
 
-	// Wipe buffer and associated structs:
+	if ( nl_batch.count == 0 ) {
+		return 0;
+	}
+
 	memset(&kernel_address, 0, sizeof(kernel_address));
 	memset(&rtnl_msghdr, 0, sizeof(rtnl_msghdr));
 	memset(&io_vec, 0, sizeof(io_vec));
-	memset(&req, 0, sizeof(req));
 
-	// Prepare the netlink header contained in req:
-	prepare_req_nlhdr_rtm(&req, RTM_NEWROUTE, install_rib, 0);
-
-	// Prepare our RTAs given install_rib:
-	prepare_req_rtm_newroute_rtas(&req, xripd_settings, install_rib);
+	prepare_msghdr(&rtnl_msghdr, &io_vec, nl_batch.buf, nl_batch.len, &kernel_address);
 
-	// Prepare our msgheader used for sendmsg:
-	prepare_msghdr(&rtnl_msghdr, &io_vec, &req, &kernel_address);
-
-	// Send to the kernel
+	len = sendmsg(xripd_settings->nlfib_sd, &rtnl_msghdr, 0);
 #if XRIPD_DEBUG == 1
-	char ipaddr[32];
-	char subnet[16];
-	inet_ntop(AF_INET, &(install_rib->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
-	inet_ntop(AF_INET, &(install_rib->rip_msg_entry.subnet), subnet, sizeof(subnet));
-	fprintf(stderr, "[route]: Sending NLM_F_CREATE Request to Kernel for %s %s.\n", ipaddr, subnet);
+	fprintf(stderr, "[route]: Flushed batch of %u route message(s) to kernel, sendmsg len was %d.\n", nl_batch.count, len);
 #endif
-	len = sendmsg(xripd_settings->nlsd, &rtnl_msghdr, 0);
+	if ( len < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to send batch of %u route message(s) to kernel.\n", nl_batch.count);
+	}
+
+	nl_batch.len = 0;
+	nl_batch.count = 0;
+
+	return ( len < 0 );
+}
+
+// Next netlink sequence number. 0 is never used, so a zeroed rib_entry_t never matches an ACK:
+static uint32_t netlink_next_seq() {
+	if ( ++nl_batch.seq == 0 ) {
+		++nl_batch.seq;
+	}
+	return nl_batch.seq;
+}
+
+// Copy a prepared message (for the prefix ipaddr/subnet, or our nexthop nh) onto the end of our batch,
+// flushing the batch first if it won't fit. Record the request in our ACK ring, and return its seq:
+static uint32_t netlink_batch_append(xripd_settings_t *xripd_settings, struct nlmsghdr *nl, uint32_t ipaddr, uint32_t subnet, int nh) {
+
+	uint32_t len = NLMSG_ALIGN(nl->nlmsg_len);
+	netlink_ack_slot_t *slot;
+
+	if ( nl_batch.len + len > sizeof(nl_batch.buf) ) {
+		netlink_flush_routes(xripd_settings);
+	}
+
+	nl->nlmsg_seq = netlink_next_seq();
+	memcpy(nl_batch.buf + nl_batch.len, nl, nl->nlmsg_len);
+	nl_batch.len += len;
+	nl_batch.count++;
+
+	slot = &nl_acks[nl->nlmsg_seq % NETLINK_ACK_RING_SIZE];
+	slot->seq = nl->nlmsg_seq;
+	slot->ipaddr = ipaddr;
+	slot->subnet = subnet;
+	slot->nlmsg_type = nl->nlmsg_type;
+	slot->nh = nh;
+	slot->group = 0;
+
+	return nl->nlmsg_seq;
+}
+
+// Take a nexthop object left in the kernel by a previous run back into our table:
+static void netlink_nh_adopt(struct nlmsghdr *nlhdr) {
+
+	struct nhmsg *nhm = (struct nhmsg *)NLMSG_DATA(nlhdr);
+	struct rtattr *nh_attribute = (struct rtattr *)(((char *)nhm) + NLMSG_ALIGN(sizeof(struct nhmsg)));
+	int len = nlhdr->nlmsg_len - NLMSG_LENGTH(sizeof(struct nhmsg));
+	uint32_t id = 0;
+	uint32_t gw = 0;
+	int oif = 0;
+	netlink_nh_t *slot;
+
+	if ( nhm->nh_protocol != RTPROT_XRIPD || nhm->nh_family != AF_INET ) {
+		return;
+	}
+
+	while ( RTA_OK(nh_attribute, len) ) {
+		switch (nh_attribute->rta_type) {
+			case NHA_ID:
+				memcpy(&id, RTA_DATA(nh_attribute), sizeof(id));
+				break;
+			case NHA_GATEWAY:
+				memcpy(&gw, RTA_DATA(nh_attribute), sizeof(gw));
+				break;
+			case NHA_OIF:
+				memcpy(&oif, RTA_DATA(nh_attribute), sizeof(oif));
+				break;
+		}
+		nh_attribute = RTA_NEXT(nh_attribute, len);
+	}
+
+	if ( id < NETLINK_NH_ID_BASE || id >= NETLINK_NH_ID_BASE + NETLINK_NH_MAX || gw == 0 ) {
+		return;
+	}
+
+	slot = &nl_nh[id - NETLINK_NH_ID_BASE];
+	slot->gw = gw;
+	slot->oif = oif;
+	slot->used = 1;
+	slot->installed = 1;
+	slot->pinned = 1;
 #if XRIPD_DEBUG == 1
-	fprintf(stderr, "[route]: sendmsg len was %d.\n", len);
+	char gw_str[16];
+	inet_ntop(AF_INET, &gw, gw_str, sizeof(gw_str));
+	fprintf(stderr, "[route]: Adopted nexthop %u via %s from the kernel.\n", id, gw_str);
 #endif
-	return 0;
 }
 
-// Given a del_entry, delete route from kernel table:
-int netlink_delete_new_route(xripd_settings_t *xripd_settings, rib_entry_t *del_entry) {
+// Check the kernel supports nexthop objects, by dumping them on our FIB socket.
+// Any of ours left by a previous run are taken back into our table:
+static void netlink_nh_probe(xripd_settings_t *xripd_settings) {
 
-	// rtmsg struct with netlink message header:
-	req_t req;
+	struct {
+		struct nlmsghdr nl;
+		struct nhmsg nhm;
+	} req;
 
+	char buf[8192];
+	struct nlmsghdr *msg_ptr;
 	int len = 0;
-	
-	// Netlink socket address for the kernel:
-	struct sockaddr_nl kernel_address;
 
-	// Structs for sendmsg()
-	// Netlink packets get packed/referenced into these:
-	struct msghdr rtnl_msghdr;
-	struct iovec io_vec;
-
-	// Wipe buffer and associated structs:
-	memset(&kernel_address, 0, sizeof(kernel_address));
-	memset(&rtnl_msghdr, 0, sizeof(rtnl_msghdr));
-	memset(&io_vec, 0, sizeof(io_vec));
 	memset(&req, 0, sizeof(req));
+	req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	req.nl.nlmsg_type = RTM_GETNEXTHOP;
+	req.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nl.nlmsg_seq = netlink_next_seq();
+	req.nhm.nh_family = AF_UNSPEC;
 
-	// Prepare the netlink header contained in req:
-	prepare_req_nlhdr_rtm(&req, RTM_DELROUTE, del_entry, 0);
+	nl_nh_supported = 0;
+	memset(nl_nh, 0, sizeof(nl_nh));
 
-	// Prepare our RTAs given del_entry:
-	prepare_req_rtm_newroute_rtas(&req, xripd_settings, del_entry);
+	if ( send(xripd_settings->nlfib_sd, &req, req.nl.nlmsg_len, 0) < 0 ) {
+		return;
+	}
 
-	// Prepare our msgheader used for sendmsg:
-	prepare_msghdr(&rtnl_msghdr, &io_vec, &req, &kernel_address);
+	while (1) {
 
-	// Send to the kernel
+		len = recv(xripd_settings->nlfib_sd, buf, sizeof(buf), 0);
+		if ( len <= 0 ) {
+			return;
+		}
+
+		msg_ptr = (struct nlmsghdr *) buf;
+		while ( NLMSG_OK(msg_ptr, len) ) {
+
+			if ( msg_ptr->nlmsg_seq == req.nl.nlmsg_seq ) {
+				switch (msg_ptr->nlmsg_type) {
+					case NLMSG_DONE:
+						nl_nh_supported = 1;
 #if XRIPD_DEBUG == 1
-	char ipaddr[32];
-	char subnet[16];
-	inet_ntop(AF_INET, &(del_entry->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
-	inet_ntop(AF_INET, &(del_entry->rip_msg_entry.subnet), subnet, sizeof(subnet));
-	fprintf(stderr, "[route]: Sending NLM_F_CREATE Request to Kernel for %s %s.\n", ipaddr, subnet);
+						fprintf(stderr, "[route]: Installing routes through nexthop objects.\n");
 #endif
-	len = sendmsg(xripd_settings->nlsd, &rtnl_msghdr, 0);
+						return;
+					// Older kernels (before 5.3) don't know RTM_GETNEXTHOP:
+					case NLMSG_ERROR:
+						fprintf(stderr, "[route]: Kernel lacks nexthop objects, installing routes with RTA_GATEWAY.\n");
+						return;
+					case RTM_NEWNEXTHOP:
+						netlink_nh_adopt(msg_ptr);
+						break;
+					default:
+						break;
+				}
+			}
+			msg_ptr = NLMSG_NEXT(msg_ptr, len);
+		}
+	}
+}
+
+// Queue a RTM_NEWNEXTHOP (create or replace) or RTM_DELNEXTHOP for our nexthop nh, returning its seq:
+static uint32_t netlink_nh_queue(xripd_settings_t *xripd_settings, int nh, int nlmsg_type) {
+
+	struct {
+		struct nlmsghdr nl;
+		struct nhmsg nhm;
+		char buf[256];
+	} req;
+
+	uint32_t id = NETLINK_NH_ID_BASE + nh;
+
+	memset(&req, 0, sizeof(req));
+	req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	req.nl.nlmsg_type = nlmsg_type;
+	req.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+
+	addattr_l(&req.nl, sizeof(req), NHA_ID, &id, sizeof(id));
+
+	if ( nlmsg_type == RTM_NEWNEXTHOP ) {
+		req.nl.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+		req.nhm.nh_family = AF_INET;
+		req.nhm.nh_protocol = RTPROT_XRIPD;
+		addattr_l(&req.nl, sizeof(req), NHA_OIF, &(nl_nh[nh].oif), sizeof(nl_nh[nh].oif));
+		addattr_l(&req.nl, sizeof(req), NHA_GATEWAY, &(nl_nh[nh].gw), sizeof(nl_nh[nh].gw));
+	}
+
 #if XRIPD_DEBUG == 1
-	fprintf(stderr, "[route]: sendmsg len was %d.\n", len);
+	char gw_str[16];
+	inet_ntop(AF_INET, &(nl_nh[nh].gw), gw_str, sizeof(gw_str));
+	fprintf(stderr, "[route]: Queueing %s Request to Kernel for nexthop %u via %s.\n",
+			(nlmsg_type == RTM_DELNEXTHOP) ? "RTM_DELNEXTHOP" : "RTM_NEWNEXTHOP", id, gw_str);
 #endif
+	return netlink_batch_append(xripd_settings, &req.nl, 0, 0, nh);
+}
+
+// Find (or create, and queue to the kernel) our nexthop object for gw out of oif.
+// Returns its slot, or -1 if our table is full:
+static int netlink_nh_get(xripd_settings_t *xripd_settings, uint32_t gw, int oif) {
+
+	int free_slot = -1;
+
+	for ( int nh = 0; nh < NETLINK_NH_MAX; nh++ ) {
+		if ( nl_nh[nh].used ) {
+			// (A nexthop being deleted with its routes is gone, once our batch reaches the kernel)
+			if ( nl_nh[nh].gw == gw && nl_nh[nh].oif == oif && nl_nh[nh].whole != NETLINK_NH_DIE ) {
+				free_slot = nh;
+				break;
+			}
+		} else if ( free_slot < 0 ) {
+			free_slot = nh;
+		}
+	}
+
+	if ( free_slot < 0 ) {
+		return -1;
+	}
+
+	nl_nh[free_slot].used = 1;
+	nl_nh[free_slot].gw = gw;
+	nl_nh[free_slot].oif = oif;
+	if ( !nl_nh[free_slot].installed ) {
+		netlink_nh_queue(xripd_settings, free_slot, RTM_NEWNEXTHOP);
+		nl_nh[free_slot].installed = 1;
+	}
+	return free_slot;
+}
+
+// Release a prefix's hold on our nexthop nh. Once nothing uses it, delete it from the kernel:
+static void netlink_nh_unref(xripd_settings_t *xripd_settings, int nh) {
+
+	if ( nl_nh[nh].refs > 0 ) {
+		nl_nh[nh].refs--;
+	}
+	if ( nl_nh[nh].refs == 0 && !nl_nh[nh].pinned ) {
+		if ( nl_nh[nh].installed ) {
+			netlink_nh_queue(xripd_settings, nh, RTM_DELNEXTHOP);
+		}
+		memset(&(nl_nh[nh]), 0, sizeof(netlink_nh_t));
+	}
+}
+
+// Hash a prefix into a bucket of our shadow FIB:
+static uint32_t netlink_shadow_hash(uint32_t ipaddr, uint32_t subnet) {
+	return ((ipaddr * 2654435761u) ^ subnet) % NETLINK_SHADOW_HASH;
+}
+
+// What have we programmed for a prefix? (NULL if nothing):
+static netlink_shadow_t *netlink_shadow_find(uint32_t ipaddr, uint32_t subnet) {
+
+	netlink_shadow_t *cur = nl_shadow[netlink_shadow_hash(ipaddr, subnet)];
+
+	while ( cur != NULL ) {
+		if ( cur->ipaddr == ipaddr && cur->subnet == subnet ) {
+			return cur;
+		}
+		cur = cur->next;
+	}
+	return NULL;
+}
+
+// Record a prefix as programmed via gw out of oif, through our nexthop nh (-1 for none).
+// Returns the nexthop it used before (-1 if none):
+static int netlink_shadow_set(uint32_t ipaddr, uint32_t subnet, uint32_t gw, int oif, int nh) {
+
+	uint32_t bucket = netlink_shadow_hash(ipaddr, subnet);
+	netlink_shadow_t *cur = netlink_shadow_find(ipaddr, subnet);
+	int old_nh = -1;
+
+	if ( cur == NULL ) {
+		cur = (netlink_shadow_t *)malloc(sizeof(netlink_shadow_t));
+		cur->ipaddr = ipaddr;
+		cur->subnet = subnet;
+		cur->next = nl_shadow[bucket];
+		nl_shadow[bucket] = cur;
+	} else {
+		old_nh = cur->nh;
+	}
+
+	cur->gw = gw;
+	cur->oif = oif;
+	cur->nh = nh;
+	return old_nh;
+}
+
+// Forget a prefix. Returns the nexthop it was installed through (-1 if none):
+static int netlink_shadow_remove(uint32_t ipaddr, uint32_t subnet) {
+
+	netlink_shadow_t **cur = &(nl_shadow[netlink_shadow_hash(ipaddr, subnet)]);
+	netlink_shadow_t *del;
+	int old_nh;
+
+	while ( *cur != NULL ) {
+		if ( (*cur)->ipaddr == ipaddr && (*cur)->subnet == subnet ) {
+			del = *cur;
+			old_nh = del->nh;
+			*cur = del->next;
+			free(del);
+			return old_nh;
+		}
+		cur = &((*cur)->next);
+	}
+	return -1;
+}
+
+// We no longer know what the kernel holds for any prefix (our ACKs have been lost), the next request for each goes out:
+static void netlink_shadow_forget_all() {
+
+	netlink_shadow_t *cur;
+
+	for ( int bucket = 0; bucket < NETLINK_SHADOW_HASH; bucket++ ) {
+		for ( cur = nl_shadow[bucket]; cur != NULL; cur = cur->next ) {
+			cur->gw = 0;
+		}
+	}
+}
+
+// As netlink_shadow_forget_all(), for the prefixes installed through our nexthop nh:
+static void netlink_shadow_forget_nh(int nh) {
+
+	netlink_shadow_t *cur;
+
+	for ( int bucket = 0; bucket < NETLINK_SHADOW_HASH; bucket++ ) {
+		for ( cur = nl_shadow[bucket]; cur != NULL; cur = cur->next ) {
+			if ( cur->nh == nh ) {
+				cur->gw = 0;
+			}
+		}
+	}
+}
+
+// Does the kernel already hold entry as we would program it (same gateway and interface)?
+int netlink_route_current(const xripd_settings_t *xripd_settings, const rib_entry_t *entry) {
+
+	netlink_shadow_t *shadow = netlink_shadow_find(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+
+	return ( shadow != NULL && shadow->gw != 0 && shadow->gw == route_gateway(xripd_settings, entry) && 
+			shadow->oif == xripd_settings->iface_index );
+}
+
+// Gateway and interface of a nexthop object we found in the kernel on startup:
+int netlink_nexthop_lookup(uint32_t id, uint32_t *gw, int *oif) {
+
+	if ( id < NETLINK_NH_ID_BASE || id >= NETLINK_NH_ID_BASE + NETLINK_NH_MAX || !nl_nh[id - NETLINK_NH_ID_BASE].pinned ) {
+		return 1;
+	}
+	*gw = nl_nh[id - NETLINK_NH_ID_BASE].gw;
+	*oif = nl_nh[id - NETLINK_NH_ID_BASE].oif;
 	return 0;
 }
 
-// Given a new route (install_rib), install this into the routing table:
-int netlink_replace_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib) {
+// Given an NLMSG_ERROR (an ACK if error == 0) from the kernel, match it back to the prefix of our request
+// and copy it into ack. Returns 1 if it was not for one of our route requests:
+static int netlink_match_ack(struct nlmsghdr *nlhdr, netlink_ack_t *ack) {
 
-	// rtmsg struct with netlink message header:
-	req_t req;
+	struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(nlhdr);
+	netlink_ack_slot_t *slot;
+	netlink_shadow_t *shadow;
+
+	if ( nlhdr->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr)) ) {
+		return 1;
+	}
+
+	slot = &nl_acks[err->msg.nlmsg_seq % NETLINK_ACK_RING_SIZE];
+	if ( err->msg.nlmsg_seq == 0 || slot->seq != err->msg.nlmsg_seq ) {
+		return 1;
+	}
+
+	// Our nexthops are ours to track. A failed create is retried, when the next route using it is installed.
+	// A failed move leaves the routes of a group on their old gateway, our shadow no longer knows what they hold:
+	if ( slot->nlmsg_type == RTM_NEWNEXTHOP ) {
+		if ( err->error != 0 ) {
+			fprintf(stderr, "[route]: Error, Kernel failed to create nexthop %u: %s\n", NETLINK_NH_ID_BASE + slot->nh, strerror(-err->error));
+			nl_nh[slot->nh].installed = 0;
+			if ( slot->group ) {
+				netlink_shadow_forget_nh(slot->nh);
+			}
+		}
+		if ( !slot->group ) {
+			slot->seq = 0;
+			return 1;
+		}
+	}
+
+	// The kernel failed a route, so our shadow no longer knows what it holds for the prefix.
+	// Its nexthop may have been flushed by the kernel (interface down), have it recreated on the retry:
+	if ( slot->nlmsg_type == RTM_NEWROUTE && err->error != 0 ) {
+		shadow = netlink_shadow_find(slot->ipaddr, slot->subnet);
+		if ( shadow != NULL ) {
+			shadow->gw = 0;
+			if ( shadow->nh >= 0 ) {
+				nl_nh[shadow->nh].installed = 0;
+			}
+		}
+	}
 
+	ack->seq = slot->seq;
+	ack->ipaddr = slot->ipaddr;
+	ack->subnet = slot->subnet;
+	ack->nlmsg_type = slot->nlmsg_type;
+	ack->error = err->error;
+	slot->seq = 0;
+	return 0;
+}
+
+// Read up to max ACKs the kernel has queued for us into acks, without blocking.
+// Stops short of max rather than drop an ACK, so the caller reaps again until it returns 0.
+// Sets *lost if the socket has overrun, and the kernel has thrown away some of our ACKs:
+int netlink_reap_acks(xripd_settings_t *xripd_settings, netlink_ack_t *acks, int max, int *lost) {
+
+	char buf[8192];
+	struct nlmsghdr *msg_ptr;
 	int len = 0;
-	
-	// Netlink socket address for the kernel:
-	struct sockaddr_nl kernel_address;
+	int count = 0;
 
-	// Structs for sendmsg()
-	// Netlink packets get packed/referenced into these:
-	struct msghdr rtnl_msghdr;
-	struct iovec io_vec;
+	*lost = 0;
 
-	// Wipe buffer and associated structs:
-	memset(&kernel_address, 0, sizeof(kernel_address));
-	memset(&rtnl_msghdr, 0, sizeof(rtnl_msghdr));
-	memset(&io_vec, 0, sizeof(io_vec));
+	// A datagram may hold more ACKs than acks has room left for, so stop while one could overflow it.
+	// Otherwise read until the socket is empty (EAGAIN):
+	while ( count + (sizeof(buf) / NLMSG_LENGTH(sizeof(struct nlmsgerr))) <= max ) {
+
+		len = recv(xripd_settings->nlfib_sd, buf, sizeof(buf), MSG_DONTWAIT);
+		if ( len < 0 ) {
+			if ( errno == ENOBUFS ) {
+				*lost = 1;
+				netlink_shadow_forget_all();
+				continue;
+			}
+			if ( errno == EINTR ) {
+				continue;
+			}
+			break;
+		}
+
+		msg_ptr = (struct nlmsghdr *) buf;
+		while ( NLMSG_OK(msg_ptr, len) ) {
+			if ( msg_ptr->nlmsg_type == NLMSG_ERROR && netlink_match_ack(msg_ptr, &acks[count]) == 0 ) {
+				count++;
+			}
+			msg_ptr = NLMSG_NEXT(msg_ptr, len);
+		}
+	}
+
+#if XRIPD_DEBUG == 1
+	if ( count > 0 ) {
+		fprintf(stderr, "[route]: Reaped %d ACK(s) from kernel.\n", count);
+	}
+#endif
+	return count;
+}
+
+// Prepare a route message of nlmsg_type for entry, and queue it into our batch:
+static void netlink_queue_route(xripd_settings_t *xripd_settings, rib_entry_t *entry, int nlmsg_type, int replace_flag) {
+
+	// rtmsg struct with netlink message header:
+	req_t req;
+	int nh = -1;
+	int old_nh = -1;
+	uint32_t gw = 0;
+	netlink_shadow_t *shadow = netlink_shadow_find(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
 	memset(&req, 0, sizeof(req));
 
+	// The prefix is part of a group, and goes (or moves) with its nexthop. That message answers for it:
+	if ( shadow != NULL && shadow->nh >= 0 && nl_nh[shadow->nh].whole != 0 ) {
+		nh = shadow->nh;
+		if ( nlmsg_type == RTM_DELROUTE && nl_nh[nh].whole == NETLINK_NH_DIE ) {
+			netlink_shadow_remove(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+			entry->fib_seq = nl_nh[nh].group_seq;
+			entry->fib_state = RIB_FIB_PENDING;
+			return;
+		}
+		gw = route_gateway(xripd_settings, entry);
+		if ( nlmsg_type == RTM_NEWROUTE && nl_nh[nh].whole == NETLINK_NH_MOVE && nl_nh[nh].gw == gw ) {
+			netlink_shadow_set(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet, gw, nl_nh[nh].oif, nh);
+			entry->fib_seq = nl_nh[nh].group_seq;
+			entry->fib_state = RIB_FIB_PENDING;
+			return;
+		}
+		nh = -1;
+	}
+
 	// Prepare the netlink header contained in req:
-	prepare_req_nlhdr_rtm(&req, RTM_NEWROUTE, install_rib, 1);
+	prepare_req_nlhdr_rtm(&req, nlmsg_type, entry, replace_flag);
+
+	if ( nlmsg_type == RTM_DELROUTE ) {
 
-	// Prepare our RTAs given install_rib:
-	prepare_req_rtm_newroute_rtas(&req, xripd_settings, install_rib);
+		// Match our route by prefix and protocol alone, whichever way its next hop was given to the kernel
+		// (our nexthop object, or RTA_GATEWAY for routes installed without one or adopted on a warm start):
+		addattr_l(&req.nl, sizeof(req), RTA_DST, &(entry->rip_msg_entry.ipaddr), 4);
+		old_nh = netlink_shadow_remove(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
 
-	// Prepare our msgheader used for sendmsg:
-	prepare_msghdr(&rtnl_msghdr, &io_vec, &req, &kernel_address);
+	} else {
+
+		gw = route_gateway(xripd_settings, entry);
+
+		// Share the nexthop object of every other route through this gateway (creating it if needed):
+		if ( nl_nh_supported ) {
+			nh = netlink_nh_get(xripd_settings, gw, xripd_settings->iface_index);
+		}
+
+		// Prepare our RTAs given entry:
+		prepare_req_rtm_newroute_rtas(&req, xripd_settings, entry, nh);
+
+		if ( nh >= 0 ) {
+			nl_nh[nh].refs++;
+		}
+		old_nh = netlink_shadow_set(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet, gw, xripd_settings->iface_index, nh);
+	}
 
-	// Send to the kernel
 #if XRIPD_DEBUG == 1
 	char ipaddr[32];
 	char subnet[16];
-	inet_ntop(AF_INET, &(install_rib->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
-	inet_ntop(AF_INET, &(install_rib->rip_msg_entry.subnet), subnet, sizeof(subnet));
-	fprintf(stderr, "[route]: Sending NLM_F_CREATE Request to Kernel for %s %s.\n", ipaddr, subnet);
+	inet_ntop(AF_INET, &(entry->rip_msg_entry.ipaddr), ipaddr, sizeof(ipaddr));
+	inet_ntop(AF_INET, &(entry->rip_msg_entry.subnet), subnet, sizeof(subnet));
+	fprintf(stderr, "[route]: Queueing %s%s Request to Kernel for %s %s.\n", 
+			(nlmsg_type == RTM_DELROUTE) ? "RTM_DELROUTE" : "RTM_NEWROUTE", 
+			replace_flag ? " NLM_F_REPLACE" : "", ipaddr, subnet);
 #endif
-	len = sendmsg(xripd_settings->nlsd, &rtnl_msghdr, 0);
+	entry->fib_seq = netlink_batch_append(xripd_settings, &req.nl, entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet, -1);
+	entry->fib_state = RIB_FIB_PENDING;
+
+	// The prefix has moved off the nexthop it used before (queued behind our route, so it is unused by then):
+	if ( old_nh >= 0 ) {
+		netlink_nh_unref(xripd_settings, old_nh);
+	}
+}
+
+// Given a new route (install_rib), install this into the routing table:
+int netlink_install_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib) {
+	netlink_queue_route(xripd_settings, install_rib, RTM_NEWROUTE, 0);
+	return 0;
+}
+
+// Given a del_entry, delete route from kernel table:
+int netlink_delete_new_route(xripd_settings_t *xripd_settings, rib_entry_t *del_entry) {
+	netlink_queue_route(xripd_settings, del_entry, RTM_DELROUTE, 0);
+	return 0;
+}
+
+// Given a new route (install_rib), replace the existing route in the routing table with it:
+int netlink_replace_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib) {
+	netlink_queue_route(xripd_settings, install_rib, RTM_NEWROUTE, 1);
+	return 0;
+}
+
+// Account entry, about to be deleted (op_delete) or reprogrammed, against the nexthop it is installed through.
+// With touched_only, only where the group already holds a prefix through that nexthop:
+void netlink_group_add(const xripd_settings_t *xripd_settings, const rib_entry_t *entry, int op_delete, int touched_only) {
+
+	netlink_shadow_t *shadow = netlink_shadow_find(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+	netlink_nh_t *nh;
+	uint32_t gw;
+
+	// Pinned nexthops may still carry routes we adopted on a warm start, and are never deleted or moved.
+	// Nor do we know what the kernel holds for a prefix it has failed us on (gw 0):
+	if ( shadow == NULL || shadow->nh < 0 || shadow->gw == 0 ) {
+		return;
+	}
+	nh = &(nl_nh[shadow->nh]);
+	if ( !nh->installed || nh->pinned || (touched_only && nh->dying == 0 && nh->moving == 0 && !nh->held) ) {
+		return;
+	}
+
+	if ( op_delete ) {
+		nh->dying++;
+		return;
+	}
+
+	// A prefix that stays on its gateway (eg. only its metric has changed), or that moves somewhere
+	// other than the rest, keeps its nexthop from going whole:
+	gw = route_gateway(xripd_settings, entry);
+	if ( gw == shadow->gw && xripd_settings->iface_index == shadow->oif ) {
+		nh->held = 1;
+	} else if ( nh->moving == 0 ) {
+		nh->move_gw = gw;
+		nh->move_oif = xripd_settings->iface_index;
+		nh->moving++;
+	} else if ( nh->move_gw != gw || nh->move_oif != xripd_settings->iface_index ) {
+		nh->held = 1;
+	} else {
+		nh->moving++;
+	}
+}
+
+// Can our nexthop nh go whole, the group holding every prefix through it? Returns NETLINK_NH_DIE or NETLINK_NH_MOVE (0 if not):
+static int netlink_group_whole_nh(int nh) {
+
+	if ( nl_nh[nh].held || nl_nh[nh].refs == 0 ) {
+		return 0;
+	}
+	if ( nl_nh[nh].dying == nl_nh[nh].refs && nl_nh[nh].moving == 0 ) {
+		return NETLINK_NH_DIE;
+	}
+	if ( nl_nh[nh].moving == nl_nh[nh].refs && nl_nh[nh].dying == 0 ) {
+		// Another of our nexthops already goes that way, the prefixes join it one by one instead:
+		for ( int other = 0; other < NETLINK_NH_MAX; other++ ) {
+			if ( nl_nh[other].used && nl_nh[other].gw == nl_nh[nh].move_gw && nl_nh[other].oif == nl_nh[nh].move_oif ) {
+				return 0;
+			}
+		}
+		return NETLINK_NH_MOVE;
+	}
+	return 0;
+}
+
+// Does the group hold some, but not all, of the prefixes through a nexthop that could otherwise go whole?
+// If so, the rest are worth finding in the writer's queue:
+int netlink_group_open() {
+
+	for ( int nh = 0; nh < NETLINK_NH_MAX; nh++ ) {
+		if ( !nl_nh[nh].held && (nl_nh[nh].dying + nl_nh[nh].moving) > 0 && (nl_nh[nh].dying + nl_nh[nh].moving) < nl_nh[nh].refs ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Would entry go (or move) along with its nexthop, given the group so far?
+int netlink_group_whole(const rib_entry_t *entry) {
+
+	netlink_shadow_t *shadow = netlink_shadow_find(entry->rip_msg_entry.ipaddr, entry->rip_msg_entry.subnet);
+
+	return ( shadow != NULL && shadow->nh >= 0 && netlink_group_whole_nh(shadow->nh) != 0 );
+}
+
+// The group is complete. Delete every nexthop that none of its prefixes outlive, and move every nexthop all of its
+// prefixes are moving off to the same new gateway. The kernel removes (or moves) the routes along with it,
+// one message rather than one per prefix. Each prefix of the group is then stamped with that message's seq
+// as it is queued, and its answer arrives as an ACK of nlmsg_type RTM_DELNEXTHOP (or RTM_NEWNEXTHOP):
+void netlink_group_apply(xripd_settings_t *xripd_settings) {
+
+	int whole;
+
+	for ( int nh = 0; nh < NETLINK_NH_MAX; nh++ ) {
+
+		if ( (whole = netlink_group_whole_nh(nh)) == 0 ) {
+			continue;
+		}
+
+		if ( whole == NETLINK_NH_MOVE ) {
+			nl_nh[nh].gw = nl_nh[nh].move_gw;
+			nl_nh[nh].oif = nl_nh[nh].move_oif;
+		}
+		nl_nh[nh].whole = whole;
+		nl_nh[nh].group_seq = netlink_nh_queue(xripd_settings, nh, (whole == NETLINK_NH_DIE) ? RTM_DELNEXTHOP : RTM_NEWNEXTHOP);
+		nl_acks[nl_nh[nh].group_seq % NETLINK_ACK_RING_SIZE].group = 1;
 #if XRIPD_DEBUG == 1
-	fprintf(stderr, "[route]: sendmsg len was %d.\n", len);
+		fprintf(stderr, "[route]: %s nexthop %u in place of %u route(s).\n", (whole == NETLINK_NH_DIE) ? "Deleting" : "Moving", 
+				NETLINK_NH_ID_BASE + nh, nl_nh[nh].refs);
 #endif
-	return 0;
+	}
+}
+
+// Every prefix of the group has been queued. Forget it, and the nexthops it has deleted:
+void netlink_group_end() {
+
+	for ( int nh = 0; nh < NETLINK_NH_MAX; nh++ ) {
+		if ( nl_nh[nh].whole == NETLINK_NH_DIE ) {
+			memset(&(nl_nh[nh]), 0, sizeof(netlink_nh_t));
+			continue;
+		}
+		nl_nh[nh].dying = 0;
+		nl_nh[nh].moving = 0;
+		nl_nh[nh].held = 0;
+		nl_nh[nh].whole = 0;
+		nl_nh[nh].group_seq = 0;
+	}
 }
 
 static void dump_rtm_newroute(xripd_settings_t *xripd_settings, struct nlmsghdr *nlhdr) {
@@ -372,17 +1124,197 @@ static void dump_rtm_newroute(xripd_settings_t *xripd_settings, struct nlmsghdr
 	fprintf(stderr, "[route]: Received route from kernel table RT_TABLE_MAIN: %s/%d via %s.\n", dst, netmask, gw);
 }
 
-// Dump our entire local routing table, and
-// for each route that we discover, attempt to add to our local routing table (by calling add_local_route_to_rib):
-int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
+// Slot of ifindex in our table of downed links (-1 if it is not down, or not held):
+static int netlink_link_find_down(int ifindex) {
+
+	for ( int i = 0; i < NETLINK_LINK_DOWN_MAX; i++ ) {
+		if ( nl_links_down[i] == ifindex ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// A link has changed state (RTM_NEWLINK/RTM_DELLINK). Losing carrier invalidates every route through it straight away.
+// Regaining it on our interface requires a resync, as the kernel does not re-announce the routes it kept (as linkdown)
+// through the outage. Any other change (MTU, name, stats) of a link that stays as it was is of no interest to us.
+// Returns 1 if a resync is required:
+static int netlink_link_event(xripd_settings_t *xripd_settings, struct nlmsghdr *nlhdr) {
+
+	struct ifinfomsg *link = (struct ifinfomsg *)NLMSG_DATA(nlhdr);
+	int running = (link->ifi_flags & IFF_UP) && (link->ifi_flags & IFF_RUNNING);
+	int slot = netlink_link_find_down(link->ifi_index);
+
+	if ( nlhdr->nlmsg_type == RTM_DELLINK || !running ) {
+		if ( slot >= 0 ) {
+			return 0;
+		}
+#if XRIPD_DEBUG == 1
+		fprintf(stderr, "[route]: Link index %d is down.\n", link->ifi_index);
+#endif
+		rib_link_down(xripd_settings, link->ifi_index);
+		// (With our table full, the link is taken down again on each of its events, rather than never brought back)
+		if ( (slot = netlink_link_find_down(0)) >= 0 ) {
+			nl_links_down[slot] = link->ifi_index;
+		}
+		return 0;
+	}
+
+	if ( slot < 0 ) {
+		return 0;
+	}
+	nl_links_down[slot] = 0;
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[route]: Link index %d is up.\n", link->ifi_index);
+#endif
+	return ( link->ifi_index == xripd_settings->iface_index );
+}
+
+// An IPv4 address has been added or removed (RTM_NEWADDR/RTM_DELADDR). Losing the address we run RIP from
+// is as good as losing our link. Returns 1 if a resync is required:
+static int netlink_addr_event(xripd_settings_t *xripd_settings, struct nlmsghdr *nlhdr) {
+
+	struct ifaddrmsg *addr = (struct ifaddrmsg *)NLMSG_DATA(nlhdr);
+	struct rtattr *addr_attribute = IFA_RTA(addr);
+	int len = IFA_PAYLOAD(nlhdr);
+	uint32_t local = 0;
+
+	if ( addr->ifa_family != AF_INET ) {
+		return 0;
+	}
+
+	// An address on our interface (maybe our own, back again) may bring routes back, any other is of no interest to us:
+	if ( nlhdr->nlmsg_type == RTM_NEWADDR ) {
+		return ( addr->ifa_index == xripd_settings->iface_index );
+	}
+
+	while ( RTA_OK(addr_attribute, len) ) {
+		if ( addr_attribute->rta_type == IFA_LOCAL ) {
+			memcpy(&local, RTA_DATA(addr_attribute), sizeof(local));
+		}
+		addr_attribute = RTA_NEXT(addr_attribute, len);
+	}
+
+	if ( addr->ifa_index == xripd_settings->iface_index && local == xripd_settings->self_ip.sin_addr.s_addr ) {
+		fprintf(stderr, "[route]: Address %s removed from %s.\n", inet_ntoa(xripd_settings->self_ip.sin_addr), xripd_settings->iface_name);
+		rib_link_down(xripd_settings, addr->ifa_index);
+	}
+	return 0;
+}
+
+// Apply every queued kernel event to the rib, without blocking.
+// Returns 1 if the kernel has dropped events on us (ENOBUFS), or our link (or an address on it) has come up, and a full resync is required:
+int netlink_read_route_events(xripd_settings_t *xripd_settings) {
+
+	char buf[8192];
+	struct nlmsghdr *msg_ptr;
+	int len = 0;
+	int resync = 0;
+
+	while (1) {
+
+		len = recv(xripd_settings->nlmon_sd, buf, sizeof(buf), MSG_DONTWAIT);
+		if ( len < 0 ) {
+			if ( errno == ENOBUFS ) {
+				resync = 1;
+				continue;
+			}
+			break;
+		}
+
+		msg_ptr = (struct nlmsghdr *) buf;
+		while ( NLMSG_OK(msg_ptr, len) ) {
+
+			switch (msg_ptr->nlmsg_type) {
+				case RTM_NEWROUTE:
+#if XRIPD_DEBUG == 1
+					dump_rtm_newroute(xripd_settings, msg_ptr);
+#endif
+					add_local_route_to_rib(xripd_settings, msg_ptr);
+					break;
+				case RTM_DELROUTE:
+#if XRIPD_DEBUG == 1
+					fprintf(stderr, "[route]: RTM_DELROUTE event from kernel.\n");
+#endif
+					del_local_route_from_rib(xripd_settings, msg_ptr);
+					break;
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					resync |= netlink_link_event(xripd_settings, msg_ptr);
+					break;
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+					resync |= netlink_addr_event(xripd_settings, msg_ptr);
+					break;
+				default:
+					break;
+			}
+			msg_ptr = NLMSG_NEXT(msg_ptr, len);
+		}
+	}
+
+	return resync;
+}
+
+// Receive the next datagram of a dump on sd into our dump buffer, growing it to fit first.
+// We peek at the real length (MSG_PEEK|MSG_TRUNC) rather than guess it, and never truncate a datagram.
+// The kernel sizes its dump datagrams by the reader's buffer, so we always peek with at least NETLINK_DUMP_BUF_MIN.
+// Returns the datagram length, or -1 on error:
+static int netlink_recv_dump(int sd) {
+
+	int len;
+	char *grown;
+
+	if ( nl_dump_buf == NULL ) {
+		nl_dump_buf = malloc(NETLINK_DUMP_BUF_MIN);
+		if ( nl_dump_buf == NULL ) {
+			return -1;
+		}
+		nl_dump_buf_len = NETLINK_DUMP_BUF_MIN;
+	}
+
+	while (1) {
+		len = recv(sd, nl_dump_buf, nl_dump_buf_len, MSG_PEEK | MSG_TRUNC);
+		if ( len < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			return -1;
+		}
+		break;
+	}
+
+	if ( (size_t)len > nl_dump_buf_len ) {
+		grown = realloc(nl_dump_buf, len);
+		if ( grown == NULL ) {
+			fprintf(stderr, "[route]: Error, Unable to grow our netlink dump buffer to %d bytes.\n", len);
+			return -1;
+		}
+		nl_dump_buf = grown;
+		nl_dump_buf_len = len;
+#if XRIPD_DEBUG == 1
+		fprintf(stderr, "[route]: Netlink dump buffer grown to %d bytes.\n", len);
+#endif
+	}
+
+	do {
+		len = recv(sd, nl_dump_buf, nl_dump_buf_len, 0);
+	} while ( len < 0 && errno == EINTR );
+
+	return len;
+}
+
+// Send one RTM_GETROUTE dump request for the main IPv4 table, and hand each route to add_local_route_to_rib.
+// With strict checking, the kernel only walks the main table for us; otherwise we get every table
+// and parse_local_route() discards the rest.
+// Returns 0 on success, 1 on failure, or NETLINK_DUMP_INTR if the table changed under the dump:
+static int netlink_dump_routes(xripd_settings_t *xripd_settings) {
 
 	struct {
 		struct nlmsghdr nl;
-		struct rtgenmsg rt_gen;
+		struct rtmsg rt;
 	} req;
 
-	char buf[8192];
-
 	// Netlink socket address for the kernel itself.
 	// Referencing this struct in our msghdr struct allows our netlink request
 	// to be delivered to kernel:
@@ -394,14 +1326,11 @@ int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
 	struct msghdr rtnl_msghdr;
 	struct iovec io_vec;
 
-	// Structs for our returned data from the kernel:
-	struct msghdr rtnl_msghdr_reply;
-	struct iovec io_vec_reply;
-
 	// Pointer to netlink message header:
 	struct nlmsghdr *msg_ptr;
 	
 	int end_parse = 0;
+	int interrupted = 0;
 
 	// Zero out our sending datastructures for sendmsg():
 	memset(&kernel_address, 0, sizeof(kernel_address));
@@ -410,7 +1339,7 @@ int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
 	memset(&req, 0, sizeof(req));
 
 #if XRIPD_DEBUG == 1
-	fprintf(stderr, "[route]: Sending NLM_F_DUMP request to kernel.\n");
+	fprintf(stderr, "[route]: Sending NLM_F_DUMP request to kernel (%s).\n", nl_strict_chk ? "strict, main table" : "all tables");
 #endif
 	// Kernel's address for NETLINK sockets
 	// kernel_address.nl_pid = 0 is implicit:
@@ -432,13 +1361,20 @@ int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
 	 * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ 
 	 */
 
-	req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg)); // Header is going to carry a rtgenmsg
+	// Header carries a full rtmsg (rtm_family sits where rtgen_family would), strict checking rejects a bare rtgenmsg:
+	req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
 	req.nl.nlmsg_type = RTM_GETROUTE;
-	req.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP; // Dump the entire routing table
-	req.nl.nlmsg_seq = 1;
+	req.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP; // Dump the routing table
+	req.nl.nlmsg_seq = ++nl_dump_seq;
 	req.nl.nlmsg_pid = getpid(); // Our sending 'address'
 
-	req.rt_gen.rtgen_family = AF_INET;
+	req.rt.rtm_family = AF_INET;
+
+	// Have the kernel filter to the main table for us.
+	// (Protocol filters can only match a single protocol, not exclude ours, so RTPROT_XRIPD is still discarded in parse_local_route)
+	if ( nl_strict_chk ) {
+		req.rt.rtm_table = RT_TABLE_MAIN;
+	}
 
 	// Pack our msgheader
 	// Iovector that references our actual netlink data:
@@ -453,68 +1389,93 @@ int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
 	rtnl_msghdr.msg_name = &kernel_address;
 	rtnl_msghdr.msg_namelen = sizeof(kernel_address);
 
-	sendmsg(xripd_settings->nlsd, (struct msghdr *) &rtnl_msghdr, 0);
+	if ( sendmsg(xripd_settings->nlsd, (struct msghdr *) &rtnl_msghdr, 0) < 0 ) {
+		fprintf(stderr, "[route]: Error, Unable to send our route dump request: %s\n", strerror(errno));
+		return 1;
+	}
 
 	while(!end_parse) {
 
 		int len;
 
-		// Zeroise our reply structs:
-		memset(&rtnl_msghdr_reply, 0, sizeof(rtnl_msghdr_reply));
-		memset(&io_vec_reply, 0, sizeof(io_vec_reply));
-	
-		// Place our recieved data into buf:
-		io_vec_reply.iov_base = buf;
-		io_vec_reply.iov_len = sizeof(buf);
+		// Give it to me:
+		len = netlink_recv_dump(xripd_settings->nlsd);
 
-		rtnl_msghdr_reply.msg_iov = &io_vec_reply;
-		rtnl_msghdr_reply.msg_iovlen = 1;
+		// Got something?
+		if ( len <= 0 ) {
+#if XRIPD_DEBUG == 1
+			fprintf(stderr, "[route]: No AF_NETLINK reply received. Indicates bad socket.\n");
+#endif
+			return 1;
+		}
 
-		// Receive from the kernel:
-		rtnl_msghdr_reply.msg_name = &kernel_address;
-		rtnl_msghdr_reply.msg_namelen = sizeof(kernel_address);
+		msg_ptr = (struct nlmsghdr *) nl_dump_buf;
 
-		// Give it to me:
-		len = recvmsg(xripd_settings->nlsd, &rtnl_msghdr_reply, 0);
+		// Is it safe to parse other netlink macros?
+		while  (NLMSG_OK(msg_ptr, len) ) {
 
-		// Got something?
-		if (len) {
+			// Not a reply to this dump (eg. a straggler from a dump we gave up on):
+			if ( msg_ptr->nlmsg_seq != req.nl.nlmsg_seq ) {
+				msg_ptr = NLMSG_NEXT(msg_ptr, len);
+				continue;
+			}
 
-			msg_ptr = (struct nlmsghdr *) buf;
+			// The table changed while the kernel was walking it, our view may be missing routes.
+			// Keep reading to the end of this dump, then have it run again:
+			if ( msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR ) {
+				interrupted = 1;
+			}
 
-			// Is it safe to parse other netlink macros?
-			while  (NLMSG_OK(msg_ptr, len) ) {
+			switch (msg_ptr->nlmsg_type) {
 
-				switch (msg_ptr->nlmsg_type) {
+				case NLMSG_DONE:
+					end_parse = 1;
+					break;
 
-					case NLMSG_DONE:
-						end_parse = 1;
-						break;
+				// The kernel has failed our dump:
+				case NLMSG_ERROR:
+					fprintf(stderr, "[route]: Error, Kernel failed our route dump: %s\n",
+						strerror(-((struct nlmsgerr *)NLMSG_DATA(msg_ptr))->error));
+					return 1;
 
-					// Kernel's sent us a route:
-					case RTM_NEWROUTE:
+				// Kernel's sent us a route:
+				case RTM_NEWROUTE:
 #if XRIPD_DEBUG == 1
-						dump_rtm_newroute(xripd_settings, msg_ptr);
+					dump_rtm_newroute(xripd_settings, msg_ptr);
 #endif
-						add_local_route_to_rib(xripd_settings, msg_ptr);
-						break;
-
-					default:
-						break;
-				}
+					add_local_route_to_rib(xripd_settings, msg_ptr);
+					break;
 
-				// Walk the chain of responses:
-				// 1 Request (NLM_F_DUMP) in this instance, generates multiple responses
-				// sizeof(buf) is quite large, so the sendmsg() call returns multiple messages:
-				msg_ptr = NLMSG_NEXT(msg_ptr, len);
+				default:
+					break;
 			}
-		} else {
-#if XRIPD_DEBUG == 1
-			fprintf(stderr, "[route]: No AF_NETLINK reply received. Indicates bad socket.\n");
-#endif
-			return 1;
+
+			// Walk the chain of responses:
+			// 1 Request (NLM_F_DUMP) in this instance, generates multiple responses:
+			msg_ptr = NLMSG_NEXT(msg_ptr, len);
+		}
+	}
+
+	return interrupted ? NETLINK_DUMP_INTR : 0;
+}
+
+// Dump our local routing table, and
+// for each route that we discover, attempt to add to our local routing table (by calling add_local_route_to_rib).
+// A dump the kernel flags as interrupted (NLM_F_DUMP_INTR) is run again, up to NETLINK_DUMP_RETRIES times:
+int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings) {
+
+	int ret;
+	int attempt;
+
+	for ( attempt = 0; attempt <= NETLINK_DUMP_RETRIES; attempt++ ) {
+		ret = netlink_dump_routes(xripd_settings);
+		if ( ret != NETLINK_DUMP_INTR ) {
+			return ret;
 		}
+		fprintf(stderr, "[route]: Route dump interrupted by a table change, restarting.\n");
 	}
 
+	// Give up with what we have. Route events will fill the gaps:
+	fprintf(stderr, "[route]: Warning, route dump still inconsistent after %d restarts.\n", NETLINK_DUMP_RETRIES);
 	return 0;
 }
@@ -24,21 +24,126 @@
 // Netlink Specific:
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/nexthop.h>
 
 #define RTPROT_XRIPD 33
 
+// Size of our buffer of batched route messages (approx 600 routes):
+#define NETLINK_BATCH_SIZE 32768
+
+// Receive buffer for our route event socket. Overrunning it costs us a full resync:
+#define NETLINK_MONITOR_RCVBUF (1024 * 1024)
+
+// Times a route dump is restarted when the kernel flags it as interrupted (NLM_F_DUMP_INTR), and
+// netlink_dump_routes() return for that case:
+#define NETLINK_DUMP_RETRIES 3
+#define NETLINK_DUMP_INTR 2
+
+// Starting size of our dump receive buffer, grown when the kernel sends a larger datagram:
+#define NETLINK_DUMP_BUF_MIN 32768
+
+// Receive buffer for the FIB writer's socket, room for the ACKs of a full batch (each takes ~1KB of buffer):
+#define NETLINK_FIB_RCVBUF (1024 * 1024)
+
+// Links we track as down at once, to act only when one comes back up:
+#define NETLINK_LINK_DOWN_MAX 64
+
+// Older headers lack strict dump checking (Linux 4.20):
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+// Size of our ring of outstanding route requests, used to match an ACK's seq back to its prefix:
+#define NETLINK_ACK_RING_SIZE 4096
+
+// Nexthop objects (Linux 5.3+). Every route we learn from a neighbour shares one kernel nexthop object,
+// so all of a neighbour's routes can be removed in one message.
+// Max amount of nexthop objects (neighbours) we hold, routes via any further gateways use RTA_GATEWAY:
+#define NETLINK_NH_MAX 256
+// Our nexthop IDs are NETLINK_NH_ID_BASE + slot, keeping clear of the IDs of other daemons:
+#define NETLINK_NH_ID_BASE 0x78720000
+// How a nexthop goes with its routes, when a group holds every one of them:
+#define NETLINK_NH_DIE 1
+#define NETLINK_NH_MOVE 2
+// Buckets in our shadow FIB (prefix -> gateway, interface and nexthop object we have programmed):
+#define NETLINK_SHADOW_HASH 4096
+
+// The kernel's answer (error == 0 for success) to one of our route requests:
+typedef struct netlink_ack_t {
+	uint32_t seq;
+	uint32_t ipaddr;
+	uint32_t subnet;
+	uint16_t nlmsg_type;
+	int error;
+} netlink_ack_t;
+
 // Init and bind our netlink socket:
 int init_netlink(xripd_settings_t *xripd_settings);
 
 // Delete our socket
 int del_netlink(xripd_settings_t *xripd_settings);
 
+// Init and bind the netlink socket used by the FIB writer thread:
+int init_netlink_fib(xripd_settings_t *xripd_settings);
+
+// Init and bind our second netlink socket, subscribed to kernel IPv4 route, link and address changes:
+int init_netlink_monitor(xripd_settings_t *xripd_settings);
+
+// Apply every queued kernel event (RTM_NEWROUTE/RTM_DELROUTE, and link/address changes) to the rib, without blocking.
+// Returns 1 if events have been lost (ENOBUFS), or our link (or an address on it) has come up, and a full resync is required.
+// Must be called with mutex_rib_lock held:
+int netlink_read_route_events(xripd_settings_t *xripd_settings);
+
 int netlink_add_local_routes_to_rib(xripd_settings_t *xripd_settings_t);
 
 int netlink_install_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib);
 int netlink_delete_new_route(xripd_settings_t *xripd_settings, rib_entry_t *del_entry);
 int netlink_replace_new_route(xripd_settings_t *xripd_settings, rib_entry_t *install_rib);
 
+// The three functions above only queue their message into a batch (with NLM_F_ACK), and stamp
+// the entry with the seq of the request and RIB_FIB_PENDING. Only to be called from the FIB writer thread.
+// Send the batch to the kernel:
+int netlink_flush_routes(xripd_settings_t *xripd_settings);
+
+// Groups of route requests (FIB writer thread only). Where a group holds every route through one of our nexthop objects,
+// and they are all being deleted (or all moving to one new gateway), the nexthop is deleted (or replaced) instead,
+// and the kernel removes (or moves) its routes along with it. Each op of the group is passed to netlink_group_add(),
+// then netlink_group_apply() before they are queued, and netlink_group_end() once they are.
+// Routes of the group are stamped with the seq of that one message, and their answer arrives as its ACK
+// (nlmsg_type RTM_DELNEXTHOP or RTM_NEWNEXTHOP):
+void netlink_group_add(const xripd_settings_t *xripd_settings, const rib_entry_t *entry, int op_delete, int touched_only);
+void netlink_group_apply(xripd_settings_t *xripd_settings);
+void netlink_group_end();
+
+// Does the group hold part of the routes through a nexthop, that could go whole with the rest of them?
+int netlink_group_open();
+
+// Would entry go (or move) with its nexthop, given the group so far?
+int netlink_group_whole(const rib_entry_t *entry);
+
+// Does our shadow FIB show the kernel already holding entry as we would program it (same gateway and interface)?
+// FIB writer thread only:
+int netlink_route_current(const xripd_settings_t *xripd_settings, const rib_entry_t *entry);
+
+// Gateway and interface of a nexthop object we found in the kernel on startup (for routes adopted on a warm start).
+// Returns 1 if id is not one of them:
+int netlink_nexthop_lookup(uint32_t id, uint32_t *gw, int *oif);
+
+// Read up to max ACKs the kernel has queued for us into acks, without blocking. Returns the count read.
+// It stops short of max rather than drop an ACK, so call it until it returns 0 to empty the socket.
+// *lost is set if the socket has overrun and ACKs have been thrown away:
+int netlink_reap_acks(xripd_settings_t *xripd_settings, netlink_ack_t *acks, int max, int *lost);
+
+// Is ipaddr (network order) directly reachable on our interface's subnet (and not ourselves)?
+int route_nexthop_onlink(const xripd_settings_t *xripd_settings, uint32_t ipaddr);
+
+// Gateway to install into the kernel for a remotely learnt route:
+// the RTE next hop if it is on-link, otherwise the router that advertised it (RFC 2453 4.4):
+uint32_t route_gateway(const xripd_settings_t *xripd_settings, const rib_entry_t *entry);
+
+// Next hop to place into our own advertisement of entry (0 = via ourselves):
+uint32_t route_advertised_nexthop(const xripd_settings_t *xripd_settings, const rib_entry_t *entry);
+
 // Helper translation functions between netmask and cidr:
 uint32_t cidr_to_netmask_netorder(int cidr);
 int netmask_to_cidr(uint32_t netmask);
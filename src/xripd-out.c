@@ -1,4 +1,11 @@
 #include "rib-out.h"
+#include "xripd-sched.h"
+
+// Paces our datagrams onto the wire:
+static xripd_sched_t update_sched;
+
+// Length of our current (jittered) update interval, periodic updates are spread across it:
+static uint64_t update_interval_ms = 0;
 
 // Fixed place in memory to hold a datagram:
 static uint8_t rip_update_datagram[RIP_DATAGRAM_SIZE];
@@ -65,28 +72,29 @@ failed_socket_init:
 	return 1;
 }
 
-// Send datagram onto the network:
-static int fire_ripv2_update_datagram(const xripd_settings_t *xripd_settings, const int n) {
+// Format dest as our RIPv2 multicast group address:
+static void format_mcast_address(struct sockaddr_in *dest) {
+
+	memset(dest, 0, sizeof(*dest));
+	dest->sin_family = AF_INET;
+	dest->sin_addr.s_addr = inet_addr(RIP_MCAST_IP);
+	dest->sin_port = htons(RIP_UDP_PORT);
+}
 
-	int ret = 0;
+// Hand our datagram to the scheduler, destined for dest (our multicast group, or a unicast requestor).
+// A send_time of 0 places it onto the wire as soon as the scheduler allows, otherwise it is part of a
+// periodic update and is held until send_time:
+static int fire_ripv2_update_datagram(const xripd_settings_t *xripd_settings, const int n, const struct sockaddr_in *dest, uint64_t send_time) {
 
 	// Calculate size of datagram
 	// Header + n * message entries:
 	int size = (sizeof(rip_msg_header_t)) + (n * sizeof(rip_msg_entry_t));
 
-	// Declare destination address:
-	struct sockaddr_in dest;
-
-	// Format address:
-	memset(&dest, 0, sizeof(dest));
-	dest.sin_family = AF_INET;
-	dest.sin_addr.s_addr = inet_addr(RIP_MCAST_IP);
-	dest.sin_port = htons(RIP_UDP_PORT);
-
-	ret = sendto(xripd_settings->sd, rip_update_datagram, size, 0, (struct sockaddr *) &dest, sizeof(dest));
-#if XRIPD_DEBUG == 1
-	fprintf(stderr, "[xripd-out]: Sent RIPv2 UPDATE Message to %s (%d bytes).\n", RIP_MCAST_IP, ret);
-#endif
+	if ( send_time == 0 ) {
+		sched_queue_immediate(&update_sched, dest, rip_update_datagram, size);
+	} else {
+		sched_queue_periodic(&update_sched, dest, rip_update_datagram, size, send_time);
+	}
 
 	// Reset our init datagram:
 	init_update_datagram();
@@ -105,238 +113,384 @@ static void increment_rip_msg_entry_metric(rib_entry_t *r) {
 	r->rip_msg_entry.metric = htonl(m);
 }
 
-// Given an input of a rib entry, and an entry_num, place the entry into a rip update datagram
-// Use the memory space allocated out of the static/global area of the exe
-// Place up to XRIPD_ENTRIES_PER_UPDATE entries into a single datagram
-// If force_send is set, fire off the datagram immediately
-static int format_ripv2_update_datagram(const xripd_settings_t *xripd_settings, const int entry_num, rib_entry_t *rib_entry, int force_send) {
-
-	// Offset for packing rip_msg_entry_t's into the rip datagram:
-	int offset = 0;
-	if ( entry_num > 0 ) {
-		offset = (entry_num - 1) % XRIPD_ENTRIES_PER_UPDATE;
+// Growable set of routes, waiting to be placed onto the network:
+typedef struct route_buffer_t {
+	rib_entry_t *entries;
+	int count;
+	int size;
+} route_buffer_t;
+
+// Routes received so far in the current REPLY stream (full table dump):
+static route_buffer_t dump_routes;
+
+// Changed routes received via UNSOLICITED streams, held off until triggered_update_time:
+static route_buffer_t triggered_routes;
+static uint64_t triggered_update_time = 0; // Monotonic ms, 0 when no triggered update is pending
+
+// Append a copy of entry onto the end of our route buffer:
+static void route_buffer_append(route_buffer_t *rb, const rib_entry_t *entry) {
+
+	// Grow if required:
+	if ( rb->count == rb->size ) {
+		rb->size = (rb->size == 0) ? 16 : rb->size * 2;
+		rb->entries = (rib_entry_t *)realloc(rb->entries, rb->size * sizeof(rib_entry_t));
 	}
-#if XRIPD_DEBUG == 1
-	fprintf(stderr, "[xripd-out]: Packing RIP Message #%d into Datagram Position %d/%d\n", entry_num, offset + 1, XRIPD_ENTRIES_PER_UPDATE);
-#endif
-	// If the caller has *NOT* told us to force send the datagram:
-	if ( force_send == 0 ) {
 
-		// Increment metric safely:
-		increment_rip_msg_entry_metric(rib_entry);
+	memcpy(&(rb->entries[rb->count]), entry, sizeof(rib_entry_t));
+	rb->count++;
+}
+
+// Replace the buffered entry for the same prefix with entry, or append it if the prefix is not buffered.
+// Multiple changes to a prefix within the holdoff are batched into its latest state:
+static void route_buffer_update(route_buffer_t *rb, const rib_entry_t *entry) {
+
+	for ( int i = 0; i < rb->count; i++ ) {
+		if ( rb->entries[i].rip_msg_entry.ipaddr == entry->rip_msg_entry.ipaddr &&
+			rb->entries[i].rip_msg_entry.subnet == entry->rip_msg_entry.subnet ) {
+			memcpy(&(rb->entries[i]), entry, sizeof(rib_entry_t));
+			return;
+		}
+	}
+	route_buffer_append(rb, entry);
+}
+
+static void route_buffer_clear(route_buffer_t *rb) {
+	rb->count = 0;
+}
+
+// Should we place this route onto the wire?
+// If Split Horizon logic is enabled, only advertise ORIGIN_LOCAL routes
+// We can make this assumption based on the logic that xripd only supports 1 interface
+// If it is ever extended to support 1+ interfaces, actual split horizon logic
+// will need to be implemented:
+static int advertise_route(const rib_entry_t *entry) {
+
+	if ( RIP_SPLIT_HORIZON_ENABLE ) {
+		return ( entry->origin == RIB_ORIGIN_LOCAL );
+	}
+	return 1;
+}
+
+// Pack every route held in rb into RIPv2 RESPONSE datagrams destined for dest
+// Use the memory space allocated out of the static/global area of the exe
+// Place up to XRIPD_ENTRIES_PER_UPDATE entries into a single datagram, firing each datagram as it fills.
+// If spread_ms is non-zero, the datagrams are spaced evenly across spread_ms, rather than sent back to back:
+static void send_route_buffer(const xripd_settings_t *xripd_settings, const route_buffer_t *rb, const struct sockaddr_in *dest, uint64_t spread_ms) {
+
+	int packed = 0;
+	rib_entry_t entry;
+	uint8_t *update = rip_update_datagram;
+
+	// Spacing between each of our datagrams:
+	int datagrams = (rb->count + XRIPD_ENTRIES_PER_UPDATE - 1) / XRIPD_ENTRIES_PER_UPDATE;
+	uint64_t spacing = (spread_ms > 0 && datagrams > 0) ? (spread_ms / datagrams) : 0;
+	uint64_t send_time = (spread_ms > 0) ? sched_now_ms() : 0;
+
+	for ( int i = 0; i < rb->count; i++ ) {
+
+		// Increment metric safely, on our own copy:
+		memcpy(&entry, &(rb->entries[i]), sizeof(rib_entry_t));
+		increment_rip_msg_entry_metric(&entry);
 
 		// Pointer magic
 		// Copy rib_entry into the appropriate space within the datagram
-		uint8_t *update = rip_update_datagram;
-		memcpy((update + ((sizeof(rip_msg_header_t) + (offset * sizeof(rip_msg_entry_t))))), 
-				&(rib_entry->rip_msg_entry), sizeof(rip_msg_entry_t));
+		memcpy((update + ((sizeof(rip_msg_header_t) + (packed * sizeof(rip_msg_entry_t))))), 
+				&(entry.rip_msg_entry), sizeof(rip_msg_entry_t));
+		packed++;
 
-		// Pack up to XRIPD_ENTRIES_PER_UPDATE into a single datagram, if we have hit the limit, fire the packet
-		// onto the network:
-		if ( (entry_num != 0 ) && (entry_num % XRIPD_ENTRIES_PER_UPDATE == 0) ) {
+		if ( packed == XRIPD_ENTRIES_PER_UPDATE ) {
 #if XRIPD_DEBUG == 1
-			fprintf(stderr, "[xripd-out]: Datagram full of entries (%d/%d). Preparing to send RIPv2 UPDATE Message.\n", offset + 1, XRIPD_ENTRIES_PER_UPDATE);
+			fprintf(stderr, "[xripd-out]: Datagram full of entries (%d/%d). Preparing to send RIPv2 UPDATE Message.\n", packed, XRIPD_ENTRIES_PER_UPDATE);
 #endif
-			fire_ripv2_update_datagram(xripd_settings, offset + 1);
+			fire_ripv2_update_datagram(xripd_settings, packed, dest, send_time);
+			packed = 0;
+			if ( send_time != 0 ) {
+				send_time += spacing;
+			}
 		}
+	}
 
-	// Caller has asked us to sent the datagram onto the network regardless, send it:
-	} else if ( force_send == 1 ) {
-
-		if ( entry_num != 1 ) {
+	// Send whatever remains:
+	if ( packed > 0 ) {
 #if XRIPD_DEBUG == 1
-			fprintf(stderr, "[xripd-out]: Datagram not full (%d/%d). Force sending RIPv2 UPDATE Message.\n", offset + 1, XRIPD_ENTRIES_PER_UPDATE);
+		fprintf(stderr, "[xripd-out]: Datagram not full (%d/%d). Force sending RIPv2 UPDATE Message.\n", packed, XRIPD_ENTRIES_PER_UPDATE);
 #endif
-			fire_ripv2_update_datagram(xripd_settings, offset + 1);
-		}
+		fire_ripv2_update_datagram(xripd_settings, packed, dest, send_time);
 	}
-	return 0;
 }
 
-// If we've got here, we've recieved some data on our sun_addresses->socketfd, time to parse this data:
+// If we've got here, we've recieved some data on our sun_addresses->socketfd, time to parse this data.
+// Read every datagram waiting on the socket, and dispatch on the message type. Streams may span
+// several calls, so their state is kept in dump_routes/triggered_routes:
 static void parse_rib_ctl_msgs(const xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses){
 
 	int len = 0; // Length of data: 
-	int recv_count = 0; // Count of recieved messages:
-	int send_count = 0; // Count of messages to send onto network
 
-	struct rib_ctl_reply {
+	// Any message the rib may send us:
+	union {
 		rib_ctl_hdr_t header;
-		rib_entry_t entry;
-	} ctl_reply;
-
-	// Number of times we've tried to read from our socket to complete a stream
-	// This is to account for out-of-order packets (with interspersed PREEMPT messages)
-	int retry_count = 0;
-	// Amount of times we will retry to read the stream correctly before giving up.
-	const int max_retries = 3; 
-
-	// Create buffer for a single datagram
-	char *buf = (char *)malloc(sizeof(ctl_reply));
-	memset(buf, 0, sizeof(ctl_reply));
-
-	// Pointer to a ctl header, used for parsing our recieved data:
-	struct rib_ctl_hdr_t *header;
-
-	// Read in a full reply's worth of data:
-	len = read(sun_addresses->socketfd, buf, sizeof(ctl_reply));
-
-	// Parse our header, make sure it's not malformed:
-	if ( len >= sizeof(rib_ctl_hdr_t) ) {
-
-		// Let's first look at the header:
-		header = (rib_ctl_hdr_t *)buf;
+		rib_ctl_reply_t reply;
+		rib_ctl_request_t endreply;
+		rib_ctl_lookup_t lookup;
+		rib_ctl_endunsolicited_t endunsolicited;
+	} ctl_msg;
+
+	// Answers to a LOOKUP, sent in one go:
+	route_buffer_t lookup_routes;
+	rib_entry_t lookup_entry;
+	memset(&lookup_routes, 0, sizeof(lookup_routes));
+	memset(&lookup_entry, 0, sizeof(lookup_entry));
+
+	while ( (len = recv(sun_addresses->socketfd, &ctl_msg, sizeof(ctl_msg), MSG_DONTWAIT)) > 0 ) {
+
+		// Make sure our header is not malformed:
+		if ( len < sizeof(rib_ctl_hdr_t) ) {
+			continue;
+		}
 
-		// If not version 1, bomb out:
-		if ( header->version != RIB_CTL_HDR_VERSION_1 ) {          
+		// If not version 1, ignore:
+		if ( ctl_msg.header.version != RIB_CTL_HDR_VERSION_1 ) {          
 			fprintf(stderr, "[xripd-out]: Received Unsupported Version.\n"); 
-			goto error_unsupported;
+			continue;
 		} 
 
 		// Parse the msg type:
-		switch (header->msgtype) {
+		switch (ctl_msg.header.msgtype) {
 
-			// First packet recieved was a start of REPLY stream, let's continue to read until we
-			// hit a RIB_CTL_HDR_MSGTYPE_ENDREPLY message:
+			// Part of a full table dump, hold onto the route until ENDREPLY:
 			case RIB_CTL_HDR_MSGTYPE_REPLY:
+				if ( len >= sizeof(rib_ctl_reply_t) && advertise_route(&(ctl_msg.reply.entry)) ) {
+					route_buffer_append(&dump_routes, &(ctl_msg.reply.entry));
+				}
+				break;
 
-				// Retry a few times until we abandon parsing:
-				while ( retry_count != max_retries ) {
-					
-					// Ensure that the datagram that we recieved first is the correct size and that
-					// it is a reply message (redundant on first pass, but important for secondary passes):
-					while ( len >= sizeof(ctl_reply) && 
-						header->msgtype == RIB_CTL_HDR_MSGTYPE_REPLY ) {
-
-						// Increment our received count:
-						recv_count++;
+			// End of our dump, place it onto the network.
+			// Our periodic (multicast) update is paced across the update interval, a unicast dump
+			// to a requestor is sent straight away:
+			case RIB_CTL_HDR_MSGTYPE_ENDREPLY:
+				if ( len < sizeof(rib_ctl_request_t) ) {
+					route_buffer_clear(&dump_routes);
+					break;
+				}
 #if XRIPD_DEBUG == 1
-						fprintf(stderr, "[xripd-out]: Received RIB_CTRL_MSGTYPE_REPLY No# %d\n", recv_count);
+				fprintf(stderr, "[xripd-out]: Successfully received RIB_CTRL_MSGTYPE_ENDREPLY\n");
+				fprintf(stderr, "[xripd-out]: Route Count to Advertise: %d\n", dump_routes.count);
 #endif
-						// Cast our buffer as a ctl_reply, and send the rib_entry_t to the
-						// handler function to pack it into our static rip_datagram variable
-						// Function may or may not place the packet onto the wire
-						ctl_reply = (*(struct rib_ctl_reply *)buf);
-
-						// If Split Horizon logic is enabled, only advertise ORIGIN_LOCAL routes
-						// We can make this assumption based on the logic that xripd only supports 1 interface
-						// If it is ever extended to support 1+ interfaces, actual split horizon logic
-						// will need to be implemented:
-						if ( RIP_SPLIT_HORIZON_ENABLE ) {
-							if ( ctl_reply.entry.origin == RIB_ORIGIN_LOCAL ) {
-								send_count++;
-								format_ripv2_update_datagram(xripd_settings, recv_count, &(ctl_reply.entry), 0);
-							}
-						// If split horizon isnt enabled, place the route onto the network anyway:
-						} else {
-							send_count++;
-							format_ripv2_update_datagram(xripd_settings, recv_count, &(ctl_reply.entry), 0);
-						}
-				
-						// Read next packet, look at the header, and increment our count:
-						len = read(sun_addresses->socketfd, buf, sizeof(ctl_reply));
-						header = (rib_ctl_hdr_t *)buf;
+				if ( IN_MULTICAST(ntohl(ctl_msg.endreply.reply_to.sin_addr.s_addr)) ) {
+					// Anything left of our last periodic update is superseded by this one:
+					uint32_t unsent = sched_flush_periodic(&update_sched);
+					if ( unsent > 0 ) {
+						fprintf(stderr, "[xripd-out]: Warning, %u datagram(s) of the last update were never sent. Pacing rate is too low for the table size.\n", unsent);
 					}
+					send_route_buffer(xripd_settings, &dump_routes, &(ctl_msg.endreply.reply_to), update_interval_ms);
+				} else {
+					send_route_buffer(xripd_settings, &dump_routes, &(ctl_msg.endreply.reply_to), 0);
+				}
+				route_buffer_clear(&dump_routes);
+				break;
 
-					// ENDREPLY message recieved to signify end of stream:
-					if ( len >= sizeof(rib_ctl_hdr_t) && header->msgtype == RIB_CTL_HDR_MSGTYPE_ENDREPLY ) {
+			// Changed route, batch it into our pending triggered update:
+			case RIB_CTL_HDR_MSGTYPE_UNSOLICITED:
+				if ( len >= sizeof(rib_ctl_reply_t) && advertise_route(&(ctl_msg.reply.entry)) ) {
+					route_buffer_update(&triggered_routes, &(ctl_msg.reply.entry));
+				}
+				break;
+
+			// Answer to specific entries of a RIPv2 REQUEST, unicast straight back to the requestor.
+			// Split horizon is not applied, the requestor is assumed to be diagnostic:
+			case RIB_CTL_HDR_MSGTYPE_LOOKUPREPLY:
+				if ( len < sizeof(rib_ctl_lookup_t) ) {
+					break;
+				}
+				route_buffer_clear(&lookup_routes);
+				for ( int i = 0; i < ctl_msg.lookup.count && i < RIP_MAX_ENTRIES; i++ ) {
+					memcpy(&(lookup_entry.rip_msg_entry), &(ctl_msg.lookup.entries[i]), sizeof(rip_msg_entry_t));
+					route_buffer_append(&lookup_routes, &lookup_entry);
+				}
 #if XRIPD_DEBUG == 1
-						fprintf(stderr, "[xripd-out]: Successfully received RIB_CTRL_MSGTYPE_ENDREPLY\n");
-						fprintf(stderr, "[xripd-out]: Route Count Received: %d\n", recv_count);
+				fprintf(stderr, "[xripd-out]: Answering RIPv2 REQUEST for %d entries from %s.\n", 
+						lookup_routes.count, inet_ntoa(ctl_msg.lookup.reply_to.sin_addr));
 #endif
-						format_ripv2_update_datagram(xripd_settings, send_count, NULL, 1);
-						retry_count = max_retries;
+				send_route_buffer(xripd_settings, &lookup_routes, &(ctl_msg.lookup.reply_to), 0);
+				break;
 
-					// We've recieved something unexpected, let's try again to either read more REPLY messages
-					// or an ENDREPLY:
-					} else {
+			// End of the changed routes. Start our holdoff if one is not already running,
+			// further changes until then are sent in the same update:
+			case RIB_CTL_HDR_MSGTYPE_ENDUNSOLICITED:
+				// Urgent changes (lost link/address) go out straight away, along with anything already held off:
+				if ( triggered_routes.count > 0 && len >= sizeof(rib_ctl_endunsolicited_t) && ctl_msg.endunsolicited.urgent ) {
+					triggered_update_time = sched_now_ms();
 #if XRIPD_DEBUG == 1
-						fprintf(stderr, "[xripd-out]: ENDREPLY not Recieved, Ignoring packet.\n");
-						fprintf(stderr, "[xripd-out]: Waiting further.%d\n", send_count);
+					fprintf(stderr, "[xripd-out]: Urgent triggered update, skipping holdoff.\n");
+#endif
+				} else if ( triggered_routes.count > 0 && triggered_update_time == 0 ) {
+					triggered_update_time = sched_now_ms() + (RIP_TRIGGERED_HOLDOFF_MIN * 1000) + 
+						(rand() % (((RIP_TRIGGERED_HOLDOFF_MAX - RIP_TRIGGERED_HOLDOFF_MIN) * 1000) + 1));
+#if XRIPD_DEBUG == 1
+					fprintf(stderr, "[xripd-out]: Triggered update scheduled in %llu ms.\n", 
+							(unsigned long long)(triggered_update_time - sched_now_ms()));
 #endif
-						len = read(sun_addresses->socketfd, buf, sizeof(ctl_reply));
-						retry_count++;
-					}
 				}
+				break;
+
 			default:
 				break;
 		}
 	}
 
-error_unsupported:
-	free(buf);
+	free(lookup_routes.entries);
 }
 
-// Generate and send rib ctl REQUEST message to rib process via Abstract Unix Domain Socket:
-static void send_ctl_request(const xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses) {
+// Generate and send rib ctl REQUEST (or REQUESTALL) message to rib process via Abstract Unix Domain Socket.
+// The rib's dump will be sent onto the network to reply_to:
+static void send_ctl_request(const xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses, uint8_t msgtype, const struct sockaddr_in *reply_to) {
 
-	// Create Header on Stack:
-	rib_ctl_hdr_t rib_control_header;
-	rib_control_header.version = RIB_CTL_HDR_VERSION_1;
-	rib_control_header.msgtype = RIB_CTL_HDR_MSGTYPE_REQUEST;
+	// Create Request on Stack:
+	rib_ctl_request_t rib_control_request;
+	memset(&rib_control_request, 0, sizeof(rib_control_request));
+	rib_control_request.header.version = RIB_CTL_HDR_VERSION_1;
+	rib_control_request.header.msgtype = msgtype;
+	memcpy(&(rib_control_request.reply_to), reply_to, sizeof(struct sockaddr_in));
 
 	// Fire off request to rib process:
 #if XRIPD_DEBUG == 1
-	fprintf(stderr, "[xripd-out]: Sending RIB_CTRL_MSGTYPE_REQUEST to xripd-rib.\n");
+	fprintf(stderr, "[xripd-out]: Sending RIB_CTRL_MSGTYPE_REQUEST (%02X) to xripd-rib.\n", msgtype);
 #endif
-	sendto(sun_addresses->socketfd, &rib_control_header, sizeof(rib_control_header), 
+	sendto(sun_addresses->socketfd, &rib_control_request, sizeof(rib_control_request), 
 		0, (struct sockaddr *) &(sun_addresses->sockaddr_un_rib), sizeof(struct sockaddr_un));
 }
 
+// Generate and send a rib ctl LOOKUP message for the specific entries of a RIPv2 REQUEST:
+static void send_ctl_lookup(const xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses, const xripd_request_t *request) {
+
+	rib_ctl_lookup_t rib_control_lookup;
+	memset(&rib_control_lookup, 0, sizeof(rib_control_lookup));
+	rib_control_lookup.header.version = RIB_CTL_HDR_VERSION_1;
+	rib_control_lookup.header.msgtype = RIB_CTL_HDR_MSGTYPE_LOOKUP;
+	memcpy(&(rib_control_lookup.reply_to), &(request->request_from), sizeof(struct sockaddr_in));
+	rib_control_lookup.count = request->count;
+	memcpy(rib_control_lookup.entries, request->entries, request->count * sizeof(rip_msg_entry_t));
+
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[xripd-out]: Sending RIB_CTRL_MSGTYPE_LOOKUP for %d entries to xripd-rib.\n", request->count);
+#endif
+	sendto(sun_addresses->socketfd, &rib_control_lookup, sizeof(rib_control_lookup), 
+		0, (struct sockaddr *) &(sun_addresses->sockaddr_un_rib), sizeof(struct sockaddr_un));
+}
+
+// Answer any RIPv2 REQUEST messages queued up by the listener:
+static void process_request_queue(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses) {
+
+	xripd_request_t requests[XRIPD_REQUEST_QUEUE_SIZE];
+	int request_count = 0;
+
+	// Take our requests off the queue, hold the lock only for the copy:
+	pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_request_queue));
+	request_count = xripd_settings->daemon_shared.request_count;
+	memcpy(requests, xripd_settings->daemon_shared.request_queue, request_count * sizeof(xripd_request_t));
+	xripd_settings->daemon_shared.request_count = 0;
+	pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_request_queue));
+
+	for ( int i = 0; i < request_count; i++ ) {
+
+		// Whole table, unicast our entire (split horizoned) table back to the requestor:
+		if ( requests[i].whole_table ) {
+#if XRIPD_DEBUG == 1
+			fprintf(stderr, "[xripd-out]: Whole table REQUEST from %s:%d.\n", 
+					inet_ntoa(requests[i].request_from.sin_addr), ntohs(requests[i].request_from.sin_port));
+#endif
+			send_ctl_request(xripd_settings, sun_addresses, RIB_CTL_HDR_MSGTYPE_REQUESTALL, &(requests[i].request_from));
+
+		// Specific entries, lookup each in the rib:
+		} else {
+			send_ctl_lookup(xripd_settings, sun_addresses, &(requests[i]));
+		}
+	}
+}
+
 // Main control loop:
 static void main_loop(xripd_settings_t *xripd_settings, const sun_addresses_t *sun_addresses){
 
-	// Used to calculate when to generate the next rib ctl REQUEST message:
-	time_t next_request_time = 0;
+	// Used to calculate when to generate the next rib ctl REQUEST message (monotonic ms):
+	uint64_t next_request_time = 0;
+	uint64_t now = 0;
+
+	// Our regular updates are multicast:
+	struct sockaddr_in mcast_address;
+	format_mcast_address(&mcast_address);
 
 	// select() variables:
 	fd_set readfds; // Set of file descriptors (in our case, only one) for select() to watch for
 	struct timeval timeout; // Time to wait for data in our select()ed socket
 	int sret; // select() return value
+	int64_t wait_ms; // How long to wait in select()
+	int sched_wait_ms; // How long until the scheduler wants to run again
 
 	// Init our statically allocated datagram:
 	init_update_datagram();
 
 	while (1) {
 
-		// Generate and send rib ctl REQUEST message to rib process:
-		send_ctl_request(xripd_settings, sun_addresses);
-
-		// Calculate time to send next request:
-		next_request_time  = time(NULL) + xripd_settings->rip_timers.route_update;
+		now = sched_now_ms();
 
-		// While we dont need to send a new request:
-		while (time(NULL) < next_request_time) {
+		// Time for our periodic update:
+		if ( now >= next_request_time ) {
 
-                        // Wipe our set of fds, and monitor our input pipe descriptor:
-                        FD_ZERO(&readfds); 
-                        FD_SET(sun_addresses->socketfd, &readfds); 
+			// Generate and send rib ctl REQUEST message to rib process:
+			send_ctl_request(xripd_settings, sun_addresses, RIB_CTL_HDR_MSGTYPE_REQUEST, &mcast_address);
 
-			// Sleep for a second:
-                        timeout.tv_sec = 1;
-                        timeout.tv_usec = 0;
+			// Any pending triggered update is kept. Our regular update is paced across the whole interval,
+			// and never carries the withdrawal of a route our filter now denies:
 
-                        // Wait up to a second for a msg entry to come in
-                        sret = select(sun_addresses->socketfd + 1, &readfds, NULL, NULL, &timeout);
-	
-			// Got a message, now let's parse it:
-			if (sret > 0) {
-				parse_rib_ctl_msgs(xripd_settings, sun_addresses);
-			}
+			// Calculate time to send next request, jittered so routers on our segment do not synchronise:
+			update_interval_ms = sched_jitter_interval_ms(xripd_settings->rip_timers.route_update);
+			next_request_time = now + update_interval_ms;
+		}
 
-			// Access shared memory from parent (daemon) thread. If it's recently received a 
-			// RIPv2 REQUEST Message, it will set the flag to 1.
-			// If the valuie is one, send a rib_ctl message to the daemon to do a full routing table
-			// dump, and then reset back to zero
-			pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_request_flag));
-			if ( xripd_settings->daemon_shared.request_flag == 1 ) {
+		// Triggered update holdoff has expired, send our batch of changed routes:
+		if ( triggered_update_time != 0 && now >= triggered_update_time ) {
 #if XRIPD_DEBUG == 1
-				fprintf(stderr, "[xripd-out]: request_flag was set to 1 by daemon. Dumping Rib ...\n");
+			fprintf(stderr, "[xripd-out]: Sending triggered update for %d changed route(s).\n", triggered_routes.count);
 #endif
-				send_ctl_request(xripd_settings, sun_addresses);
-				xripd_settings->daemon_shared.request_flag = 0;
-			}
-			pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_request_flag));
+			send_route_buffer(xripd_settings, &triggered_routes, &mcast_address, 0);
+			route_buffer_clear(&triggered_routes);
+			triggered_update_time = 0;
+		}
+
+		// Access shared memory from parent (daemon) thread. Answer any RIPv2 REQUEST
+		// messages it has queued for us:
+		process_request_queue(xripd_settings, sun_addresses);
+
+		// Place whatever is due onto the wire:
+		sched_wait_ms = sched_run(&update_sched, xripd_settings->sd);
+
+		// Sleep until our next event, at most a second (to pick up queued REQUESTs):
+		wait_ms = next_request_time - now;
+		if ( triggered_update_time != 0 && (int64_t)(triggered_update_time - now) < wait_ms ) {
+			wait_ms = triggered_update_time - now;
+		}
+		if ( sched_wait_ms >= 0 && sched_wait_ms < wait_ms ) {
+			wait_ms = sched_wait_ms;
+		}
+		if ( wait_ms > 1000 ) {
+			wait_ms = 1000;
+		}
+		if ( wait_ms < 0 ) {
+			wait_ms = 0;
+		}
+
+		// Wipe our set of fds, and monitor our input pipe descriptor:
+		FD_ZERO(&readfds); 
+		FD_SET(sun_addresses->socketfd, &readfds); 
+
+		timeout.tv_sec = wait_ms / 1000;
+		timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+		sret = select(sun_addresses->socketfd + 1, &readfds, NULL, NULL, &timeout);
+
+		// Got a message, now let's parse it:
+		if (sret > 0) {
+			parse_rib_ctl_msgs(xripd_settings, sun_addresses);
 		}
 	}
 }
@@ -350,6 +504,12 @@ void *xripd_out_spawn(void *xripd_settings) {
 	sun_addresses_t sun_addresses;
 	memset(&sun_addresses, 0, sizeof(sun_addresses));
 
+	// Seed our triggered update holdoff and update interval jitter:
+	srand(time(NULL) ^ getpid());
+
+	// Init our scheduler, with our pacing limits:
+	sched_init(&update_sched, ((xripd_settings_t *)xripd_settings)->pace_rate, ((xripd_settings_t *)xripd_settings)->pace_burst);
+
 	// Create our abstract UNIX Domain Socket:
 	if ( init_abstract_unix_socket(&sun_addresses) != 0 ) {
 		fprintf(stderr, "[xripd-out]: Failed to bind to Abstract UNIX Domain Socket: \\0xripd-daemon.\n");
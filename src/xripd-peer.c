@@ -0,0 +1,153 @@
+#include "xripd-peer.h"
+
+// Our peers, only used from the listener thread:
+static xripd_peer_t *peer_hash[XRIPD_PEER_HASH_SIZE];
+static uint32_t peer_count = 0;
+
+// Our policer, route entries/sec (0 = unpoliced) and burst:
+static uint32_t police_rate = 0;
+static uint32_t police_burst = 0;
+
+static void xripd_peer_report_one(xripd_peer_t *peer, time_t now);
+
+// Hash a source address into a bucket:
+static uint32_t xripd_peer_hash(uint32_t addr) {
+	return (addr * 2654435761u) % XRIPD_PEER_HASH_SIZE;
+}
+
+// Unlink and free the peer at *link, first reporting anything it has yet to:
+static void xripd_peer_free(xripd_peer_t **link, time_t now) {
+
+	xripd_peer_t *peer = *link;
+
+	peer->next_report = 0;
+	xripd_peer_report_one(peer, now);
+	*link = peer->next;
+	free(peer);
+	peer_count--;
+}
+
+// Our table is full, make room by dropping the peer we have heard from least recently:
+static void xripd_peer_evict(time_t now) {
+
+	xripd_peer_t **link;
+	xripd_peer_t **oldest = NULL;
+
+	for ( int bucket = 0; bucket < XRIPD_PEER_HASH_SIZE; bucket++ ) {
+		for ( link = &(peer_hash[bucket]); *link != NULL; link = &((*link)->next) ) {
+			if ( oldest == NULL || (*link)->last_heard < (*oldest)->last_heard ) {
+				oldest = link;
+			}
+		}
+	}
+	if ( oldest != NULL ) {
+		xripd_peer_free(oldest, now);
+	}
+}
+
+// Find the peer for a source address, creating it if we haven't heard from it before:
+xripd_peer_t *xripd_peer_lookup(uint32_t addr, time_t now) {
+
+	uint32_t bucket = xripd_peer_hash(addr);
+	xripd_peer_t *peer = peer_hash[bucket];
+
+	while ( peer != NULL ) {
+		if ( peer->addr == addr ) {
+			peer->last_heard = now;
+			return peer;
+		}
+		peer = peer->next;
+	}
+
+	if ( peer_count >= XRIPD_PEER_MAX ) {
+		xripd_peer_evict(now);
+	}
+
+	peer = (xripd_peer_t *)malloc(sizeof(xripd_peer_t));
+	memset(peer, 0, sizeof(xripd_peer_t));
+	peer->addr = addr;
+	peer->last_heard = now;
+	peer->tokens = police_burst;
+	peer->last_refill = sched_now_ms();
+	peer->next = peer_hash[bucket];
+	peer_hash[bucket] = peer;
+	peer_count++;
+
+	return peer;
+}
+
+// Set the rate and burst each peer is policed to:
+void xripd_peer_police_init(uint32_t rate, uint32_t burst) {
+
+	police_rate = rate;
+	police_burst = burst;
+}
+
+// Police count route entries from a peer through its token bucket (as our scheduler's, see xripd-sched.c):
+uint32_t xripd_peer_police(xripd_peer_t *peer, uint32_t count) {
+
+	uint64_t now = sched_now_ms();
+	uint32_t allowed = count;
+
+	if ( police_rate == 0 ) {
+		return count;
+	}
+
+	// Top up for the time elapsed since our last refill:
+	peer->tokens += ((double)(now - peer->last_refill) * police_rate) / 1000.0;
+	if ( peer->tokens > police_burst ) {
+		peer->tokens = police_burst;
+	}
+	peer->last_refill = now;
+
+	if ( peer->tokens < count ) {
+		allowed = (uint32_t)peer->tokens;
+		peer->rtes_policed += count - allowed;
+	}
+	peer->tokens -= allowed;
+
+	return allowed;
+}
+
+// Report a peer if it has had routes filtered or policed since its last report:
+static void xripd_peer_report_one(xripd_peer_t *peer, time_t now) {
+
+	char addr[16];
+
+	if ( (peer->rtes_filtered == peer->rtes_filtered_reported && peer->rtes_policed == peer->rtes_policed_reported) ||
+		now < peer->next_report ) {
+		return;
+	}
+	inet_ntop(AF_INET, &(peer->addr), addr, sizeof(addr));
+	if ( peer->rtes_filtered != peer->rtes_filtered_reported ) {
+		fprintf(stderr, "[daemon]: Filtered %llu of %llu route(s) from %s (+%llu since last report).\n",
+				(unsigned long long)peer->rtes_filtered, (unsigned long long)peer->rtes_received, addr,
+				(unsigned long long)(peer->rtes_filtered - peer->rtes_filtered_reported));
+	}
+	if ( peer->rtes_policed != peer->rtes_policed_reported ) {
+		fprintf(stderr, "[daemon]: Policed %llu of %llu route(s) from %s, over its rate of %u/sec (+%llu since last report).\n",
+				(unsigned long long)peer->rtes_policed, (unsigned long long)peer->rtes_received, addr, police_rate,
+				(unsigned long long)(peer->rtes_policed - peer->rtes_policed_reported));
+	}
+	peer->rtes_filtered_reported = peer->rtes_filtered;
+	peer->rtes_policed_reported = peer->rtes_policed;
+	peer->next_report = now + XRIPD_PEER_REPORT_INTERVAL;
+}
+
+// Report peers that have had routes filtered or policed since their last report, and forget those gone idle:
+void xripd_peer_report(time_t now) {
+
+	xripd_peer_t **link;
+
+	for ( int bucket = 0; bucket < XRIPD_PEER_HASH_SIZE; bucket++ ) {
+		link = &(peer_hash[bucket]);
+		while ( *link != NULL ) {
+			if ( now - (*link)->last_heard > XRIPD_PEER_IDLE ) {
+				xripd_peer_free(link, now);
+				continue;
+			}
+			xripd_peer_report_one(*link, now);
+			link = &((*link)->next);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef XRIPD_PEER_H
+#define XRIPD_PEER_H
+
+#include "xripd.h"
+#include "xripd-sched.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+
+// Buckets in our source address -> peer hash, and the most peers we keep state for
+// (past that, a new source takes the place of the peer we have heard from least recently):
+#define XRIPD_PEER_HASH_SIZE 64
+#define XRIPD_PEER_MAX 256
+
+// Seconds without a RESPONSE before we forget a peer (well past RIP's own timeout of its routes):
+#define XRIPD_PEER_IDLE 300
+
+// Minimum interval (seconds) between reports of a peer's filtered route count:
+#define XRIPD_PEER_REPORT_INTERVAL 60
+
+// What the daemon knows of each source of RIPv2 RESPONSEs (our neighbours).
+// Only used from the listener thread:
+typedef struct xripd_peer_t {
+	uint32_t addr; // Source address (network order)
+	time_t last_heard;
+	uint64_t rtes_received; // Route entries received
+	uint64_t rtes_filtered; // Of which denied by our filter, never sent on to the rib
+	uint64_t rtes_filtered_reported; // rtes_filtered as of our last report
+	uint64_t rtes_policed; // Of which dropped by our policer, over the rate this peer may send at
+	uint64_t rtes_policed_reported; // rtes_policed as of our last report
+	double tokens; // Policer token bucket, in route entries
+	uint64_t last_refill; // ms, monotonic
+	time_t next_report;
+	struct xripd_peer_t *next;
+} xripd_peer_t;
+
+// Find the peer for a source address, creating it if we haven't heard from it before:
+xripd_peer_t *xripd_peer_lookup(uint32_t addr, time_t now);
+
+// Set the rate (route entries/sec, 0 = unpoliced) and burst each peer is policed to:
+void xripd_peer_police_init(uint32_t rate, uint32_t burst);
+
+// Police count route entries from a peer through its token bucket.
+// Returns how many of them (the first) are within its rate, the rest are counted in rtes_policed:
+uint32_t xripd_peer_police(xripd_peer_t *peer, uint32_t count);
+
+// Report peers that have had routes filtered or policed since their last report (at most every XRIPD_PEER_REPORT_INTERVAL),
+// and forget peers we haven't heard from for XRIPD_PEER_IDLE:
+void xripd_peer_report(time_t now);
+
+#endif
@@ -0,0 +1,150 @@
+#include "xripd-sched.h"
+
+// Current monotonic time in milliseconds:
+uint64_t sched_now_ms(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+// Offset our update interval by a small random amount each time it is set, so that
+// routers on the same segment do not drift into sync (RFC 2453 3.8 uses 30s +/- 5s):
+uint64_t sched_jitter_interval_ms(uint16_t interval) {
+
+	uint64_t interval_ms = (uint64_t)interval * 1000;
+	uint64_t jitter_ms = interval_ms / 6;
+
+	if ( jitter_ms == 0 ) {
+		return interval_ms;
+	}
+	return (interval_ms - jitter_ms) + (rand() % ((2 * jitter_ms) + 1));
+}
+
+void sched_init(xripd_sched_t *sched, uint16_t rate, uint16_t burst) {
+
+	memset(sched, 0, sizeof(*sched));
+	sched->rate = rate;
+	sched->burst = (burst > 0) ? burst : 1;
+
+	// Start with a full bucket:
+	sched->tokens = sched->burst;
+	sched->last_refill = sched_now_ms();
+}
+
+// Allocate a copy of our datagram, and join onto the end of queue q:
+static void sched_queue_append(sched_queue_t *q, const struct sockaddr_in *dest, const uint8_t *data, uint16_t len, uint64_t send_time) {
+
+	if ( len > RIP_DATAGRAM_SIZE ) {
+		return;
+	}
+
+	sched_datagram_t *d = (sched_datagram_t *)malloc(sizeof(sched_datagram_t));
+	memset(d, 0, sizeof(*d));
+	memcpy(&(d->dest), dest, sizeof(struct sockaddr_in));
+	memcpy(d->data, data, len);
+	d->len = len;
+	d->send_time = send_time;
+	d->next = NULL;
+
+	if ( q->tail == NULL ) {
+		q->head = d;
+	} else {
+		q->tail->next = d;
+	}
+	q->tail = d;
+	q->count++;
+}
+
+// Pop the head of queue q, caller frees:
+static sched_datagram_t *sched_queue_pop(sched_queue_t *q) {
+
+	sched_datagram_t *d = q->head;
+
+	if ( d != NULL ) {
+		q->head = d->next;
+		if ( q->head == NULL ) {
+			q->tail = NULL;
+		}
+		q->count--;
+	}
+	return d;
+}
+
+void sched_queue_immediate(xripd_sched_t *sched, const struct sockaddr_in *dest, const uint8_t *data, uint16_t len) {
+	sched_queue_append(&(sched->immediate), dest, data, len, 0);
+}
+
+void sched_queue_periodic(xripd_sched_t *sched, const struct sockaddr_in *dest, const uint8_t *data, uint16_t len, uint64_t send_time) {
+	sched_queue_append(&(sched->periodic), dest, data, len, send_time);
+}
+
+uint32_t sched_flush_periodic(xripd_sched_t *sched) {
+
+	uint32_t count = 0;
+	sched_datagram_t *d;
+
+	while ( (d = sched_queue_pop(&(sched->periodic))) != NULL ) {
+		free(d);
+		count++;
+	}
+	return count;
+}
+
+// Top up our token bucket for the time elapsed since the last refill:
+static void sched_refill(xripd_sched_t *sched, uint64_t now) {
+
+	if ( sched->rate == 0 ) {
+		return;
+	}
+
+	sched->tokens += ((double)(now - sched->last_refill) * sched->rate) / 1000.0;
+	if ( sched->tokens > sched->burst ) {
+		sched->tokens = sched->burst;
+	}
+	sched->last_refill = now;
+}
+
+int sched_run(xripd_sched_t *sched, int sd) {
+
+	uint64_t now = sched_now_ms();
+	sched_queue_t *q;
+	sched_datagram_t *d;
+	int ret = 0;
+
+	sched_refill(sched, now);
+
+	while (1) {
+
+		// Immediate datagrams always go first, periodic datagrams only once due:
+		if ( sched->immediate.head != NULL ) {
+			q = &(sched->immediate);
+		} else if ( sched->periodic.head != NULL && sched->periodic.head->send_time <= now ) {
+			q = &(sched->periodic);
+		} else {
+			break;
+		}
+
+		// Out of tokens, wait for the bucket to refill:
+		if ( sched->rate != 0 && sched->tokens < 1.0 ) {
+			return (int)(((1.0 - sched->tokens) * 1000.0) / sched->rate) + 1;
+		}
+
+		d = sched_queue_pop(q);
+		ret = sendto(sd, d->data, d->len, 0, (struct sockaddr *) &(d->dest), sizeof(d->dest));
+#if XRIPD_DEBUG == 1
+		fprintf(stderr, "[sched]: Sent RIPv2 UPDATE Message to %s:%d (%d bytes).\n", inet_ntoa(d->dest.sin_addr), ntohs(d->dest.sin_port), ret);
+#endif
+		free(d);
+
+		if ( sched->rate != 0 ) {
+			sched->tokens -= 1.0;
+		}
+	}
+
+	// Nothing due, wake up for our next periodic datagram:
+	if ( sched->periodic.head != NULL ) {
+		return (int)(sched->periodic.head->send_time - now);
+	}
+	return -1;
+}
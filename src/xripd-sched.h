@@ -0,0 +1,73 @@
+#ifndef XRIPD_SCHED_H
+#define XRIPD_SCHED_H
+
+#include "xripd.h"
+
+// Standard Includes:
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+// Network Specific:
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// A datagram waiting to be placed onto the network:
+typedef struct sched_datagram_t {
+	struct sockaddr_in dest;
+	uint64_t send_time; // Monotonic time (ms) before which the datagram is not sent
+	uint16_t len;
+	uint8_t data[RIP_DATAGRAM_SIZE];
+	struct sched_datagram_t *next;
+} sched_datagram_t;
+
+// FIFO of datagrams:
+typedef struct sched_queue_t {
+	sched_datagram_t *head;
+	sched_datagram_t *tail;
+	uint32_t count;
+} sched_queue_t;
+
+// Update scheduler. Datagrams are paced onto the wire through a token bucket of
+// rate datagrams/sec (0 = unlimited), allowing bursts of up to burst datagrams:
+typedef struct xripd_sched_t {
+
+	// Triggered updates and unicast replies, sent as soon as the bucket allows:
+	sched_queue_t immediate;
+
+	// Periodic update, spread across the update interval:
+	sched_queue_t periodic;
+
+	// Token bucket:
+	uint16_t rate;
+	uint16_t burst;
+	double tokens;
+	uint64_t last_refill;
+
+} xripd_sched_t;
+
+// Current monotonic time in milliseconds:
+uint64_t sched_now_ms(void);
+
+// Return interval (seconds) in milliseconds, offset by a random +/- 1/6th of the interval (RFC 2453 3.8 jitter):
+uint64_t sched_jitter_interval_ms(uint16_t interval);
+
+// Init our scheduler with our token bucket parameters:
+void sched_init(xripd_sched_t *sched, uint16_t rate, uint16_t burst);
+
+// Copy a datagram onto the immediate queue:
+void sched_queue_immediate(xripd_sched_t *sched, const struct sockaddr_in *dest, const uint8_t *data, uint16_t len);
+
+// Copy a datagram onto the periodic queue, not to be sent before send_time:
+void sched_queue_periodic(xripd_sched_t *sched, const struct sockaddr_in *dest, const uint8_t *data, uint16_t len, uint64_t send_time);
+
+// Discard any periodic datagrams not yet sent (superseded by a new periodic update). Returns the number discarded:
+uint32_t sched_flush_periodic(xripd_sched_t *sched);
+
+// Send every datagram that is due, and permitted by the bucket, out of socket sd.
+// Returns the number of milliseconds until the scheduler next needs to run, or -1 if idle:
+int sched_run(xripd_sched_t *sched, int sd);
+
+#endif
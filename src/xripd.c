@@ -2,15 +2,22 @@
 #include "xripd-out.h"
 #include "rib.h"
 #include "route.h"
+#include "xripd-peer.h"
+
+// Offset of the RIP header within the skb seen by a UDP socket filter (skb->data points at the UDP header):
+#define XRIPD_BPF_RIP_OFFSET 8
+// Minimum interval (seconds) between reports of our socket's drop count, and the longest we block
+// in recvmsg() without picking it up:
+#define XRIPD_DROP_REPORT_INTERVAL 60
 
 // Given an interface name string, find and set our interface number (as indexed by the kernel).
 // Populate our xripd_settings_t struct with this index value
-static int get_iface_index(xripd_settings_t *xripd_settings, struct ifreq *ifrq) {
+static int get_iface_index(xripd_settings_t *xripd_settings, int sd, struct ifreq *ifrq) {
 
 	// Attempt to find interface index number of xripd_settings->iface_name
 	// If successful, interface index in ifrq->ifr_ifindex:
 	strcpy(ifrq->ifr_name, xripd_settings->iface_name);
-	if ( ioctl(xripd_settings->sd, SIOCGIFINDEX, ifrq) == -1) {
+	if ( ioctl(sd, SIOCGIFINDEX, ifrq) == -1) {
 		return 1;
 	} else {
 		xripd_settings->iface_index = ifrq->ifr_ifindex;
@@ -18,11 +25,147 @@ static int get_iface_index(xripd_settings_t *xripd_settings, struct ifreq *ifrq)
 	}
 }
 
-// Create our AF_INET SOCK_DGRAM listening socket:
-static int init_socket(xripd_settings_t *xripd_settings) {
+// Compile and attach a classic BPF filter onto our listening socket.
+// Datagrams that we would always ignore in xripd_listen_loop are dropped in the kernel, before
+// they wake us up or get copied into user space:
+//	+ Our own multicast looped back to us (source = self_ip)
+//	+ Anything that is not RIPv2
+//	+ Commands other than RESPONSE and REQUEST (and REQUEST too, when we are passive)
+static int attach_socket_filter(xripd_settings_t *xripd_settings) {
+
+	// BPF_ABS loads convert to host order, compare against a host order self ip:
+	uint32_t self_ip = ntohl(xripd_settings->self_ip.sin_addr.s_addr);
+
+	// Passive daemons ignore REQUEST messages, so let the kernel drop these as well:
+	uint32_t request_cmd = RIP_HEADER_REQUEST;
+	if ( xripd_settings->passive_mode == XRIPD_PASSIVE_MODE_ENABLE ) {
+		request_cmd = RIP_HEADER_RESPONSE;
+	}
+
+	struct sock_filter filter_code[] = {
+		// Source address of the IP header, drop if it is our own:
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, self_ip, 6, 0),
+
+		// RIP version, drop anything that is not RIPv2:
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, XRIPD_BPF_RIP_OFFSET + offsetof(rip_msg_header_t, version)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RIP_SUPPORTED_VERSION, 0, 4),
+
+		// RIP command, accept RESPONSE and (conditionally) REQUEST:
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, XRIPD_BPF_RIP_OFFSET + offsetof(rip_msg_header_t, command)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RIP_HEADER_RESPONSE, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, request_cmd, 0, 1),
+
+		// Accept (whole datagram):
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		// Drop:
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+
+	struct sock_fprog filter_prog = {
+		.len = sizeof(filter_code) / sizeof(filter_code[0]),
+		.filter = filter_code,
+	};
+
+	if ( setsockopt(xripd_settings->sd, SOL_SOCKET, SO_ATTACH_FILTER, &filter_prog, sizeof(filter_prog)) == -1 ) {
+		return 1;
+	}
+
+	return 0;
+}
+
+// Ask the kernel to report the datagrams it has dropped for our socket as ancillary data. This is the socket's drop count
+// (SO_RXQ_OVFL): datagrams dropped on our receive queue overflowing, and for a UDP socket those rejected by our socket
+// filter too. A rejected datagram never reaches us to carry the count, so we also wake every XRIPD_DROP_REPORT_INTERVAL
+// to pick it up directly (SO_MEMINFO) while only rejected datagrams are arriving:
+static int enable_drop_count(xripd_settings_t *xripd_settings) {
+
+	int enable = 1;
+	if ( setsockopt(xripd_settings->sd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == -1 ) {
+		return 1;
+	}
+
+	struct timeval timeout = { .tv_sec = XRIPD_DROP_REPORT_INTERVAL, .tv_usec = 0 };
+	if ( setsockopt(xripd_settings->sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ) {
+		return 1;
+	}
+
+	return 0;
+}
+
+// Read our socket's drop count directly, when no datagram has brought it to us:
+static void read_drop_count(xripd_settings_t *xripd_settings) {
+
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+
+	if ( getsockopt(xripd_settings->sd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 && len > SK_MEMINFO_DROPS * sizeof(uint32_t) ) {
+		xripd_settings->rxq_ovfl_drops = meminfo[SK_MEMINFO_DROPS];
+	}
+}
+
+// Report our socket's drop count if it has moved, at most once every XRIPD_DROP_REPORT_INTERVAL:
+static void report_drop_count(xripd_settings_t *xripd_settings, uint32_t *reported_drops, time_t *next_drop_report) {
+
+	if ( xripd_settings->rxq_ovfl_drops != *reported_drops && time(NULL) >= *next_drop_report ) {
+		fprintf(stderr, "[daemon]: Kernel has dropped %u datagram(s) for our socket, on receive queue overflow or by our socket filter (+%u since last report).\n",
+				xripd_settings->rxq_ovfl_drops, xripd_settings->rxq_ovfl_drops - *reported_drops);
+		*reported_drops = xripd_settings->rxq_ovfl_drops;
+		*next_drop_report = time(NULL) + XRIPD_DROP_REPORT_INTERVAL;
+	}
+}
+
+// Resolve our interface index, address and netmask into xripd_settings.
+// Called before fork(), so that both the daemon and the rib (which installs routes against
+// our interface, and decides whether a next hop is on-link) share the same view of it:
+static int init_interface(xripd_settings_t *xripd_settings) {
 
 	// Interface Request:
 	struct ifreq ifrq;
+	memset(&ifrq, 0, sizeof(ifrq));
+
+	// Any socket will do for our ioctls:
+	int sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if ( sd < 0 ) {
+		fprintf(stderr, "[daemon]: Error, Unable to open socket to query interface %s\n", xripd_settings->iface_name);
+		return 1;
+	}
+
+	// Xlate iface name to ifindex:
+	if ( get_iface_index(xripd_settings, sd, &ifrq) != 0 ) {
+		close(sd);
+		fprintf(stderr, "[daemon]: Error, Unable to identify interface by given string %s\n", xripd_settings->iface_name);
+		return 1;
+	}
+
+	// Acquire IP Address:
+	if ( ioctl(sd, SIOCGIFADDR, &ifrq)  == -1 ){
+		close(sd);
+		fprintf(stderr, "[daemon]: Error, Unable to get IP Address of %s\n", xripd_settings->iface_name);
+		return 1;
+	}
+	xripd_settings->self_ip = *((struct sockaddr_in *)&ifrq.ifr_addr);
+
+	// Acquire Netmask:
+	if ( ioctl(sd, SIOCGIFNETMASK, &ifrq)  == -1 ){
+		close(sd);
+		fprintf(stderr, "[daemon]: Error, Unable to get Netmask of %s\n", xripd_settings->iface_name);
+		return 1;
+	}
+	xripd_settings->iface_netmask = ((struct sockaddr_in *)&ifrq.ifr_netmask)->sin_addr.s_addr;
+
+#if XRIPD_DEBUG == 1
+	fprintf(stderr, "[daemon]: Interface %s (index %d), Self IP: %s", xripd_settings->iface_name, 
+			xripd_settings->iface_index, inet_ntoa(xripd_settings->self_ip.sin_addr));
+	fprintf(stderr, " Netmask: %s\n", inet_ntoa(((struct sockaddr_in *)&ifrq.ifr_netmask)->sin_addr));
+#endif
+
+	close(sd);
+	return 0;
+}
+
+// Create our AF_INET SOCK_DGRAM listening socket:
+static int init_socket(xripd_settings_t *xripd_settings) {
 
 	// Socket address vars:
 	uint16_t bind_port = RIP_UDP_PORT;
@@ -39,13 +182,6 @@ static int init_socket(xripd_settings_t *xripd_settings) {
 		return 1;
 	}
 
-	// Xlate iface name to ifindex:
-	if ( get_iface_index(xripd_settings, &ifrq) != 0 ) {
-		close(xripd_settings->sd);
-		fprintf(stderr, "[daemon]: Error, Unable to identify interface by given string %s\n", xripd_settings->iface_name);
-		return 1;
-	}
-
 	// Set SO_REUSEADDR onto the mcast socket:
 	int reuse = 1;
 	if ( setsockopt(xripd_settings->sd, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse, sizeof(reuse)) == -1 ){
@@ -54,17 +190,18 @@ static int init_socket(xripd_settings_t *xripd_settings) {
 		return 1;
 	}
 
-	// Acquire IP Address:
-	if ( ioctl(xripd_settings->sd, SIOCGIFADDR, &ifrq)  == -1 ){
+	// Filter out datagrams we will never process in the kernel:
+	if ( attach_socket_filter(xripd_settings) != 0 ) {
 		close(xripd_settings->sd);
-		fprintf(stderr, "[daemon]: Error, Unable to get IP Address of %s\n", xripd_settings->iface_name);
+		fprintf(stderr, "[daemon]: Error, Unable to attach socket filter to socket\n");
+		return 1;
+	}
+
+	// Count datagrams the kernel drops for our socket:
+	if ( enable_drop_count(xripd_settings) != 0 ) {
+		close(xripd_settings->sd);
+		fprintf(stderr, "[daemon]: Error, Unable to enable drop count on socket\n");
 		return 1;
-	} else {
-#if XRIPD_DEBUG == 1
-		xripd_settings->self_ip = *((struct sockaddr_in *)&ifrq.ifr_addr);
-		//fprintf(stderr, "__ MILES __ %s\n", inet_ntoa(((struct sockaddr_in *)&ifrq.ifr_addr)->sin_addr));
-		fprintf(stderr, "[daemon]: Self IP: %s\n", inet_ntoa(xripd_settings->self_ip.sin_addr));
-#endif
 	}
 
 	// Convert the presentation string for RIP_MCAST_IP into a network object:
@@ -83,7 +220,7 @@ static int init_socket(xripd_settings_t *xripd_settings) {
 
 	// Populate our mcast group ips:
 	mcast_group.imr_multiaddr.s_addr = inet_addr(RIP_MCAST_IP);
-	mcast_group.imr_interface.s_addr = ((struct sockaddr_in *)&ifrq.ifr_addr)->sin_addr.s_addr;
+	mcast_group.imr_interface.s_addr = xripd_settings->self_ip.sin_addr.s_addr;
 
 	// Add mcast membership for our RIPv2 MCAST group:
 	int ret = setsockopt(xripd_settings->sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *) &mcast_group, sizeof(mcast_group));
@@ -123,8 +260,17 @@ static xripd_settings_t *init_xripd_settings() {
 	xripd_settings->xripd_rib = NULL;
 	xripd_settings->filter_mode = XRIPD_FILTER_MODE_NULL; // Default Value
 
+	// Outbound pacing:
+	xripd_settings->pace_rate = XRIPD_PACE_RATE_DEFAULT;
+	xripd_settings->pace_burst = XRIPD_PACE_BURST_DEFAULT;
+
+	// Inbound policing:
+	xripd_settings->police_rate = XRIPD_POLICE_RATE_DEFAULT;
+	xripd_settings->police_burst = XRIPD_POLICE_BURST_DEFAULT;
+
 	// Init our rib and daemon mutexes:
-	pthread_mutex_init(&(xripd_settings->daemon_shared.mutex_request_flag), NULL);
+	pthread_mutex_init(&(xripd_settings->daemon_shared.mutex_request_queue), NULL);
+	pthread_mutex_init(&(xripd_settings->daemon_shared.mutex_filter), NULL);
 	pthread_mutex_init(&(xripd_settings->rib_shared.mutex_rib_lock), NULL);
 
 	return xripd_settings;
@@ -136,14 +282,16 @@ static int send_to_rib(xripd_settings_t *xripd_settings, rip_msg_entry_t *rip_en
 
 	// Create our rib_entry:
 	rib_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
 	memcpy(&(entry.recv_from), &recv_from, sizeof(struct sockaddr_in));
 	memcpy(&(entry.rip_msg_entry), rip_entry, sizeof(rip_msg_entry_t));
 
 	// Set our current time:
 	entry.recv_time = time(NULL);
 
-	// Remotely learnt route:
+	// Remotely learnt route, over our interface:
 	entry.origin = RIB_ORIGIN_REMOTE;
+	entry.ifindex = xripd_settings->iface_index;
 
 #if XRIPD_DEBUG == 1
 	fprintf(stderr, "[daemon]:\t\tSending RIP Entry to RIB\n");
@@ -156,6 +304,44 @@ static int send_to_rib(xripd_settings_t *xripd_settings, rip_msg_entry_t *rip_en
 	return 0;
 }
 
+// Parse a RIPv2 REQUEST message, and queue it up for the speaker thread to answer.
+// A request with a single entry of AFI 0 and Metric 16 is a request for our whole table,
+// otherwise it is a request for the specific entries listed:
+static int queue_request(xripd_settings_t *xripd_settings, const char *receive_buffer, int len, const struct sockaddr_in *source_address) {
+
+	xripd_request_t request;
+	memset(&request, 0, sizeof(request));
+	memcpy(&(request.request_from), source_address, sizeof(struct sockaddr_in));
+
+	// Pull out up to RIP_MAX_ENTRIES from the request:
+	int entries = (len - (int)sizeof(rip_msg_header_t)) / RIP_ENTRY_SIZE;
+	if ( entries <= 0 ) {
+		return 1;
+	}
+	if ( entries > RIP_MAX_ENTRIES ) {
+		entries = RIP_MAX_ENTRIES;
+	}
+	request.count = entries;
+	memcpy(request.entries, receive_buffer + sizeof(rip_msg_header_t), entries * sizeof(rip_msg_entry_t));
+
+	if ( entries == 1 && ntohs(request.entries[0].afi) == 0 &&
+		ntohl(request.entries[0].metric) == RIP_METRIC_INFINITY ) {
+		request.whole_table = 1;
+	}
+
+	// Queue safely using mutexes, drop the request if the speaker is falling behind:
+	pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_request_queue));
+	if ( xripd_settings->daemon_shared.request_count >= XRIPD_REQUEST_QUEUE_SIZE ) {
+		pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_request_queue));
+		return 1;
+	}
+	memcpy(&(xripd_settings->daemon_shared.request_queue[xripd_settings->daemon_shared.request_count]), &request, sizeof(request));
+	xripd_settings->daemon_shared.request_count++;
+	pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_request_queue));
+
+	return 0;
+}
+
 // Listen on our DGRAM socket, and parse messages recieved:
 static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 
@@ -164,17 +350,57 @@ static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 	memset(&receive_buffer, 0, RIP_DATAGRAM_SIZE);
 
 	struct sockaddr_in source_address;
-	uint32_t source_address_len = sizeof(source_address);
+
+	// recvmsg() structs, the kernel attaches its drop count for our socket (SO_RXQ_OVFL) as ancillary data:
+	struct msghdr msg;
+	struct iovec io_vec;
+	char cmsg_buffer[CMSG_SPACE(sizeof(uint32_t))];
+	struct cmsghdr *cmsg;
+
+	// When to next report our socket's drop count:
+	uint32_t reported_drops = 0;
+	time_t next_drop_report = 0;
+
+	// Source of our datagram, and our reference to the filter/policy while we parse it:
+	xripd_peer_t *peer = NULL;
+	filter_t *filter = NULL;
+	policy_t *policy = NULL;
+	policy_result_t policy_result;
 
 	while(1) {
 #if XRIPD_DEBUG == 1
 		fprintf(stderr, "[daemon]: Listening ...\n");
 		fflush(stderr);
 #endif
-		if ((len = recvfrom(xripd_settings->sd, receive_buffer, RIP_DATAGRAM_SIZE, 0, (struct sockaddr *)&source_address, &source_address_len)) == -1) {
-			perror("recv");
+		// Format our recvmsg structs:
+		memset(&msg, 0, sizeof(msg));
+		io_vec.iov_base = receive_buffer;
+		io_vec.iov_len = RIP_DATAGRAM_SIZE;
+		msg.msg_name = &source_address;
+		msg.msg_namelen = sizeof(source_address);
+		msg.msg_iov = &io_vec;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsg_buffer;
+		msg.msg_controllen = sizeof(cmsg_buffer);
+
+		if ((len = recvmsg(xripd_settings->sd, &msg, 0)) == -1) {
+			if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				// Nothing has reached us for a whole report interval:
+				read_drop_count(xripd_settings);
+				report_drop_count(xripd_settings, &reported_drops, &next_drop_report);
+			} else {
+				perror("recv");
+			}
 		} else {
 
+			// Pick up the kernel's drop count for our socket:
+			for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+				if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL ) {
+					memcpy(&(xripd_settings->rxq_ovfl_drops), CMSG_DATA(cmsg), sizeof(uint32_t));
+				}
+			}
+			report_drop_count(xripd_settings, &reported_drops, &next_drop_report);
+
 			// Protect against loops by NOT accepting traffic delivered to the daemon from itself:
 			// This is possible if the upstream switchport delivers multicast traffic back to the source port:
 			if ( xripd_settings->self_ip.sin_addr.s_addr == source_address.sin_addr.s_addr ) {
@@ -197,11 +423,27 @@ static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 					// Progressively scan through our buffer at interfaves of RIP_MESSAGE_SIZE
 					int len_remaining = len - sizeof(rip_msg_header_t);
 					int i = 0;
+					uint32_t entries = ( len_remaining > 0 ) ? len_remaining / RIP_ENTRY_SIZE : 0;
+					uint32_t allowed = 0;
 #if XRIPD_DEBUG == 1
 					fprintf(stderr, "[daemon]: Received RIPv2 RESPONSE Message (Command: %02X) from %s Total Message Size: %d Entry(ies) Size: %d\n", msg_header->command, source_address_p, len, len_remaining);
 #endif
-					while (i <= (len_remaining - RIP_ENTRY_SIZE)) {
+					// Police the peer that sent them first, entries over its rate are dropped before we do any work on them
+					// (or pass them on to the rib), so a flood from one neighbour is borne by that neighbour alone:
+					peer = xripd_peer_lookup(source_address.sin_addr.s_addr, time(NULL));
+					peer->rtes_received += entries;
+					allowed = xripd_peer_police(peer, entries);
+
+					// Routes denied by our filter (or inbound policy) are dropped here, rather than being passed across to the rib only to be dropped there.
+					// Counted against the peer that sent them:
+					pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_filter));
+					filter = filter_get(xripd_settings->xripd_rib->filter);
+					policy = policy_get(xripd_settings->xripd_rib->policy);
+					pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_filter));
+
+					while (i < (int)(allowed * RIP_ENTRY_SIZE)) {
 						rip_msg_entry_t *rip_entry = (rip_msg_entry_t *)(receive_buffer + sizeof(rip_msg_header_t) + i);
+						i += RIP_ENTRY_SIZE;
 #if XRIPD_DEBUG == 1
 						char ipaddr[16];
 						char subnet[16];
@@ -214,13 +456,31 @@ static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 								ntohs(rip_entry->afi), ipaddr, subnet, nexthop, ntohl(rip_entry->metric));
 #endif
 
+						if ( filter != NULL && filter_route(filter, rip_entry->ipaddr, rip_entry->subnet) != XRIPD_FILTER_RESULT_ALLOW ) {
+							peer->rtes_filtered++;
+							continue;
+						}
+
+						// Then through our inbound policy, which may rewrite the metric/tag of a route it permits:
+						if ( policy != NULL ) {
+							if ( policy_evaluate(policy, POLICY_DIR_IN, source_address.sin_addr.s_addr, rip_entry->ipaddr, rip_entry->subnet,
+									ntohl(rip_entry->metric), ntohs(rip_entry->tag), &policy_result) != POLICY_ACTION_PERMIT ) {
+								peer->rtes_filtered++;
+								continue;
+							}
+							policy_apply(&policy_result, rip_entry);
+						}
+
 						if (send_to_rib(xripd_settings, rip_entry, source_address) != 0) {
 #if XRIPD_DEBUG == 1
 							fprintf(stderr, "[daemon]: Unable to add entry to RIP-RIB!\n");
 #endif
 						}
-						i += RIP_ENTRY_SIZE;
 					}
+
+					filter_put(filter);
+					policy_put(policy);
+					xripd_peer_report(time(NULL));
 				} else if ( msg_header->command == RIP_HEADER_REQUEST ) {
 #if XRIPD_DEBUG == 1
 					fprintf(stderr, "[daemon]: RIPv2 REQUEST Message Received\n");
@@ -230,14 +490,13 @@ static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 						continue;
 					}
 
-					// Set request_flag safely using mutexes. rib_ctl/speaker thread, will check this
-					// and this is will trigger a full routing table update over the network
-					// Specific route updates are not supported:
-					pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_request_flag));
-					if (xripd_settings->daemon_shared.request_flag != 1) {
-						xripd_settings->daemon_shared.request_flag = 1;
+					// Queue the request for the rib_ctl/speaker thread, which will unicast
+					// our answer back to the requestor:
+					if ( queue_request(xripd_settings, receive_buffer, len, &source_address) != 0 ) {
+#if XRIPD_DEBUG == 1
+						fprintf(stderr, "[daemon]: Unable to queue RIPv2 REQUEST from %s\n", source_address_p);
+#endif
 					}
-					pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_request_flag));
 
 
 				} else {
@@ -255,31 +514,207 @@ static int xripd_listen_loop(xripd_settings_t *xripd_settings) {
 	return 0;
 }
 
+// Reload our copy of the filter and policy (applied to inbound routes by the listener).
+// As in the rib, both are swapped in or neither is:
+static void daemon_filter_reload(xripd_settings_t *xripd_settings) {
+
+	filter_t *new_filter = NULL;
+	filter_t *old_filter = NULL;
+	policy_t *new_policy = NULL;
+	policy_t *old_policy = NULL;
+
+	if ( xripd_settings->xripd_rib->filter != NULL ) {
+		new_filter = load_filter(xripd_settings->filter_mode, xripd_settings->filter_file, xripd_settings->filter_cache);
+		if ( new_filter == NULL ) {
+			fprintf(stderr, "[daemon]: Unable to reload filter file, keeping our current filter and policy.\n");
+			return;
+		}
+	}
+	if ( xripd_settings->xripd_rib->policy != NULL ) {
+		new_policy = load_policy(xripd_settings->policy_file);
+		if ( new_policy == NULL ) {
+			fprintf(stderr, "[daemon]: Unable to reload policy file, keeping our current filter and policy.\n");
+			filter_put(new_filter);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&(xripd_settings->daemon_shared.mutex_filter));
+	if ( new_filter != NULL ) {
+		old_filter = xripd_settings->xripd_rib->filter;
+		xripd_settings->xripd_rib->filter = new_filter;
+	}
+	if ( new_policy != NULL ) {
+		old_policy = xripd_settings->xripd_rib->policy;
+		xripd_settings->xripd_rib->policy = new_policy;
+	}
+	pthread_mutex_unlock(&(xripd_settings->daemon_shared.mutex_filter));
+
+	// Destroyed now, or once the listener is done with them:
+	filter_put(old_filter);
+	policy_put(old_policy);
+}
+
+// Entry point for our SIGHUP thread. Reload our own copy of the filter/policy, then pass SIGHUP on
+// to the rib to reload its own (ours goes first, so the rib is not sent routes its new filter denies):
+static void *sighup_spawn(void *arg) {
+
+	xripd_settings_t *xripd_settings = (xripd_settings_t *)arg;
+	sigset_t sighup;
+	int sig = 0;
+
+	sigemptyset(&sighup);
+	sigaddset(&sighup, SIGHUP);
+
+	while ( sigwait(&sighup, &sig) == 0 ) {
+		fprintf(stderr, "[daemon]: Received SIGHUP, reloading filter and policy.\n");
+		daemon_filter_reload(xripd_settings);
+		kill(xripd_settings->rib_pid, SIGHUP);
+	}
+	return NULL;
+}
+
 // Print usage and pass exit status on:
 static void print_usage(int ret) {
 
-	fprintf(stderr, "usage: xripd [-h] [-bw <filename>] [-p] -i <interface>\n");
+	fprintf(stderr, "usage: xripd [-h] [-bw <filename>] [-C <cachefile>] [-P <policyfile>] [-p] [-r <rate>[:<burst>]] [-l <rate>[:<burst>]] [-m <max>[:warn|stop|purge]] -i <interface>\n");
 
 	fprintf(stderr, "params:\n");
        	fprintf(stderr, "\t-i <interface>\t Bind RIP daemon to network interface\n");
        	fprintf(stderr, "\t-b\t\t Read Blacklist from <filename>\n");
        	fprintf(stderr, "\t-w\t\t Read Whielist from <filename>\n");
+       	fprintf(stderr, "\t-C\t\t Keep the compiled filter in <cachefile>, reused while <filename> is unchanged\n");
+       	fprintf(stderr, "\t-P\t\t Read route policy from <policyfile>\n");
        	fprintf(stderr, "\t-p\t\t Enable Passive Mode (Don't generate RIPv2 Messages onto the network)\n");
+       	fprintf(stderr, "\t-r\t\t Pace outbound datagrams to <rate>/sec, in bursts of up to <burst> (0 = unpaced, default %d:%d)\n",
+			XRIPD_PACE_RATE_DEFAULT, XRIPD_PACE_BURST_DEFAULT);
+       	fprintf(stderr, "\t-l\t\t Police route entries from each neighbour to <rate>/sec, in bursts of up to <burst> (0 = unpoliced, default %d:%d)\n",
+			XRIPD_POLICE_RATE_DEFAULT, XRIPD_POLICE_BURST_DEFAULT);
+       	fprintf(stderr, "\t-m\t\t Hold at most <max> routes from each neighbour, then warn, stop accepting new routes (default) or purge it\n");
        	fprintf(stderr, "\t-h\t\t Display this help message\n");
 	fprintf(stderr, "filter:\n");
        	fprintf(stderr, "\t - filter file may contain zero or more routes to be white/blacklisted from the RIB\n");
-       	fprintf(stderr, "\t - 1 route per line in file, in the format of x.x.x.x y.y.y.y\n");
+       	fprintf(stderr, "\t - 1 route per line in file, in the format of x.x.x.x y.y.y.y or x.x.x.x/n, optionally followed by ge n and/or le n\n");
+       	fprintf(stderr, "\t - without ge/le a line matches that exact route, ge/le match a range of lengths under it (as a prefix-list),\n");
+       	fprintf(stderr, "\t   ie. 10.0.0.0/8 le 32 matches 10.0.0.0/8 and everything longer within it\n");
+       	fprintf(stderr, "\t - duplicate routes, blank lines and # comments are ignored\n");
+	fprintf(stderr, "policy:\n");
+       	fprintf(stderr, "\t - 1 rule per line: <in|out> <neighbour|any> <permit|deny> [prefix x.x.x.x/n [ge n] [le n]] [tag n] [metric n[-n]]\n");
+       	fprintf(stderr, "\t   [set-metric +/-n] [set-tag n]\n");
+       	fprintf(stderr, "\t - the first rule matching a route decides it, routes matching no rule are permitted as is\n");
+       	fprintf(stderr, "\t - out rules apply to every neighbour (any) as our updates are multicast\n");
 	fprintf(stderr, "\n");
 	exit(ret);
 }
 
+// Parse our pacing argument, in the form of <rate>[:<burst>]:
+static int parse_pace(xripd_settings_t *xripd_settings, const char *arg) {
+
+	char *end = NULL;
+	unsigned long rate = 0;
+	unsigned long burst = XRIPD_PACE_BURST_DEFAULT;
+
+	rate = strtoul(arg, &end, 10);
+	if ( end == arg || rate > UINT16_MAX ) {
+		fprintf(stderr, "[daemon]: Invalid pacing rate: %s\n", arg);
+		return 1;
+	}
+
+	if ( *end == ':' ) {
+		arg = end + 1;
+		burst = strtoul(arg, &end, 10);
+		if ( end == arg || burst == 0 || burst > UINT16_MAX ) {
+			fprintf(stderr, "[daemon]: Invalid pacing burst: %s\n", arg);
+			return 1;
+		}
+	}
+
+	if ( *end != '\0' ) {
+		fprintf(stderr, "[daemon]: Invalid pacing argument\n");
+		return 1;
+	}
+
+	xripd_settings->pace_rate = (uint16_t)rate;
+	xripd_settings->pace_burst = (uint16_t)burst;
+
+	return 0;
+}
+
+// Parse our policing argument, in the form of <rate>[:<burst>]:
+static int parse_police(xripd_settings_t *xripd_settings, const char *arg) {
+
+	char *end = NULL;
+	unsigned long rate = 0;
+	unsigned long burst = XRIPD_POLICE_BURST_DEFAULT;
+
+	rate = strtoul(arg, &end, 10);
+	if ( end == arg || rate > UINT32_MAX ) {
+		fprintf(stderr, "[daemon]: Invalid policing rate: %s\n", arg);
+		return 1;
+	}
+
+	if ( *end == ':' ) {
+		arg = end + 1;
+		burst = strtoul(arg, &end, 10);
+		if ( end == arg || burst == 0 || burst > UINT32_MAX ) {
+			fprintf(stderr, "[daemon]: Invalid policing burst: %s\n", arg);
+			return 1;
+		}
+	}
+
+	if ( *end != '\0' ) {
+		fprintf(stderr, "[daemon]: Invalid policing argument\n");
+		return 1;
+	}
+
+	xripd_settings->police_rate = (uint32_t)rate;
+	xripd_settings->police_burst = (uint32_t)burst;
+
+	return 0;
+}
+
+// Parse our maximum prefix argument, in the form of <max>[:warn|stop|purge]:
+static int parse_max_prefix(xripd_settings_t *xripd_settings, const char *arg) {
+
+	char *end = NULL;
+	unsigned long max = 0;
+	uint8_t action = XRIPD_MAX_PREFIX_STOP;
+
+	max = strtoul(arg, &end, 10);
+	if ( end == arg || max > UINT32_MAX ) {
+		fprintf(stderr, "[daemon]: Invalid maximum prefix count: %s\n", arg);
+		return 1;
+	}
+
+	if ( *end == ':' ) {
+		if ( strcmp(end + 1, "warn") == 0 ) {
+			action = XRIPD_MAX_PREFIX_WARN;
+		} else if ( strcmp(end + 1, "stop") == 0 ) {
+			action = XRIPD_MAX_PREFIX_STOP;
+		} else if ( strcmp(end + 1, "purge") == 0 ) {
+			action = XRIPD_MAX_PREFIX_PURGE;
+		} else {
+			fprintf(stderr, "[daemon]: Invalid maximum prefix action: %s\n", end + 1);
+			return 1;
+		}
+	} else if ( *end != '\0' ) {
+		fprintf(stderr, "[daemon]: Invalid maximum prefix argument\n");
+		return 1;
+	}
+
+	xripd_settings->max_prefix = (uint32_t)max;
+	xripd_settings->max_prefix_action = action;
+
+	return 0;
+}
+
 // Function to parse command line arguments
 static int parse_args(xripd_settings_t *xripd_settings, int *argc, char **argv) {
 
 	int option_index = 0;
 	int index_count = 0;
 
-	while ((option_index = getopt(*argc, argv, "i:b:w:hp")) != -1) {
+	while ((option_index = getopt(*argc, argv, "i:b:w:hpr:l:m:C:P:")) != -1) {
 		switch(option_index) {
 			case 'i':
 				strcpy(xripd_settings->iface_name, optarg);
@@ -292,9 +727,30 @@ static int parse_args(xripd_settings_t *xripd_settings, int *argc, char **argv)
 				xripd_settings->filter_mode = XRIPD_FILTER_MODE_WHITELIST;
 				strcpy(xripd_settings->filter_file, optarg);
 				break;
+			case 'C':
+				snprintf(xripd_settings->filter_cache, sizeof(xripd_settings->filter_cache), "%s", optarg);
+				break;
+			case 'P':
+				snprintf(xripd_settings->policy_file, sizeof(xripd_settings->policy_file), "%s", optarg);
+				break;
 			case 'p':
 				xripd_settings->passive_mode = XRIPD_PASSIVE_MODE_ENABLE;
 				break;
+			case 'r':
+				if ( parse_pace(xripd_settings, optarg) != 0 ) {
+					print_usage(1);
+				}
+				break;
+			case 'l':
+				if ( parse_police(xripd_settings, optarg) != 0 ) {
+					print_usage(1);
+				}
+				break;
+			case 'm':
+				if ( parse_max_prefix(xripd_settings, optarg) != 0 ) {
+					print_usage(1);
+				}
+				break;
 			case 'h':
 				print_usage(0);
 			default:
@@ -355,11 +811,22 @@ int main(int argc, char **argv) {
 		shutdown_process(xripd_settings, 1);
 	}
 
+	// Resolve our interface, prior to fork() so the rib sees it too:
+	if ( init_interface(xripd_settings) != 0 ) {
+		shutdown_process(xripd_settings, 1);
+	}
+
 	// Init our RIB with a specific datastore:
 	if ( init_rib(xripd_settings, XRIPD_RIB_DATASTORE_LINKEDLIST) != 0) {
 		shutdown_process(xripd_settings, 1);
 	}
 
+	// Hold SIGHUP (filter reload) in every thread of both processes, each collects it in a thread of its own:
+	sigset_t sighup;
+	sigemptyset(&sighup);
+	sigaddset(&sighup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sighup, NULL);
+
 	// Fork:
 	pid_t rib_f = fork();
 
@@ -371,6 +838,11 @@ int main(int argc, char **argv) {
 
 		// Close reading end of rib_in pipe:
 		close(xripd_settings->p_rib_in[0]);
+
+		// Reload our filter on SIGHUP, passing it on to the rib:
+		xripd_settings->rib_pid = rib_f;
+		pthread_t sighup_thread;
+		pthread_create(&sighup_thread, NULL, &sighup_spawn, (void *)xripd_settings);
 		
 		// Our listening socket for inbound RIPv2 packets:
 		if ( init_socket(xripd_settings) != 0) {
@@ -390,7 +862,8 @@ int main(int argc, char **argv) {
 #endif
 		}
 
-		// Main Listening Loop
+		// Main Listening Loop, policing what we hear from each neighbour:
+		xripd_peer_police_init(xripd_settings->police_rate, xripd_settings->police_burst);
 		xripd_listen_loop(xripd_settings);
 
 		// SHOULD NEVER REACH:
@@ -413,6 +886,10 @@ int main(int argc, char **argv) {
 		if ( init_netlink(xripd_settings) != 0) {
 			shutdown_process(xripd_settings, 1);
 		}
+
+		if ( init_netlink_monitor(xripd_settings) != 0) {
+			shutdown_process(xripd_settings, 1);
+		}
 		
 		// Main loop for the RIB:
 		rib_main_loop(xripd_settings);
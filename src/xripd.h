@@ -4,12 +4,14 @@
 // Standard Includes:
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
 
 #include <getopt.h>
 
@@ -20,6 +22,8 @@
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
 #include <arpa/inet.h>
 
 #include <pthread.h>
@@ -30,6 +34,23 @@
 
 #define XRIPD_ENTRIES_PER_UPDATE 4
 
+// Maximum RIPv2 REQUEST messages queued for the speaker to answer:
+#define XRIPD_REQUEST_QUEUE_SIZE 8
+
+// Default pacing of our outbound datagrams (datagrams/sec, and burst size):
+#define XRIPD_PACE_RATE_DEFAULT 50
+#define XRIPD_PACE_BURST_DEFAULT 16
+
+// Default policing of the route entries we accept from each neighbour (entries/sec, and burst size).
+// The burst allows for a couple of full tables at once, the rate for a full table every update interval:
+#define XRIPD_POLICE_RATE_DEFAULT 1000
+#define XRIPD_POLICE_BURST_DEFAULT 25000
+
+// What to do with a neighbour that sends us more than max_prefix routes (max_prefix_action):
+#define XRIPD_MAX_PREFIX_WARN 0x00 // Log it, and carry on accepting its routes
+#define XRIPD_MAX_PREFIX_STOP 0x01 // Refuse any new routes from it, until it is back under
+#define XRIPD_MAX_PREFIX_PURGE 0x02 // Invalidate every route from it, and refuse its routes for a route_flush period
+
 #define XRIPD_PASSIVE_MODE_DISABLE 0x00
 #define XRIPD_PASSIVE_MODE_ENABLE 0x01
 
@@ -41,6 +62,7 @@
 
 #define RIP_DATAGRAM_SIZE 512
 #define RIP_ENTRY_SIZE 20
+#define RIP_MAX_ENTRIES 25 // (RIP_DATAGRAM_SIZE - Header) / RIP_ENTRY_SIZE
 
 #define RIP_METRIC_INFINITY 16
 
@@ -58,8 +80,32 @@
 #define RIP_TIMER_HOLDDOWN_DEFAULT 180 
 #define RIP_TIMER_FLUSH_DEFAULT 200 
 
+// Triggered updates are held off for a random 1-5 seconds (RFC 2453 3.10.1),
+// to batch further changes into the same update:
+#define RIP_TRIGGERED_HOLDOFF_MIN 1
+#define RIP_TRIGGERED_HOLDOFF_MAX 5
+
 #define RIP_SPLIT_HORIZON_ENABLE 0x01
 
+// https://tools.ietf.org/html/rfc2453
+// RIP Message Format:
+// RIP Header:
+typedef struct rip_msg_header_t {
+	uint8_t command;
+	uint8_t version;
+	uint16_t zero;
+} rip_msg_header_t;
+
+// Each RIP Message may include 1-25 RIP Entries (RTEs):
+typedef struct rip_msg_entry_t {
+	uint16_t afi;
+	uint16_t tag;
+	uint32_t ipaddr;
+	uint32_t subnet;
+	uint32_t nexthop;
+	uint32_t metric;
+} rip_msg_entry_t;
+
 typedef struct rip_timers_t {
 	
 	// Update: Rate at which updates are sent:
@@ -78,12 +124,25 @@ typedef struct rip_timers_t {
 	uint16_t route_flush;
 } rip_timers_t;
 
+// A RIPv2 REQUEST message, as parsed by the listener for the speaker to answer:
+typedef struct xripd_request_t {
+	struct sockaddr_in request_from;	// Requestor's address and port, replies are unicast back to here
+	uint8_t whole_table;			// Single AFI 0, Metric 16 entry: Request for our entire table
+	uint8_t count;				// Number of specific entries requested
+	rip_msg_entry_t entries[RIP_MAX_ENTRIES];
+} xripd_request_t;
+
 // Shared Memory Access between the 2 daemon threads, listener and speaker/rib_ctl:
 typedef struct daemon_shared_t {
 
-	// Have we recieved a RIPv2 REQUEST message?
-	pthread_mutex_t mutex_request_flag;
-	uint8_t request_flag;
+	// RIPv2 REQUEST messages recieved by the listener, waiting to be answered by the speaker:
+	pthread_mutex_t mutex_request_queue;
+	xripd_request_t request_queue[XRIPD_REQUEST_QUEUE_SIZE];
+	uint8_t request_count;
+
+	// Our copy of the filter and policy (xripd_rib->filter/policy, as loaded before fork()), applied to inbound routes by the listener.
+	// Swapped under mutex_filter on a reload:
+	pthread_mutex_t mutex_filter;
 
 } daemon_shared_t;
 
@@ -93,6 +152,12 @@ typedef struct rib_shared_t {
 	// Lock access to the rib:
 	pthread_mutex_t mutex_rib_lock;
 
+	// Triggered updates. Raised (under mutex_rib_lock) when the rib has changed routes to advertise,
+	// the rib-out thread is woken up by a byte written into p_trigger:
+	uint8_t trigger_flag;
+	uint8_t trigger_urgent; // Changes follow the loss of a link/address, send without holdoff
+	int p_trigger[2];
+
 } rib_shared_t;
 
 // Daemon Settings Structure:
@@ -101,20 +166,33 @@ typedef struct xripd_settings_t {
 	// Sockets:
 	uint8_t sd; 			// Socket Descriptor (for inbound RIP Packets)
 	uint8_t nlsd;			// Netlink Socket Descriptor (for route table manipulation)
+	int nlfib_sd;			// Netlink Socket Descriptor owned by the FIB writer thread (route installs/deletes)
+	int nlmon_sd;			// Netlink Socket Descriptor subscribed to kernel IPv4 route changes (RTMGRP_IPV4_ROUTE)
 
 	uint8_t passive_mode;		// Enable Passive Flag (aka do not advertise on net)
 	struct sockaddr_in self_ip;	// Self IP of interface daemon is bound to. Do not accept inbound rip updates when source = self_ip (loop avoidance)
+	uint32_t rxq_ovfl_drops;	// Datagrams the kernel dropped for our socket, receive queue overflows and socket filter rejections (SO_RXQ_OVFL)
+	uint16_t pace_rate;		// Outbound datagrams per second (0 = unpaced)
+	uint16_t pace_burst;		// Outbound datagrams that may be sent back to back
+	uint32_t police_rate;		// Inbound route entries per second, per neighbour (0 = unpoliced)
+	uint32_t police_burst;		// Inbound route entries a neighbour may send back to back
+	uint32_t max_prefix;		// Most reachable routes the rib holds from any one neighbour (0 = unlimited)
+	uint8_t max_prefix_action;	// XRIPD_MAX_PREFIX_*
 	
 	// Interfaces:
 	char iface_name[IFNAMSIZ]; 	// Human String for an interface, ie. "eth3" or "enp0s3"
-	uint8_t iface_index; 		// Kernel index id for interface
+	int iface_index; 		// Kernel index id for interface
+	uint32_t iface_netmask;		// Netmask of our interface (network order), used to decide if a next hop is on-link
 
 	// RIB:
 	struct xripd_rib_t *xripd_rib;		// Pointer to RIB
 	int p_rib_in[2];		// Pipe for Listener -> RIB
+	pid_t rib_pid;			// Our xripd-rib process (SIGHUP is passed on to it)
 	
 	// Filter:
 	char filter_file[64];		// Filename for the filterfile
+	char filter_cache[64];		// Filename for the compiled filter image (optional)
+	char policy_file[64];		// Filename for the route policy (optional)
 	uint8_t filter_mode;		// Whitelist or Blacklist?
 
 	// Timers:
@@ -126,23 +204,4 @@ typedef struct xripd_settings_t {
 
 } xripd_settings_t;
 
-// https://tools.ietf.org/html/rfc2453
-// RIP Message Format:
-// RIP Header:
-typedef struct rip_msg_header_t {
-	uint8_t command;
-	uint8_t version;
-	uint16_t zero;
-} rip_msg_header_t;
-
-// Each RIP Message may include 1-25 RIP Entries (RTEs):
-typedef struct rip_msg_entry_t {
-	uint16_t afi;
-	uint16_t tag;
-	uint32_t ipaddr;
-	uint32_t subnet;
-	uint32_t nexthop;
-	uint32_t metric;
-} rip_msg_entry_t;
-
 #endif